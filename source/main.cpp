@@ -6,11 +6,31 @@
 #include "radio_comms.h"
 #include "mb_images.h"
 #include "main.h"
+#include "profiler.h"
 
 MicroBit uBit;
 
-// Configure how many milliseconds to leave as a buffer for accurate periodic messages
-static const int PERIODIC_BUFFER_MS = 9;
+// Time before a periodic message deadline when no new commands are processed,
+// enough to send the longest response without delaying the periodic message,
+// at SBP_DEFAULT_BAUDRATE and scaled down at faster baud rates
+static const CODAL_TIMESTAMP PERIODIC_RESERVED_US = 3000;
+static CODAL_TIMESTAMP periodic_reserved_us = PERIODIC_RESERVED_US;
+
+// Size of the CODAL serial RX and TX buffers at SBP_DEFAULT_BAUDRATE, scaled up
+// at faster baud rates to hold the same time worth of data, up to UINT8_MAX
+static const size_t SERIAL_BUFFER_LEN = 168;
+
+// Deadlines closer than this are busy waited, as the timer event could fire
+// before the main fiber starts waiting for it
+static const CODAL_TIMESTAMP SCHEDULER_SPIN_US = 100;
+
+// Event used to wake up the main fiber, any component ID not used by CODAL
+static const uint16_t SCHEDULER_EVT_ID = 9500;
+static const uint16_t SCHEDULER_EVT_DEADLINE = 1;
+static const uint16_t SCHEDULER_EVT_SERIAL = 2;
+static const uint16_t SCHEDULER_EVT_CAPTURE = 3;
+static const uint16_t SCHEDULER_EVT_TX = 4;
+static const uint16_t SCHEDULER_EVT_BAUD = 5;
 
 // Last 1 KB of flash where we can store the radio frequency and/or remote micro:bit ID
 const uint32_t REMOTE_MB_ID_ADDR = 0x0007FC00;
@@ -18,6 +38,132 @@ const uint32_t REMOTE_MB_ID_ADDR = 0x0007FC00;
 // The sensor data instance to hold the latest sensor values
 static sbp_sensor_data_t sensor_data = { };
 
+// Runtime counters in the protocol state, for the STATS command
+static sbp_runtime_stats_t *runtime_stats = NULL;
+
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+// With the MSTART command the latest sensor data from every remote micro:bit
+// is kept, in the same index as the radio bridge list of remote micro:bits
+static bool radio_multi_remote = false;
+static sbp_sensor_data_t remote_sensor_data[RADIO_REMOTES_LEN];
+// When the serial port can't send a message for every remote micro:bit in a
+// period, the next deadline starts from the first one left out. The messages
+// are all the same length, so the last one tells how many fit.
+static size_t radio_multi_next_index = 0;
+static size_t radio_multi_msg_len = 0;
+
+// The samples from the active remote micro:bit wait here to be released with
+// the same spacing they were captured with, so that the samples that arrive
+// together in a multi-sample packet are sent in consecutive periodic messages
+typedef struct radio_playout_s {
+    CODAL_TIMESTAMP release_us;
+    sbp_sensor_data_t data;
+} radio_playout_t;
+static const size_t RADIO_PLAYOUT_LEN = 2 * RADIO_BATCH_SAMPLES_MAX;
+// Capture spacing larger than this is a gap in the samples, not kept in the playout
+static const uint32_t RADIO_PLAYOUT_MAX_SPACING_US = 100000;
+static radio_playout_t radio_playout[RADIO_PLAYOUT_LEN];
+static size_t radio_playout_head = 0;
+static size_t radio_playout_len = 0;
+
+// The remote micro:bits sample at the bridge period, sent to them again when
+// it changes, and every few seconds as the radio commands can be lost and the
+// clocks drift apart
+static const CODAL_TIMESTAMP RADIO_PERIOD_RESYNC_US = 5000000;
+static bool radio_period_sync = true;
+static uint32_t radio_period_mb_id = 0;
+static uint32_t radio_period_ms = 0;
+static CODAL_TIMESTAMP radio_period_sent_us = 0;
+
+// In the change-driven mode the remote micro:bits only send the samples that
+// change, so the last one is held as fresh for up to two heartbeats, to allow
+// for a lost heartbeat packet
+static uint32_t radio_hold_us = 0;
+
+// With the RSLOT command a beacon starts each time-slotted frame, sent on a
+// periodic deadline, and the remote micro:bits send their packets in their
+// own slot after it
+static bool radio_slots = false;
+static CODAL_TIMESTAMP radio_beacon_next_us = 0;
+#endif
+
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+// The sampling fiber wakes up once per period, this long before each deadline
+// or half a period with the shorter ones, and reads each enabled sensor when
+// its own sampling period has elapsed
+static const CODAL_TIMESTAMP SAMPLING_LEAD_US = 4000;
+static const uint32_t SAMPLING_TEMPERATURE_MS = 1000;
+// Fibers are cooperative, so the main fiber can't send a periodic message
+// while the sensors are being read, no sampling starts this close to a deadline,
+// or a quarter of the period with the shorter ones
+static const CODAL_TIMESTAMP SAMPLING_GUARD_US = 2000;
+// Event used to wake up the sampling fiber
+static const uint16_t SAMPLING_EVT_ID = 9502;
+static const uint16_t SAMPLING_EVT_TIMER = 1;
+static const uint16_t SAMPLING_EVT_START = 2;
+
+// Latest values from the sampling fiber, double buffered: the fiber writes the
+// next sample into the slot not being read, which can take several yields on
+// the I2C reads, and then publishes it by incrementing sampled_seq. Fibers are
+// cooperative, so a copy of the published slot is never interrupted by a write.
+static sbp_sensor_data_t sampled_data[2];
+static volatile uint32_t sampled_seq = 0;
+// The sampled_seq value when the periodic messages were started
+static uint32_t sampled_seq_start = 0;
+// The sampled_seq value of the last sample read by updateSensorData()
+static uint32_t sampled_seq_read = 0;
+// The protocol state with the sensors to sample, owned by the main fiber
+static const sbp_state_t *sampling_state = NULL;
+// The next periodic message deadline, set by the main fiber as soon as the
+// previous one is serviced
+static CODAL_TIMESTAMP sampling_deadline_us = 0;
+
+// Accelerometer burst capture (CAP command), sampled on a periodic timer event
+// into RAM, and sent by the main loop as binary frames once it finishes
+static const uint16_t CAPTURE_EVT_ID = 9501;
+static const uint16_t CAPTURE_EVT_SAMPLE = 1;
+typedef enum capture_state_e {
+    CAPTURE_IDLE,
+    CAPTURE_SAMPLING,
+    CAPTURE_SENDING,
+} capture_state_t;
+static capture_state_t capture_state = CAPTURE_IDLE;
+static int16_t capture_data[SBP_CMD_CAPTURE_SAMPLES_MAX][3];
+static uint16_t capture_samples = 0;
+static uint16_t capture_len = 0;
+static uint16_t capture_sent = 0;
+static int capture_original_period_ms = 0;
+
+// The accelerometer period before the batched binary mode sped it up to the
+// periodic message period, or 0 if it hasn't
+static int batch_original_period_ms = 0;
+#endif
+
+// Samples buffered to be sent together in a batched binary periodic message
+static sbp_sensor_data_t batch_samples[SBP_CMD_BATCH_MAX];
+static size_t batch_samples_len = 0;
+
+// Parser for the commands received via serial, fed directly from the RX buffer
+static sbp_cmd_parser_t cmd_parser = { };
+
+// Serial TX queue, every message is encoded into the serial_data buffer and
+// then copied whole into this ring, which is drained into the CODAL TX buffer
+// without waiting for the transmission. So the next message can be encoded,
+// and commands processed, while the previous one is being sent, and as all
+// the messages go through the queue, a response never lands in the middle of
+// a periodic message.
+static const size_t SERIAL_TX_QUEUE_LEN = 512;
+static uint8_t serial_tx_queue[SERIAL_TX_QUEUE_LEN];
+static size_t serial_tx_head = 0;
+static size_t serial_tx_len = 0;
+
+// Current UART baud rate, and the one requested by a BAUD command, switched to
+// once its response has been sent. The switch has to be confirmed by the host
+// before serial_baud_confirm_us, or it is reverted to SBP_DEFAULT_BAUDRATE.
+static uint32_t serial_baudrate = SBP_DEFAULT_BAUDRATE;
+static uint32_t serial_baud_switch = 0;
+static CODAL_TIMESTAMP serial_baud_confirm_us = 0;
+
 // Function declarations
 uint32_t getRemoteMbId();
 
@@ -33,26 +179,162 @@ static inline uint32_t getActiveRemoteMbId() {
 #endif
 }
 
+/**
+ * @brief Copies the sensor data from a radio packet, as fresh data.
+ *
+ * @param radio_packet The sensor data packet received via radio.
+ * @param data The sensor data to update.
+ */
+static void setRadioSensorData(const radio_packet_t *radio_packet, sbp_sensor_data_t *data) {
+    const radio_sensor_data_t *radio_sensor_data = &radio_packet->sensor_data;
+    data->timestamp_us = (uint32_t)system_timer_current_time_us();
+    data->remote_timestamp_us = radio_sensor_data->capture_time_us;
+    data->accelerometer_x = radio_sensor_data->accelerometer_x;
+    data->accelerometer_y = radio_sensor_data->accelerometer_y;
+    data->accelerometer_z = radio_sensor_data->accelerometer_z;
+    data->button_a = radio_sensor_data->button_a;
+    data->button_b = radio_sensor_data->button_b;
+    data->button_logo = radio_sensor_data->button_logo;
+    data->fresh_data = true;
+}
+
+/**
+ * @brief Adds a sample from the active remote micro:bit to the playout, to
+ * be released a capture period after the previous one, or straight away if
+ * the playout has caught up.
+ *
+ * @param radio_packet The sensor data packet received via radio.
+ */
+static void radioPlayoutPush(const radio_packet_t *radio_packet) {
+    const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+    CODAL_TIMESTAMP release_us = now_us;
+    if (radio_playout_len == RADIO_PLAYOUT_LEN) {
+        // The oldest sample is superseded by the next one released
+        sensor_data = radio_playout[radio_playout_head].data;
+        radio_playout_head = (radio_playout_head + 1) % RADIO_PLAYOUT_LEN;
+        radio_playout_len--;
+    }
+    if (radio_playout_len > 0) {
+        const radio_playout_t *last = &radio_playout[(radio_playout_head + radio_playout_len - 1) % RADIO_PLAYOUT_LEN];
+        const uint32_t spacing_us = radio_packet->sensor_data.capture_time_us - last->data.remote_timestamp_us;
+        if (spacing_us <= RADIO_PLAYOUT_MAX_SPACING_US && (last->release_us + spacing_us) > now_us) {
+            release_us = last->release_us + spacing_us;
+        }
+    }
+
+    radio_playout_t *entry = &radio_playout[(radio_playout_head + radio_playout_len) % RADIO_PLAYOUT_LEN];
+    entry->release_us = release_us;
+    entry->data = sensor_data;
+    radio_seq_stats_t seq_stats;
+    if (radiobridge_getRemoteSeqStats(radio_packet->mb_id, &seq_stats) == MICROBIT_OK) {
+        entry->data.radio_lost = seq_stats.lost;
+    }
+    setRadioSensorData(radio_packet, &entry->data);
+    radio_playout_len++;
+}
+
+/**
+ * @brief Moves the latest sample due from the playout into the sensor data.
+ *
+ * @param data The sensor data to update.
+ */
+static void radioPlayoutRelease(sbp_sensor_data_t *data) {
+    const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+    while (radio_playout_len > 0 && radio_playout[radio_playout_head].release_us <= now_us) {
+        *data = radio_playout[radio_playout_head].data;
+        radio_playout_head = (radio_playout_head + 1) % RADIO_PLAYOUT_LEN;
+        radio_playout_len--;
+    }
+}
+
+/**
+ * @brief Marks the last sensor data from a remote micro:bit as fresh again in
+ * the change-driven mode, until it is older than the hold time.
+ *
+ * @param data The sensor data, already sent if it isn't fresh.
+ *
+ * @return True if the sensor data is fresh.
+ */
+static bool radioHoldLastValue(sbp_sensor_data_t *data) {
+    if (data->fresh_data) return true;
+    // The timestamp is cleared by the start commands, to not hold older data
+    if (radio_hold_us == 0 || data->timestamp_us == 0) return false;
+    data->fresh_data = ((uint32_t)system_timer_current_time_us() - data->timestamp_us) <= radio_hold_us;
+    return data->fresh_data;
+}
+
+/**
+ * @brief Sends the bridge period to the active remote micro:bit, with the time
+ * until the next deadline, so that it samples just before it. In the multi
+ * remote mode all of them get the period, but they keep their own phase, to
+ * not send their packets at the same time.
+ *
+ * @param protocol_state The protocol state with the period.
+ * @param next_deadline_us The next periodic message deadline.
+ */
+static void syncRemotePeriod(const sbp_state_t *protocol_state, const CODAL_TIMESTAMP next_deadline_us) {
+    const uint32_t mb_id = radio_multi_remote ? 0 : getActiveRemoteMbId();
+    if (!radio_multi_remote && mb_id == 0) return;
+
+    const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+    if (!radio_period_sync && mb_id == radio_period_mb_id && protocol_state->period_ms == radio_period_ms &&
+            (now_us - radio_period_sent_us) < RADIO_PERIOD_RESYNC_US) {
+        return;
+    }
+    const uint32_t phase_us = radio_multi_remote || next_deadline_us <= now_us ?
+                              RADIO_PHASE_NONE : (uint32_t)(next_deadline_us - now_us);
+    radiobridge_sendPeriod(mb_id, protocol_state->period_ms * 1000, phase_us,
+                           protocol_state->radio_deadband_mg, protocol_state->radio_heartbeat_ms);
+    radio_period_sync = false;
+    radio_period_mb_id = mb_id;
+    radio_period_ms = protocol_state->period_ms;
+    radio_period_sent_us = now_us;
+}
+
+/**
+ * @brief Sends the time-slotted beacon on the first deadline of each frame.
+ *
+ * @param deadline_us The periodic message deadline just sent.
+ * @param period_us The bridge period.
+ */
+static void sendRadioBeacon(const CODAL_TIMESTAMP deadline_us, const CODAL_TIMESTAMP period_us) {
+    if (!radio_slots || deadline_us < radio_beacon_next_us) return;
+    radio_beacon_next_us = deadline_us + radiobridge_sendBeacon((uint32_t)period_us);
+}
+
 /**
  * @brief Callback for received radio packets.
  *
  * @param radio_sensor_data The data received via radio.
  */
 void radioDataCallback(const radio_packet_t *radio_packet) {
-    if (radio_packet->packet_type != RADIO_PKT_SENSOR_DATA) return;
-    if (radio_packet->mb_id == getActiveRemoteMbId()) {
-        const radio_sensor_data_t *radio_sensor_data = &radio_packet->sensor_data;
-        sensor_data.accelerometer_x = radio_sensor_data->accelerometer_x;
-        sensor_data.accelerometer_y = radio_sensor_data->accelerometer_y;
-        sensor_data.accelerometer_z = radio_sensor_data->accelerometer_z;
-        sensor_data.button_a = radio_sensor_data->button_a;
-        sensor_data.button_b = radio_sensor_data->button_b;
-        sensor_data.button_logo = radio_sensor_data->button_logo;
-        sensor_data.fresh_data = true;
+    PROFILER_START(profile_start);
+    runtime_stats->radio_received++;
+    if (radio_packet->packet_type != RADIO_PKT_SENSOR_DATA) {
+        runtime_stats->radio_ignored++;
+        PROFILER_END(PROFILER_STAGE_RADIO_CALLBACK, profile_start);
+        return;
     }
-#if CONFIG_ENABLED(DEV_MODE)
-    radiobridge_updateRemoteMbIds(radio_packet->mb_id);
-#endif
+    // Duplicated and reordered packets don't have fresh data
+    size_t remote_index;
+    const radio_seq_t seq = radiobridge_updateRemoteMbIds(radio_packet->mb_id, radio_packet->id, &remote_index);
+    if (seq != RADIO_SEQ_NEW) {
+        runtime_stats->radio_ignored++;
+    } else if (radio_multi_remote) {
+        // Every remote micro:bit is forwarded, as long as there is space to track it
+        if (remote_index < RADIO_REMOTES_LEN) {
+            runtime_stats->radio_accepted++;
+            setRadioSensorData(radio_packet, &remote_sensor_data[remote_index]);
+        } else {
+            runtime_stats->radio_ignored++;
+        }
+    } else if (radio_packet->mb_id != getActiveRemoteMbId()) {
+        runtime_stats->radio_ignored++;
+    } else {
+        runtime_stats->radio_accepted++;
+        radioPlayoutPush(radio_packet);
+    }
+    PROFILER_END(PROFILER_STAGE_RADIO_CALLBACK, profile_start);
 }
 #endif
 
@@ -100,13 +382,17 @@ int setRemoteMbId(sbp_state_s *protocol_state) {
     if (result < SBP_SUCCESS) return result;
 
     // At this point the new remote ID has been accepted
-#if CONFIG_ENABLED(RADIO_BRIDGE) && CONFIG_ENABLED(DEV_MODE)
+#if CONFIG_ENABLED(RADIO_BRIDGE)
     radiobridge_setActiveRemoteMbId(protocol_state->remote_id);
 #endif
 
     // Set radio frequency of the bridge only
     protocol_state->radio_frequency = radio_getFrequencyFromId(protocol_state->remote_id);
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+    int success = radiobridge_setRadioFrequency(protocol_state->radio_frequency);
+#else
     int success = uBit.radio.setFrequencyBand(protocol_state->radio_frequency);
+#endif
     return success == MICROBIT_OK ? SBP_SUCCESS : SBP_ERROR_INTERNAL;
 }
 
@@ -140,138 +426,845 @@ uint8_t getRadioFrequency() {
 /**
  * @brief Sets the radio frequency configured in the protocol state.
  *
- * TODO: Currently the microbit-bridge function only changes the bridge radio
- *       frequency, needs an update to change the remote micro:bit as well.
+ * The remote micro:bits switch together with the bridge, which takes a few
+ * periods, until then the bridge stays on the current frequency, and if any
+ * of them don't reply it stays on it. The protocol state is left with the
+ * frequency the bridge is on, for the response, and the main loop keeps it
+ * up to date, so the host reads RF[] until it has switched.
  *
  * @param protocol_state The protocol state with the updated radio frequency.
  *
- * @return SBP_SUCCESS if the radio frequency was set successfully, an error
- *         value otherwise.
+ * @return SBP_SUCCESS if the switch has started, SBP_ERROR_BUSY if there is
+ *         already one in progress, or SBP_ERROR_INTERNAL otherwise.
  */
 int setRadioFrequency(sbp_state_s *protocol_state) {
 #if CONFIG_ENABLED(RADIO_BRIDGE)
     int result = radiobridge_setRadioFrequencyAllMbs(protocol_state->radio_frequency);
-    return result == MICROBIT_OK ? SBP_SUCCESS : SBP_ERROR_INTERNAL;
+    if (result == MICROBIT_BUSY) return SBP_ERROR_BUSY;
+    if (result != MICROBIT_OK) return SBP_ERROR_INTERNAL;
+    protocol_state->radio_frequency = radiobridge_getRadioFrequency();
+    return SBP_SUCCESS;
 #else
+    (void)protocol_state;
     return SBP_SUCCESS;
 #endif
 }
 
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+/**
+ * @brief Runs the accelerometer at least as fast as the periodic messages in
+ * the batched binary mode, as its default period is longer than the shortest
+ * batched periods, and restores its previous period otherwise.
+ *
+ * @param protocol_state The protocol state with the periodic mode and period,
+ *        or NULL to only restore the period.
+ */
+static void setBatchAccelerometerPeriod(const sbp_state_t *protocol_state) {
+    if (batch_original_period_ms != 0) {
+        uBit.accelerometer.setPeriod(batch_original_period_ms);
+        batch_original_period_ms = 0;
+    }
+    if (protocol_state == NULL || protocol_state->periodic_mode != SBP_PERIODIC_MODE_BINARY ||
+            protocol_state->batch_size < 2 || !protocol_state->sensors.accelerometer) {
+        return;
+    }
+    const int original_period_ms = uBit.accelerometer.getPeriod();
+    if (protocol_state->period_ms >= original_period_ms) return;
+    batch_original_period_ms = original_period_ms;
+    uBit.accelerometer.setPeriod(protocol_state->period_ms);
+}
+#endif
+
 /**
- * @brief Sets any actions required when the start/zstart command is received.
+ * @brief Sets any actions required when any of the start commands is received.
  *
  * @param protocol_state The protocol state to set the start command for.
  *
- * @return SBP_SUCCESS
+ * @return SBP_SUCCESS, or an error value if the periodic mode is not available.
  */
 int setStartCommand(sbp_state_s *protocol_state) {
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+    // The capture dump uses the batch buffer and the serial port
+    if (capture_state != CAPTURE_IDLE) return SBP_ERROR_INTERNAL;
+    sampled_seq_start = sampled_seq;
+    sampled_seq_read = sampled_seq;
+    setBatchAccelerometerPeriod(protocol_state);
+    // Take the first sample now, the fiber could be waiting for a longer period
+    MicroBitEvent(SAMPLING_EVT_ID, SAMPLING_EVT_START);
+#endif
     // Discard any data received before this point as stale data
     sensor_data.fresh_data = false;
+    batch_samples_len = 0;
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+    radio_multi_remote = protocol_state->periodic_mode == SBP_PERIODIC_MODE_MULTI;
+    radio_multi_next_index = 0;
+    radio_multi_msg_len = 0;
+    radio_playout_len = 0;
+    radio_period_sync = true;
+    radio_beacon_next_us = 0;
+    sensor_data.timestamp_us = 0;
+    for (size_t i = 0; i < RADIO_REMOTES_LEN; i++) {
+        remote_sensor_data[i].fresh_data = false;
+        remote_sensor_data[i].timestamp_us = 0;
+    }
+#else
+    // Only the radio bridge has more than one source of sensor data
+    if (protocol_state->periodic_mode == SBP_PERIODIC_MODE_MULTI) return SBP_ERROR_NOT_IMPLEMENTED;
+#endif
     return SBP_SUCCESS;
 }
 
 /**
- * @brief Updates the sensor data structure with the current values as enabled
- * in sensor_config.
+ * @brief Callback for the STOP command, puts back the accelerometer period
+ * changed for the batched binary mode.
  *
- * @param sensor_config The sensor configuration to use.
- * @param sensor_data The sensor data structure to update.
+ * @param protocol_state The protocol state, not used.
+ *
+ * @return SBP_SUCCESS.
  */
-void updateSensorData(const sbp_sensors_t sensor_config, sbp_sensor_data_t *sensor_data) {
+int stopPeriodic(sbp_state_s *protocol_state) {
+    (void)protocol_state;
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+    setBatchAccelerometerPeriod(NULL);
+#endif
+    return SBP_SUCCESS;
+}
+
+/**
+ * @brief Callback for the TS command, the remote capture time is only
+ * available in the radio bridge builds.
+ *
+ * @param protocol_state The protocol state with the new timestamps setting.
+ *
+ * @return SBP_SUCCESS, or SBP_ERROR_CMD_VALUE if the timestamps setting is
+ *         not available in this build.
+ */
+int setTimestamps(sbp_state_s *protocol_state) {
 #if CONFIG_DISABLED(RADIO_BRIDGE)
-    if (sensor_config.accelerometer) {
-        sensor_data->accelerometer_x = uBit.accelerometer.getX();
-        sensor_data->accelerometer_y = uBit.accelerometer.getY();
-        sensor_data->accelerometer_z = uBit.accelerometer.getZ();
+    if (protocol_state->timestamps == SBP_TIMESTAMPS_REMOTE) {
+        return SBP_ERROR_CMD_VALUE;
     }
-    if (sensor_config.magnetometer) {
-        sensor_data->magnetometer_x = uBit.compass.getX();
-        sensor_data->magnetometer_y = uBit.compass.getY();
-        sensor_data->magnetometer_z = uBit.compass.getZ();
+#else
+    (void)protocol_state;
+#endif
+    return SBP_SUCCESS;
+}
+
+/**
+ * @brief Callback for the BAUD command, requests the switch to the new baud
+ * rate, or confirms a switch already done.
+ *
+ * @param protocol_state The protocol state with the new baud rate.
+ *
+ * @return SBP_SUCCESS, SBP_ERROR_CMD_VALUE if a different switch is waiting
+ *         for confirmation, or SBP_ERROR_INTERNAL during a capture.
+ */
+int setBaudrate(sbp_state_s *protocol_state) {
+    if (serial_baud_confirm_us != 0) {
+        if (protocol_state->baudrate != serial_baudrate) return SBP_ERROR_CMD_VALUE;
+        serial_baud_confirm_us = 0;
+        system_timer_cancel_event(SCHEDULER_EVT_ID, SCHEDULER_EVT_BAUD);
+        return SBP_SUCCESS;
     }
-    if (sensor_config.buttons) {
-        sensor_data->button_a = (bool)uBit.buttonA.isPressed();
-        sensor_data->button_b = (bool)uBit.buttonB.isPressed();
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+    // The capture dump is sent between commands
+    if (capture_state != CAPTURE_IDLE) return SBP_ERROR_INTERNAL;
+#endif
+    if (protocol_state->baudrate != serial_baudrate) {
+        serial_baud_switch = protocol_state->baudrate;
     }
-    if (sensor_config.button_logo) {
-        sensor_data->button_logo = (bool)uBit.logo.isPressed();
+    return SBP_SUCCESS;
+}
+
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+/**
+ * @brief Reads a sensor type into the sensor data structure.
+ *
+ * @param sensor_type The sensor to read.
+ * @param data The sensor data structure to update.
+ */
+static void sampleSensor(const sbp_sensor_type_t sensor_type, sbp_sensor_data_t *data) {
+    switch (sensor_type) {
+        case SBP_SENSOR_TYPE_ACC:
+            data->accelerometer_x = uBit.accelerometer.getX();
+            data->accelerometer_y = uBit.accelerometer.getY();
+            data->accelerometer_z = uBit.accelerometer.getZ();
+            break;
+        case SBP_SENSOR_TYPE_MAG:
+            data->magnetometer_x = uBit.compass.getX();
+            data->magnetometer_y = uBit.compass.getY();
+            data->magnetometer_z = uBit.compass.getZ();
+            break;
+        case SBP_SENSOR_TYPE_BTN:
+            data->button_a = (bool)uBit.buttonA.isPressed();
+            data->button_b = (bool)uBit.buttonB.isPressed();
+            break;
+        case SBP_SENSOR_TYPE_BTN_LOGO:
+            data->button_logo = (bool)uBit.logo.isPressed();
+            break;
+        case SBP_SENSOR_TYPE_BTN_PINS:
+            data->button_p0 = (bool)uBit.io.P0.isTouched();
+            data->button_p1 = (bool)uBit.io.P1.isTouched();
+            data->button_p2 = (bool)uBit.io.P2.isTouched();
+            break;
+        case SBP_SENSOR_TYPE_TEMP:
+            data->temperature = uBit.thermometer.getTemperature();
+            break;
+        case SBP_SENSOR_TYPE_LIGHT:
+            data->light_level = uBit.display.readLightLevel();
+            break;
+        case SBP_SENSOR_TYPE_SOUND:
+            data->sound_level = (int)uBit.audio.levelSPL->getValue();
+            break;
+        default:
+            break;
     }
-    if (sensor_config.button_pins) {
-        sensor_data->button_p0 = (bool)uBit.io.P0.isTouched();
-        sensor_data->button_p1 = (bool)uBit.io.P1.isTouched();
-        sensor_data->button_p2 = (bool)uBit.io.P2.isTouched();
+}
+
+/**
+ * @brief Sampling fiber, reads the sensors enabled for the periodic messages
+ * once per period, just before each deadline, and publishes the values for
+ * updateSensorData(). The slower sensors are only read at their own rate,
+ * the accelerometer and compass at their configured period, and keep their
+ * last value in between.
+ *
+ * This keeps the slow I2C reads out of the periodic message deadline, and
+ * gives each batched binary sample a new reading.
+ */
+static void samplingFiber() {
+    // The accelerometer and compass periods are read on every pass, as the
+    // batched binary mode changes the accelerometer one
+    uint32_t sensor_period_ms[SBP_SENSOR_TYPE_LEN] = {
+        0,                                          // SBP_SENSOR_TYPE_ACC
+        0,                                          // SBP_SENSOR_TYPE_MAG
+        0,                                          // SBP_SENSOR_TYPE_BTN
+        0,                                          // SBP_SENSOR_TYPE_BTN_LOGO
+        0,                                          // SBP_SENSOR_TYPE_BTN_PINS
+        SAMPLING_TEMPERATURE_MS,                    // SBP_SENSOR_TYPE_TEMP
+        0,                                          // SBP_SENSOR_TYPE_LIGHT
+        0,                                          // SBP_SENSOR_TYPE_SOUND
+    };
+    CODAL_TIMESTAMP next_sample_us[SBP_SENSOR_TYPE_LEN] = { };
+
+    while (true) {
+        const sbp_sensors_t sensors = sampling_state->sensors;
+        const CODAL_TIMESTAMP period_us = sampling_state->period_ms * 1000;
+        const CODAL_TIMESTAMP lead_us = (period_us / 2) < SAMPLING_LEAD_US ? (period_us / 2) : SAMPLING_LEAD_US;
+        const CODAL_TIMESTAMP guard_us = (period_us / 4) < SAMPLING_GUARD_US ? (period_us / 4) : SAMPLING_GUARD_US;
+        const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+        const bool sampling = sampling_state->send_periodic && sensors.raw;
+        const bool near_deadline = (now_us + guard_us) > sampling_deadline_us;
+        if (sampling && !near_deadline) {
+            const uint32_t seq = sampled_seq;
+            sbp_sensor_data_t *sample = &sampled_data[(seq + 1) % 2];
+            *sample = sampled_data[seq % 2];
+            sample->timestamp_us = (uint32_t)now_us;
+
+            sensor_period_ms[SBP_SENSOR_TYPE_ACC] = (uint32_t)uBit.accelerometer.getPeriod();
+            sensor_period_ms[SBP_SENSOR_TYPE_MAG] = (uint32_t)uBit.compass.getPeriod();
+            for (size_t i = 0; i < SBP_SENSOR_TYPE_LEN; i++) {
+                if (!((sensors.raw >> i) & 0x01)) continue;
+                // Half a period of tolerance, as the passes are a period apart with some jitter,
+                // and the first sample after a start command reads all the enabled sensors
+                const bool due = (now_us + (period_us / 2)) >= next_sample_us[i] || seq == sampled_seq_start;
+                if (!due) continue;
+                sampleSensor((sbp_sensor_type_t)i, sample);
+                next_sample_us[i] = now_us + (sensor_period_ms[i] * 1000);
+            }
+            // Every pass is a new sample, with the last value of the sensors not due yet
+            sampled_seq = seq + 1;
+        }
+
+        // Wait for the next pass before a deadline, or only for a start command while stopped
+        if (sampling) {
+            CODAL_TIMESTAMP wake_us = sampling_deadline_us > lead_us ? sampling_deadline_us - lead_us : 0;
+            const CODAL_TIMESTAMP after_us = system_timer_current_time_us();
+            while (wake_us <= after_us) wake_us += period_us;
+            system_timer_event_after_us(wake_us - after_us, SAMPLING_EVT_ID, SAMPLING_EVT_TIMER);
+        }
+        fiber_wait_for_event(SAMPLING_EVT_ID, MICROBIT_EVT_ANY);
+        system_timer_cancel_event(SAMPLING_EVT_ID, SAMPLING_EVT_TIMER);
     }
-    if (sensor_config.temperature) {
-        sensor_data->temperature = uBit.thermometer.getTemperature();
+}
+#endif
+
+/**
+ * @brief Moves as many bytes as fit from the serial TX queue into the CODAL
+ * TX buffer, never waits for the transmission.
+ */
+static void serialTxFlush() {
+    while (serial_tx_len > 0) {
+        const size_t contiguous_len = SERIAL_TX_QUEUE_LEN - serial_tx_head;
+        const size_t send_len = serial_tx_len < contiguous_len ? serial_tx_len : contiguous_len;
+        PROFILER_START(profile_start);
+        int sent = uBit.serial.send(&serial_tx_queue[serial_tx_head], (int)send_len, ASYNC);
+        PROFILER_END(PROFILER_STAGE_SERIAL_SEND, profile_start);
+        if (sent <= 0) return;
+        serial_tx_head = (serial_tx_head + sent) % SERIAL_TX_QUEUE_LEN;
+        serial_tx_len -= sent;
+        // The CODAL TX buffer is full
+        if ((size_t)sent < send_len) return;
     }
-    if (sensor_config.light_level) {
-        sensor_data->light_level = uBit.display.readLightLevel();
+}
+
+/**
+ * @brief Refills the CODAL TX buffer from the queue once it has been sent,
+ * and wakes up the main fiber if the queue had messages waiting, as there is
+ * now more space in it.
+ */
+static void onSerialTxEmpty(MicroBitEvent) {
+    if (serial_tx_len == 0) return;
+    serialTxFlush();
+    MicroBitEvent(SCHEDULER_EVT_ID, SCHEDULER_EVT_TX);
+}
+
+/**
+ * @brief Adds a full message to the serial TX queue and starts sending it.
+ *
+ * Only waits, for the CODAL TX buffer to be sent, if the queue doesn't have
+ * space for the message.
+ *
+ * @param data The message to send.
+ * @param data_len The length of the message, up to SERIAL_TX_QUEUE_LEN.
+ */
+static void serialTxQueue(const char *data, const size_t data_len) {
+    serialTxFlush();
+    while ((SERIAL_TX_QUEUE_LEN - serial_tx_len) < data_len) {
+        fiber_wait_for_event(MICROBIT_ID_NOTIFY, CODAL_SERIAL_EVT_TX_EMPTY);
+        serialTxFlush();
     }
-    if (sensor_config.sound_level) {
-        sensor_data->sound_level = (int)uBit.audio.levelSPL->getValue();
-    };
-    sensor_data->fresh_data = true;
+    size_t tail = (serial_tx_head + serial_tx_len) % SERIAL_TX_QUEUE_LEN;
+    for (size_t i = 0; i < data_len; i++) {
+        serial_tx_queue[tail] = (uint8_t)data[i];
+        tail = (tail + 1) % SERIAL_TX_QUEUE_LEN;
+    }
+    serial_tx_len += data_len;
+    runtime_stats->serial_tx_bytes += data_len;
+    serialTxFlush();
+}
+
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+/**
+ * @brief Sends a multi remote periodic message for each remote micro:bit
+ * with fresh data since the previous deadline, in index order.
+ *
+ * Only as many messages are queued as the serial port can send in a period,
+ * and as fit in the serial TX queue without waiting, but at least one. The
+ * remote micro:bits left out keep their fresh data, and go first on the
+ * next deadline, so they all take turns.
+ *
+ * @param protocol_state The protocol state with the enabled sensors.
+ * @param serial_data Buffer to encode each message into.
+ * @param serial_data_len The length of the buffer.
+ *
+ * @return The number of messages sent.
+ */
+static size_t sendRemotesPeriodic(sbp_state_t *protocol_state, char *serial_data, const size_t serial_data_len) {
+    // 8N1, 10 bits per byte
+    const size_t period_len = (size_t)(((uint64_t)serial_baudrate * protocol_state->period_ms) / (10 * 1000));
+    const size_t queue_free_len = SERIAL_TX_QUEUE_LEN - serial_tx_len;
+    size_t budget_len = period_len < queue_free_len ? period_len : queue_free_len;
+    const size_t first_index = radio_multi_next_index;
+    radio_multi_next_index = 0;
+
+    size_t messages = 0;
+    for (size_t n = 0; n < RADIO_REMOTES_LEN; n++) {
+        const size_t i = (first_index + n) % RADIO_REMOTES_LEN;
+        if (!radioHoldLastValue(&remote_sensor_data[i])) continue;
+        // Before encoding it, as each message takes the next message ID
+        const size_t msg_len = radio_multi_msg_len ? radio_multi_msg_len : SBP_MULTI_STR_MAX_LEN - 1;
+        if (msg_len > queue_free_len || (messages > 0 && msg_len > budget_len)) {
+            radio_multi_next_index = i;
+            break;
+        }
+        remote_sensor_data[i].fresh_data = false;
+
+        const CODAL_TIMESTAMP encode_start_us = system_timer_current_time_us();
+        PROFILER_START(encode_start);
+        int serial_str_length = sbp_multiSensorDataPeriodicStr(
+                &remote_sensor_data[i], (uint8_t)i,
+                serial_data, serial_data_len, protocol_state->timestamps);
+        if (serial_str_length < SBP_SUCCESS) uBit.panic(220);
+        PROFILER_END(PROFILER_STAGE_ENCODE, encode_start);
+        protocol_state->runtime_stats.encode_us += (uint32_t)(system_timer_current_time_us() - encode_start_us);
+        protocol_state->runtime_stats.messages++;
+        serialTxQueue(serial_data, serial_str_length);
+        radio_multi_msg_len = (size_t)serial_str_length;
+        budget_len -= radio_multi_msg_len < budget_len ? radio_multi_msg_len : budget_len;
+        messages++;
+    }
+    return messages;
+}
+#endif
+
+/**
+ * @brief Switches the UART to a new baud rate, once everything queued has
+ * been sent at the previous one, with the CODAL buffers and the time reserved
+ * for commands before the periodic messages scaled to it.
+ *
+ * Anything received during the switch is discarded.
+ *
+ * @param baudrate The new baud rate.
+ */
+static void serialSetBaudrate(const uint32_t baudrate) {
+    // The main fiber waits for the queue to be sent, like serialTxQueue, and
+    // then sleeps once for the last byte to leave the UART
+    serialTxFlush();
+    while (serial_tx_len > 0 || uBit.serial.txBufferedSize() > 0) {
+        fiber_wait_for_event(MICROBIT_ID_NOTIFY, CODAL_SERIAL_EVT_TX_EMPTY);
+        serialTxFlush();
+    }
+    uBit.sleep(1);
+
+    const uint32_t buffer_len = (uint32_t)((uint64_t)SERIAL_BUFFER_LEN * baudrate / SBP_DEFAULT_BAUDRATE);
+    const uint8_t buffer_size = buffer_len > UINT8_MAX ? UINT8_MAX : (uint8_t)buffer_len;
+    uBit.serial.setTxBufferSize(buffer_size);
+    uBit.serial.setRxBufferSize(buffer_size);
+    uBit.serial.setBaudrate(baudrate);
+    serial_baudrate = baudrate;
+    periodic_reserved_us = PERIODIC_RESERVED_US * SBP_DEFAULT_BAUDRATE / baudrate;
+
+    cmd_parser = { };
+    while (uBit.serial.read(ASYNC) != MICROBIT_NO_DATA);
+}
+
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+/**
+ * @brief Capture timer event handler, reads an accelerometer sample into the
+ * capture buffer, and wakes up the main fiber once all have been captured.
+ */
+static void onCaptureSample(MicroBitEvent) {
+    if (capture_state != CAPTURE_SAMPLING) return;
+
+    capture_data[capture_len][0] = (int16_t)uBit.accelerometer.getX();
+    capture_data[capture_len][1] = (int16_t)uBit.accelerometer.getY();
+    capture_data[capture_len][2] = (int16_t)uBit.accelerometer.getZ();
+    capture_len++;
+
+    if (capture_len >= capture_samples) {
+        system_timer_cancel_event(CAPTURE_EVT_ID, CAPTURE_EVT_SAMPLE);
+        uBit.accelerometer.setPeriod(capture_original_period_ms);
+        capture_state = CAPTURE_SENDING;
+        MicroBitEvent(SCHEDULER_EVT_ID, SCHEDULER_EVT_CAPTURE);
+    }
+}
+
+/**
+ * @brief Sends the next binary frame of a finished capture.
+ *
+ * @param buffer The buffer to encode the frame into.
+ * @param buffer_len The length of the buffer.
+ */
+static void sendCaptureFrame(char *buffer, const size_t buffer_len) {
+    // The batch buffer is free, as the periodic messages can't run during a capture
+    sbp_sensors_t accelerometer_only;
+    accelerometer_only.accelerometer = true;
+    const size_t max_samples = sbp_binaryMaxSamples(accelerometer_only);
+    const size_t remaining = capture_len - capture_sent;
+    const size_t samples_len = remaining < max_samples ? remaining : max_samples;
+    for (size_t i = 0; i < samples_len; i++) {
+        const int16_t *sample = capture_data[capture_sent + i];
+        batch_samples[i].accelerometer_x = sample[0];
+        batch_samples[i].accelerometer_y = sample[1];
+        batch_samples[i].accelerometer_z = sample[2];
+    }
+
+    int frame_len = sbp_binaryCaptureData(capture_sent, batch_samples, samples_len, (uint8_t *)buffer, buffer_len);
+    if (frame_len < SBP_SUCCESS) uBit.panic(230);
+    serialTxQueue(buffer, frame_len);
+
+    capture_sent += samples_len;
+    if (capture_sent >= capture_len) {
+        capture_state = CAPTURE_IDLE;
+    }
+}
+#endif
+
+/**
+ * @brief Callback for the PROF command, reads the latency histogram of a
+ * profiled stage, only available with the PROFILER build flag.
+ *
+ * @param protocol_state The protocol state with the stage to read, and to
+ *        copy its histogram into.
+ *
+ * @return SBP_SUCCESS, SBP_ERROR_CMD_VALUE if the stage is not valid, or
+ *         SBP_ERROR_NOT_IMPLEMENTED without the profiler.
+ */
+int readProfile(sbp_state_s *protocol_state) {
+#if CONFIG_ENABLED(PROFILER)
+    return profiler_read(protocol_state->profile_stage, &protocol_state->profile);
+#else
+    return SBP_ERROR_NOT_IMPLEMENTED;
 #endif
 }
 
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+/**
+ * @brief Reads the radio packet sequence counters of a remote micro:bit.
+ *
+ * @param protocol_state The protocol state with the remote micro:bit ID,
+ *        or 0 for the active one, where the counters are stored.
+ *
+ * @return SBP_SUCCESS, or SBP_ERROR_CMD_VALUE if the remote micro:bit has
+ *         not been heard recently.
+ */
+int readRadioLoss(sbp_state_s *protocol_state) {
+    const uint32_t mb_id = protocol_state->radio_loss_id ? protocol_state->radio_loss_id : getActiveRemoteMbId();
+    radio_seq_stats_t seq_stats;
+    if (radiobridge_getRemoteSeqStats(mb_id, &seq_stats) != MICROBIT_OK) return SBP_ERROR_CMD_VALUE;
+
+    protocol_state->radio_loss.received = seq_stats.received;
+    protocol_state->radio_loss.lost = seq_stats.lost;
+    protocol_state->radio_loss.duplicated = seq_stats.duplicated;
+    protocol_state->radio_loss.reordered = seq_stats.reordered;
+    return SBP_SUCCESS;
+}
+
+/**
+ * @brief Reads the micro:bit ID of a remote micro:bit index, as sent in the
+ * multi remote periodic messages.
+ *
+ * @param protocol_state The protocol state with the remote index, where the
+ *        micro:bit ID is stored.
+ *
+ * @return SBP_SUCCESS, or SBP_ERROR_CMD_VALUE if there isn't a remote
+ *         micro:bit with that index.
+ */
+int readRemoteIndex(sbp_state_s *protocol_state) {
+    const uint32_t mb_id = radiobridge_getRemoteMbId(protocol_state->remote_index);
+    if (mb_id == 0) return SBP_ERROR_CMD_VALUE;
+    protocol_state->remote_index_id = mb_id;
+    return SBP_SUCCESS;
+}
+
+/**
+ * @brief Sets the change-driven mode of the remote micro:bits, sent to them
+ * with the period, and holds the last value for up to two heartbeats.
+ *
+ * @param protocol_state The protocol state with the deadband and heartbeat.
+ *
+ * @return SBP_SUCCESS.
+ */
+int setRadioChange(sbp_state_s *protocol_state) {
+    radio_hold_us = protocol_state->radio_heartbeat_ms * 2000;
+    radio_period_sync = true;
+    return SBP_SUCCESS;
+}
+
+/**
+ * @brief Starts or stops the time-slotted beacons, the remote micro:bits go
+ * back to sending their packets straight away a few frames after the last.
+ *
+ * @param protocol_state The protocol state with the time-slotted setting.
+ *
+ * @return SBP_SUCCESS.
+ */
+int setRadioSlots(sbp_state_s *protocol_state) {
+    radio_slots = protocol_state->radio_slots;
+    radio_beacon_next_us = 0;
+    return SBP_SUCCESS;
+}
+#endif
+
+/**
+ * @brief Starts an accelerometer burst capture, only available with the
+ * local sensors.
+ *
+ * @param protocol_state The protocol state with the capture samples and rate.
+ *
+ * @return SBP_SUCCESS, SBP_ERROR_CMD_REPEATED if a capture is already in
+ *         progress, or SBP_ERROR_NOT_IMPLEMENTED in the radio builds.
+ */
+int startCapture(sbp_state_s *protocol_state) {
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+    if (capture_state != CAPTURE_IDLE) return SBP_ERROR_CMD_REPEATED;
+
+    capture_samples = protocol_state->capture_samples;
+    capture_len = 0;
+    capture_sent = 0;
+
+    // Run the accelerometer at least as fast as the capture rate
+    const int period_ms = 1000 / protocol_state->capture_rate_hz;
+    capture_original_period_ms = uBit.accelerometer.getPeriod();
+    uBit.accelerometer.setPeriod(period_ms > 0 ? period_ms : 1);
+
+    capture_state = CAPTURE_SAMPLING;
+    system_timer_event_every_us(1000000 / protocol_state->capture_rate_hz, CAPTURE_EVT_ID, CAPTURE_EVT_SAMPLE);
+    return SBP_SUCCESS;
+#else
+    (void)protocol_state;
+    return SBP_ERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+/**
+ * @brief Updates the sensor data structure with the latest values published
+ * by the sampling fiber, only copies them so it takes a fixed short time.
+ *
+ * In the radio bridge builds the sensor data is updated by the radio
+ * callback instead.
+ *
+ * @param sensor_data The sensor data structure to update.
+ */
+void updateSensorData(sbp_sensor_data_t *sensor_data) {
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+    const uint32_t seq = sampled_seq;
+    *sensor_data = sampled_data[seq % 2];
+    // Only a sample published since the last deadline is fresh, so it's never batched twice
+    sensor_data->fresh_data = seq != sampled_seq_read;
+    sampled_seq_read = seq;
+#elif CONFIG_ENABLED(RADIO_BRIDGE)
+    radioPlayoutRelease(sensor_data);
+    radioHoldLastValue(sensor_data);
+#endif
+}
+
+/**
+ * @brief Wakes up the main fiber when a full command line has been received.
+ */
+static void onSerialDelimiter(MicroBitEvent) {
+    MicroBitEvent(SCHEDULER_EVT_ID, SCHEDULER_EVT_SERIAL);
+}
+
+/**
+ * @brief Processes the next command from the serial RX buffer, if a full
+ * command has been received, and sends its response.
+ *
+ * @return True if a command was processed.
+ */
+static bool processSerialCommand(sbp_state_t *protocol_state, char *serial_data, const size_t serial_data_len) {
+    // Feed the buffered bytes to the parser until a full command is processed
+    int serial_char;
+    while ((serial_char = uBit.serial.read(ASYNC)) != MICROBIT_NO_DATA) {
+        sbp_cmd_t cmd;
+        int result = sbp_parserFeed(&cmd_parser, (char)serial_char, &cmd);
+        if (result == SBP_PARSER_INCOMPLETE) continue;
+        // Until a baud rate switch is confirmed the host could still be at the previous rate
+        if (result < SBP_SUCCESS && serial_baud_confirm_us != 0) continue;
+        if (result < SBP_SUCCESS) uBit.panic(210);
+        int response_len = sbp_processParsedCommand(&cmd, protocol_state, serial_data, serial_data_len);
+        if (response_len < SBP_SUCCESS) uBit.panic(210);
+        serialTxQueue(serial_data, response_len);
+        protocol_state->runtime_stats.commands++;
+
+        // The BAUD response is the last message at the previous baud rate
+        if (serial_baud_switch != 0) {
+            serialSetBaudrate(serial_baud_switch);
+            serial_baud_switch = 0;
+            serial_baud_confirm_us = system_timer_current_time_us() + (SBP_BAUD_CONFIRM_TIMEOUT_MS * 1000);
+            system_timer_event_after_us(SBP_BAUD_CONFIRM_TIMEOUT_MS * 1000, SCHEDULER_EVT_ID, SCHEDULER_EVT_BAUD);
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Adds a serviced deadline to the periodic message statistics.
+ *
+ * @param protocol_state The protocol state with the statistics to update.
+ * @param late_us How late the deadline was serviced.
+ * @param slack_us How long the main loop was idle before the deadline.
+ */
+static void updatePeriodicStats(sbp_state_t *protocol_state, const CODAL_TIMESTAMP late_us, const CODAL_TIMESTAMP slack_us) {
+    sbp_periodic_stats_t *stats = &protocol_state->periodic_stats;
+    const uint32_t late = late_us > UINT32_MAX ? UINT32_MAX : (uint32_t)late_us;
+    stats->deadlines++;
+    stats->late_sum_us += late;
+    if (late > stats->late_max_us) stats->late_max_us = late;
+
+    sbp_runtime_stats_t *runtime = &protocol_state->runtime_stats;
+    const uint32_t slack = slack_us > UINT32_MAX ? UINT32_MAX : (uint32_t)slack_us;
+    runtime->slack_sum_us += slack;
+    if (stats->deadlines == 1 || slack < runtime->slack_min_us) runtime->slack_min_us = slack;
+}
+
+/**
+ * @brief Calculates how many samples to send in each periodic message.
+ *
+ * Only the binary format batches samples, limited by how many samples fit
+ * in a single message with the enabled sensors.
+ *
+ * @param protocol_state The protocol state with the configured batch size.
+ *
+ * @return The number of samples per periodic message.
+ */
+static size_t getBatchSize(const sbp_state_t *protocol_state) {
+    if (protocol_state->periodic_mode != SBP_PERIODIC_MODE_BINARY) return 1;
+    size_t max_samples = sbp_binaryMaxSamples(protocol_state->sensors);
+    return protocol_state->batch_size < max_samples ? protocol_state->batch_size : max_samples;
+}
+
 int main() {
     uBit.init();
+#if CONFIG_ENABLED(PROFILER)
+    profiler_init();
+#endif
 
     uBit.display.print(IMG_WAITING);
 
-    const int SERIAL_BUFFER_LEN = 128;
     uBit.serial.setTxBufferSize(SERIAL_BUFFER_LEN);
     uBit.serial.setRxBufferSize(SERIAL_BUFFER_LEN);
-    uBit.serial.setBaudrate(115200);
+    uBit.serial.setBaudrate(SBP_DEFAULT_BAUDRATE);
 
-    const size_t serial_data_len = SERIAL_BUFFER_LEN + 1;
+    // Large enough for a full serial RX buffer and for the longest periodic message
+    const size_t serial_data_len = (SERIAL_BUFFER_LEN + 1 > SBP_VERBOSE_STR_MAX_LEN) ?
+                                   SERIAL_BUFFER_LEN + 1 : SBP_VERBOSE_STR_MAX_LEN;
     char serial_data[serial_data_len];
+    static_assert(serial_data_len >= SBP_VERBOSE_STR_MAX_LEN && serial_data_len >= SBP_COMPACT_STR_MAX_LEN &&
+                  serial_data_len >= SBP_MULTI_STR_MAX_LEN && serial_data_len >= SBP_BINARY_FRAME_MAX_LEN &&
+                  serial_data_len >= SBP_DELTA_FRAME_MAX_LEN,
+                  "serial_data is too small for the longest periodic message");
+    static_assert(SERIAL_TX_QUEUE_LEN >= serial_data_len, "The serial TX queue can't hold a full message");
 
     sbp_state_t protocol_state = {
         .send_periodic = SBP_DEFAULT_SEND_PERIODIC,
-        .periodic_compact = SBP_DEFAULT_PERIODIC_Z,
+        .periodic_mode = SBP_DEFAULT_PERIODIC_MODE,
         .radio_frequency = getRadioFrequency(),
         .remote_id = getRemoteMbId(),
         .id = microbit_serial_number(),
         .period_ms = SBP_DEFAULT_PERIOD_MS,
+        .delta_keyframe_interval = SBP_DEFAULT_DELTA_KEYFRAME,
+        .batch_size = SBP_DEFAULT_BATCH_SIZE,
         // TODO: Get the hardware version from the micro:bit DAL/CODAL
         .hw_version = 2,
         .sw_version = PROJECT_VERSION,
         .sensors = { },
+        .periodic_stats = { },
+        .timestamps = SBP_DEFAULT_TIMESTAMPS,
+        .capture_samples = 0,
+        .capture_rate_hz = 0,
+        .baudrate = SBP_DEFAULT_BAUDRATE,
+        .handshake = false,
+        .runtime_stats = { },
+        .profile_stage = 0,
+        .profile = { },
+        .radio_loss_msg = false,
+        .radio_loss_id = 0,
+        .radio_loss = { },
+        .remote_index = 0,
+        .remote_index_id = 0,
+        .radio_deadband_mg = 0,
+        .radio_heartbeat_ms = 0,
+        .radio_slots = false,
     };
     sbp_cmd_callbacks_t protocol_callbacks = {
         .radioFrequency = setRadioFrequency,
         .remoteMbId = setRemoteMbId,
         .start = setStartCommand,
         .zstart = setStartCommand,
+        .bstart = setStartCommand,
+        .dstart = setStartCommand,
+        .mstart = setStartCommand,
+        .timestamps = setTimestamps,
+        .capture = startCapture,
+        .baudrate = setBaudrate,
+        .profile = readProfile,
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+        .radioLoss = readRadioLoss,
+        .remoteIndex = readRemoteIndex,
+        .radioChange = setRadioChange,
+        .radioSlots = setRadioSlots,
+#else
+        // Without a radio the RLOSS, RLMSG, RMBIDX, RCHG and RSLOT commands are not available
+        .radioLoss = NULL,
+        .remoteIndex = NULL,
+        .radioChange = NULL,
+        .radioSlots = NULL,
+#endif
+        .stop = stopPeriodic,
     };
 
     int init_success = sbp_init(&protocol_callbacks, &protocol_state);
     if (init_success < SBP_SUCCESS) uBit.panic(200);
+    runtime_stats = &protocol_state.runtime_stats;
 
 #if CONFIG_ENABLED(RADIO_REMOTE)
     radiotx_mainLoop();
 #elif CONFIG_ENABLED(RADIO_BRIDGE)
     radiobridge_init(radioDataCallback, protocol_state.radio_frequency);
+#if CONFIG_DISABLED(DEV_MODE)
+    // The configured remote micro:bit is the active one, so that its sequence
+    // counters are never forgotten
+    radiobridge_setActiveRemoteMbId(protocol_state.remote_id);
+#endif
+#else
+    sampling_state = &protocol_state;
+    create_fiber(samplingFiber);
+    uBit.messageBus.listen(CAPTURE_EVT_ID, CAPTURE_EVT_SAMPLE, onCaptureSample);
 #endif
 
-    uint32_t next_periodic_msg = uBit.systemTime() + protocol_state.period_ms;
+    uBit.serial.eventOn(SBP_MSG_SEPARATOR);
+    uBit.messageBus.listen(MICROBIT_ID_SERIAL, CODAL_SERIAL_EVT_DELIM_MATCH, onSerialDelimiter);
+    uBit.messageBus.listen(MICROBIT_ID_NOTIFY, CODAL_SERIAL_EVT_TX_EMPTY, onSerialTxEmpty);
+
+    // Absolute deadline for the next periodic message, each one is exactly a
+    // period after the previous, so that lateness doesn't accumulate into drift
+    CODAL_TIMESTAMP next_deadline_us = system_timer_current_time_us() + (protocol_state.period_ms * 1000);
+    // Idle time before the deadline, from when the loop last had work to do,
+    // wake ups without any work don't count
+    CODAL_TIMESTAMP slack_us = 0;
+    bool idle = false;
     while (true) {
-        // Read any incoming message & process it until we reached the time reserved for periodic messages
-        while ((uBit.systemTime() + PERIODIC_BUFFER_MS) < next_periodic_msg) {
-            ManagedString cmd = uBit.serial.readUntil(SBP_MSG_SEPARATOR, ASYNC);
-            if (cmd.length() > 0) {
-                // Read any incoming message & process it
-                int response_len = sbp_processCommand(cmd, &protocol_state, serial_data, serial_data_len);
-                if (response_len < SBP_SUCCESS) uBit.panic(210);
-                uBit.serial.send((uint8_t *)serial_data, response_len, SYNC_SLEEP);
-            }
-            // Sleep if there is no buffered message, and enough time before the periodic message
-            if (!uBit.serial.isReadable() && ((uBit.systemTime() + PERIODIC_BUFFER_MS) < next_periodic_msg)) {
-                uBit.sleep(1);  // This might take up to 4ms, as that's the CODAL ticker resolution
-            }
+        // Only the periodic message that completes a batch needs time reserved to be sent,
+        // with shorter batched periods commands are processed in between samples
+        const size_t batch_size = getBatchSize(&protocol_state);
+        const bool deadline_sends = protocol_state.send_periodic && (batch_samples_len + 1) >= batch_size;
+        const CODAL_TIMESTAMP reserved_us = deadline_sends ? periodic_reserved_us : 0;
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+        sampling_deadline_us = next_deadline_us;
+#endif
+
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+        // A radio frequency switch only changes it once the remote micro:bits switch too
+        protocol_state.radio_frequency = radiobridge_getRadioFrequency();
+#endif
+
+        // The host didn't confirm the baud rate switch, and should go back as well
+        if (serial_baud_confirm_us != 0 && system_timer_current_time_us() >= serial_baud_confirm_us) {
+            serial_baud_confirm_us = 0;
+            serialSetBaudrate(SBP_DEFAULT_BAUDRATE);
+            protocol_state.baudrate = SBP_DEFAULT_BAUDRATE;
+        }
+
+        // Process the received commands while there is time before the deadline
+        while ((system_timer_current_time_us() + reserved_us) < next_deadline_us) {
+            if (!processSerialCommand(&protocol_state, serial_data, serial_data_len)) break;
+            idle = false;
         }
 
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+        // A finished capture is sent a frame at a time, with commands processed in between.
+        // The next frame is only queued once the previous one is in the CODAL TX buffer,
+        // see onSerialTxEmpty(), so that responses don't wait behind the whole capture.
+        if (capture_state == CAPTURE_SENDING && serial_tx_len == 0) {
+            sendCaptureFrame(serial_data, serial_data_len);
+            idle = false;
+            next_deadline_us = system_timer_current_time_us() + (protocol_state.period_ms * 1000);
+            continue;
+        }
+#endif
+
+        // Sleep until the deadline, or until a new command is received
+        CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+        if (!idle) {
+            slack_us = now_us < next_deadline_us ? next_deadline_us - now_us : 0;
+            idle = true;
+        }
+        if ((now_us + SCHEDULER_SPIN_US) < next_deadline_us) {
+            system_timer_event_after_us(next_deadline_us - now_us, SCHEDULER_EVT_ID, SCHEDULER_EVT_DEADLINE);
+            fiber_wait_for_event(SCHEDULER_EVT_ID, MICROBIT_EVT_ANY);
+            system_timer_cancel_event(SCHEDULER_EVT_ID, SCHEDULER_EVT_DEADLINE);
+            continue;
+        }
+        while ((now_us = system_timer_current_time_us()) < next_deadline_us);
+        const CODAL_TIMESTAMP deadline_us = next_deadline_us;
+        const CODAL_TIMESTAMP period_us = protocol_state.period_ms * 1000;
+        idle = false;
+#if CONFIG_DISABLED(RADIO_BRIDGE) && CONFIG_DISABLED(RADIO_REMOTE)
+        sampling_deadline_us = deadline_us + period_us;
+#endif
+
 #if CONFIG_ENABLED(DEV_MODE)
         if (uBit.logo.isPressed()) {
             // Useful to test crash recovery
@@ -286,29 +1279,74 @@ int main() {
 
         // If periodic messages are enabled and new data has been received, send it
         if (protocol_state.send_periodic) {
-            updateSensorData(protocol_state.sensors, &sensor_data);
+            updatePeriodicStats(&protocol_state, now_us - deadline_us, slack_us);
+            PROFILER_START(update_start);
+            updateSensorData(&sensor_data);
+            PROFILER_END(PROFILER_STAGE_SENSOR_UPDATE, update_start);
             bool fresh_data = sensor_data.fresh_data;
             sensor_data.fresh_data = false;
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+            if (protocol_state.periodic_mode == SBP_PERIODIC_MODE_MULTI) {
+                fresh_data = sendRemotesPeriodic(&protocol_state, serial_data, serial_data_len) > 0;
+            }
+#endif
+            if (!fresh_data) protocol_state.runtime_stats.stale++;
+            const CODAL_TIMESTAMP encode_start_us = system_timer_current_time_us();
+            PROFILER_START(encode_start);
 
-            int serial_str_length;
-            if (protocol_state.periodic_compact) {
-                serial_str_length = sbp_compactSensorDataPeriodicStr(
-                        protocol_state.sensors, &sensor_data, serial_data, serial_data_len);
+            // The multi remote messages have already been sent
+            bool send_msg = fresh_data && protocol_state.periodic_mode != SBP_PERIODIC_MODE_MULTI;
+            int serial_str_length = 0;
+            if (batch_size > 1) {
+                // Only fresh samples are batched, and the message is sent once the batch is full
+                if (fresh_data) {
+                    batch_samples[batch_samples_len++] = sensor_data;
+                }
+                send_msg = batch_samples_len >= batch_size;
+                if (send_msg) {
+                    serial_str_length = sbp_binarySensorDataPeriodic(
+                            protocol_state.sensors, batch_samples, batch_samples_len,
+                            (uint8_t *)serial_data, serial_data_len);
+                    batch_samples_len = 0;
+                }
             } else {
-                serial_str_length = sbp_sensorDataPeriodicStr(
-                        protocol_state.sensors, &sensor_data, serial_data, serial_data_len);
+                switch (protocol_state.periodic_mode) {
+                    case SBP_PERIODIC_MODE_COMPACT:
+                        serial_str_length = sbp_compactSensorDataPeriodicStr(
+                                &sensor_data, serial_data, serial_data_len,
+                                protocol_state.timestamps);
+                        break;
+                    case SBP_PERIODIC_MODE_BINARY:
+                        serial_str_length = sbp_binarySensorDataPeriodic(
+                                protocol_state.sensors, &sensor_data, 1, (uint8_t *)serial_data, serial_data_len);
+                        break;
+                    case SBP_PERIODIC_MODE_DELTA:
+                        serial_str_length = sbp_deltaSensorDataPeriodic(
+                                protocol_state.sensors, protocol_state.delta_keyframe_interval,
+                                &sensor_data, (uint8_t *)serial_data, serial_data_len);
+                        break;
+                    case SBP_PERIODIC_MODE_MULTI:
+                        break;
+                    case SBP_PERIODIC_MODE_VERBOSE:
+                    default:
+                        serial_str_length = sbp_sensorDataPeriodicStr(
+                                &sensor_data, serial_data, serial_data_len,
+                                protocol_state.timestamps, protocol_state.radio_loss_msg);
+                        break;
+                }
             }
             if (serial_str_length < SBP_SUCCESS) uBit.panic(220);
 
-            // For development, uncomment to check available free time
-            // uBit.serial.printf("t[%d]", next_periodic_msg - uBit.systemTime());
-
-            // Now wait without sleeping until ready to send the serial message
-            while (uBit.systemTime() < next_periodic_msg);
-            next_periodic_msg = uBit.systemTime() + protocol_state.period_ms;
-
+            if (send_msg) {
+                PROFILER_END(PROFILER_STAGE_ENCODE, encode_start);
+                protocol_state.runtime_stats.encode_us += (uint32_t)(system_timer_current_time_us() - encode_start_us);
+                protocol_state.runtime_stats.messages++;
+                serialTxQueue(serial_data, serial_str_length);
+            }
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+            sendRadioBeacon(deadline_us, period_us);
+#endif
             if (fresh_data) {
-                uBit.serial.send((uint8_t *)serial_data, serial_str_length, SYNC_SLEEP);
                 uBit.display.print(IMG_RUNNING);
             } else {
                 // No new data received, blink the waiting image
@@ -319,9 +1357,21 @@ int main() {
                     blink = !blink;
                 }
             }
+
+            // If we are already past the next deadline skip it, instead of sending a burst to catch up
+            next_deadline_us = deadline_us + period_us;
+            now_us = system_timer_current_time_us();
+            if (now_us >= next_deadline_us) {
+                const CODAL_TIMESTAMP missed = ((now_us - next_deadline_us) / period_us) + 1;
+                protocol_state.periodic_stats.missed += (uint32_t)missed;
+                next_deadline_us += missed * period_us;
+            }
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+            syncRemotePeriod(&protocol_state, next_deadline_us);
+#endif
         } else {
             // In this case we don't need to keep a constant periodic interval, just continue
-            next_periodic_msg = uBit.systemTime() + protocol_state.period_ms;
+            next_deadline_us = now_us + period_us;
         }
     }
 }
@@ -54,4 +54,10 @@ extern MicroBit uBit;
 #error "Invalid build type"
 #endif
 
+// Per stage latency histograms of the hot path, read with the PROF command,
+// enabled with the PROFILER=1 build flag, see profiler.h
+#ifndef PROFILER
+#define PROFILER                0
+#endif
+
 #define IMG_WAITING             IMG_DOT
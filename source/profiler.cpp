@@ -0,0 +1,70 @@
+#include "profiler.h"
+
+#if CONFIG_ENABLED(PROFILER)
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#include "nrf.h"
+#define PROFILER_DWT                1
+#else
+#include <time.h>
+#define PROFILER_DWT                0
+#endif
+
+static sbp_histogram_t histograms[PROFILER_STAGE_LEN] = { };
+
+/**
+ * @brief Converts profiler ticks into nanoseconds.
+ */
+static inline uint32_t ticksToNs(const uint32_t ticks) {
+#if PROFILER_DWT
+    // The nRF52833 CPU runs at 64 MHz, 15.625 ns per cycle
+    return (uint32_t)(((uint64_t)ticks * 125) / 8);
+#else
+    return ticks;
+#endif
+}
+
+void profiler_init() {
+#if PROFILER_DWT
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+uint32_t profiler_now() {
+#if PROFILER_DWT
+    return DWT->CYCCNT;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec);
+#endif
+}
+
+void profiler_add(const profiler_stage_t stage, const uint32_t start_ticks) {
+    // Unsigned subtraction, correct across the counter wrap around
+    const uint32_t ns = ticksToNs(profiler_now() - start_ticks);
+
+    sbp_histogram_t *histogram = &histograms[stage];
+    histogram->count++;
+    histogram->sum_ns += ns;
+    if (ns > histogram->max_ns) histogram->max_ns = ns;
+
+    // Bucket i from 64 * 2^i ns, see sbp_histogram_t
+    size_t bucket = 0;
+    if (ns >= 128) {
+        bucket = (size_t)(31 - __builtin_clz(ns)) - 6;
+        if (bucket >= SBP_HISTOGRAM_BUCKETS) bucket = SBP_HISTOGRAM_BUCKETS - 1;
+    }
+    if (histogram->buckets[bucket] < UINT16_MAX) histogram->buckets[bucket]++;
+}
+
+int profiler_read(const uint32_t stage, sbp_histogram_t *histogram) {
+    if (stage >= PROFILER_STAGE_LEN) return SBP_ERROR_CMD_VALUE;
+    *histogram = histograms[stage];
+    histograms[stage] = { };
+    return SBP_SUCCESS;
+}
+
+#endif
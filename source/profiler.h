@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include "main.h"
+#include "serial_bridge_protocol.h"
+
+/**
+ * @brief Stages of the hot path with a latency histogram, the index is the
+ * PROF command value.
+ */
+typedef enum profiler_stage_e {
+    PROFILER_STAGE_SENSOR_UPDATE = 0,
+    PROFILER_STAGE_ENCODE,
+    PROFILER_STAGE_SERIAL_SEND,
+    PROFILER_STAGE_RADIO_RX,
+    PROFILER_STAGE_RADIO_CALLBACK,
+    PROFILER_STAGE_LEN,
+} profiler_stage_t;
+
+const char* const profiler_stage_str[PROFILER_STAGE_LEN] = {
+    "updateSensorData",     // PROFILER_STAGE_SENSOR_UPDATE
+    "encode",               // PROFILER_STAGE_ENCODE
+    "serial send",          // PROFILER_STAGE_SERIAL_SEND
+    "radio RX",             // PROFILER_STAGE_RADIO_RX
+    "radio callback",       // PROFILER_STAGE_RADIO_CALLBACK
+};
+
+/**
+ * @brief Times a stage, from PROFILER_START() to PROFILER_END() in the same
+ * scope, only compiled in when the PROFILER build flag is enabled.
+ */
+#if CONFIG_ENABLED(PROFILER)
+#define PROFILER_START(name)        const uint32_t name = profiler_now()
+#define PROFILER_END(stage, name)   profiler_add(stage, name)
+#else
+#define PROFILER_START(name)
+#define PROFILER_END(stage, name)
+#endif
+
+#if CONFIG_ENABLED(PROFILER)
+/**
+ * @brief Starts the cycle counter, on the host there is nothing to start.
+ */
+void profiler_init();
+
+/**
+ * @return The current time in ticks, CPU cycles from the Cortex-M DWT cycle
+ *         counter, or nanoseconds from the monotonic clock on the host.
+ */
+uint32_t profiler_now();
+
+/**
+ * @brief Adds the time since start to the stage histogram.
+ *
+ * @param stage The profiled stage.
+ * @param start_ticks The profiler_now() value at the start of the stage.
+ */
+void profiler_add(const profiler_stage_t stage, const uint32_t start_ticks);
+
+/**
+ * @brief Copies a stage histogram, and resets it, so that each read covers
+ * the time since the previous one.
+ *
+ * @param stage The profiled stage, as received in the PROF command.
+ * @param histogram Output with the stage histogram.
+ *
+ * @return SBP_SUCCESS, or SBP_ERROR_CMD_VALUE if the stage is not valid.
+ */
+int profiler_read(const uint32_t stage, sbp_histogram_t *histogram);
+#endif
@@ -1,6 +1,8 @@
+#include <stdlib.h>
 #include "main.h"
 #include "radio_comms.h"
 #include "mb_images.h"
+#include "profiler.h"
 
 #if CONFIG_ENABLED(RADIO_REMOTE)
 /**
@@ -22,15 +24,99 @@ static radio_cmd_func_t radiotx_cmd_functions[RADIO_CMD_TYPE_LEN] = { };
 static radio_data_callback_t radiobridge_data_callback = NULL;
 
 /**
- * @brief Stores the list of micro:bit IDs that have been seen recently,
- * the time they were last seen, and the index of the active micro:bit.
+ * @brief Registry of the remote micro:bits that have been seen recently.
+ *
+ * Each remote has a fixed entry in mb_remotes while it is tracked, the entry
+ * index is the remote index. It's found by its ID with an open addressed hash
+ * table of entry indexes, and the entries in use are kept in an intrusive
+ * list from the most to the least recently heard, so that the expired remote
+ * or the one to replace is always at the tail.
+ *
+ * For each one it also tracks the last sensor data packet ID, and a bitmap
+ * of the packets received before it (bit n for the ID n packets back), to
+ * tell apart duplicated and reordered packets.
+ */
+typedef struct mb_remote_s {
+    uint32_t mb_id;
+    uint32_t time;
+    uint32_t seq;
+    uint32_t seq_window;
+    radio_seq_stats_t seq_stats;
+    uint8_t lru_prev;
+    uint8_t lru_next;
+    // Waiting for its reply to the radio frequency switch in progress
+    bool channel_wait;
+} mb_remote_t;
+
+static const size_t MB_REMOTES_LEN = RADIO_REMOTES_LEN;
+static const uint8_t MB_REMOTE_NONE = 0xFF;
+static mb_remote_t mb_remotes[MB_REMOTES_LEN] = { };
+static uint8_t lru_head = MB_REMOTE_NONE;
+static uint8_t lru_tail = MB_REMOTE_NONE;
+static uint8_t free_head = MB_REMOTE_NONE;
+static uint8_t mb_remotes_used = 0;
+static uint8_t active_mb_index = MB_REMOTE_NONE;
+
+/**
+ * @brief Hash table with the entry index plus one of each remote, zero for
+ * empty buckets. It's kept at most half full so the probes stay short.
+ */
+static constexpr size_t mbHashLen(const size_t len, const size_t hash_len = 1) {
+    return (hash_len >= (2 * len)) ? hash_len : mbHashLen(len, hash_len * 2);
+}
+static const size_t MB_HASH_LEN = mbHashLen(MB_REMOTES_LEN);
+static uint8_t mb_hash[MB_HASH_LEN] = { };
+
+/**
+ * @brief Packet ID jumps forward larger than this are taken as the remote
+ * micro:bit restarting, instead of lost packets.
+ */
+static const int32_t MB_SEQ_MAX_GAP = 1000;
+
+/**
+ * @brief Packet IDs tracked behind the newest one to find the duplicates.
+ * The radio doesn't hold packets for this long, so a packet further behind
+ * is from the remote micro:bit restarting its IDs, however soon it restarts.
+ */
+static const int32_t MB_SEQ_WINDOW = 32;
+
+/**
+ * @brief Radio frequency switch, see radiobridge_setRadioFrequencyAllMbs().
+ *
+ * While it's announced the remote micro:bits reply, and a guard time before
+ * the switch the bridge decides to switch, announce it again with a later
+ * switch time, or cancel it. After the switch it's confirmed on the new
+ * frequency for a while. Timer events drive each step.
  */
-static const size_t MB_IDS_LEN = 32;
-static const size_t MB_IDS_ID = 0;
-static const size_t MB_IDS_TIME = 1;
-static uint32_t mb_ids[MB_IDS_LEN][2] = { };
-static size_t active_mb_id_i = MB_IDS_LEN;
-#define GET_ACTIVE_MB_ID()      mb_ids[active_mb_id_i][MB_IDS_ID]
+typedef enum radio_channel_state_e {
+    RADIO_CHANNEL_IDLE = 0,
+    RADIO_CHANNEL_ANNOUNCING,
+    RADIO_CHANNEL_SWITCHING,
+    RADIO_CHANNEL_CONFIRMING,
+    RADIO_CHANNEL_CANCELLING,
+} radio_channel_state_t;
+
+static radio_channel_state_t channel_state = RADIO_CHANNEL_IDLE;
+static uint8_t channel_frequency = 0;
+static uint8_t channel_target = 0;
+static uint8_t channel_attempts = 0;
+static uint32_t channel_switch_id = 0;
+static CODAL_TIMESTAMP channel_switch_us = 0;
+static CODAL_TIMESTAMP channel_until_us = 0;
+
+static const uint8_t RADIO_CHANNEL_ATTEMPTS = 3;
+static const uint32_t RADIO_CHANNEL_SWITCH_DELAY_US = 50000;
+static const uint32_t RADIO_CHANNEL_GUARD_US = 10000;
+static const uint32_t RADIO_CHANNEL_CONFIRM_US = 30000;
+static const uint32_t RADIO_CHANNEL_TICK_US = 5000;
+
+// Timer events for the switch steps, any component ID not used by CODAL
+static const uint16_t RADIOBRIDGE_EVT_ID = 9511;
+static const uint16_t RADIOBRIDGE_EVT_CHANNEL_TICK = 1;
+static const uint16_t RADIOBRIDGE_EVT_CHANNEL_SWITCH = 2;
+
+static void radiobridge_onChannelReply(const radio_packet_t *packet);
+static void radiobridge_onChannelEvent(MicroBitEvent e);
 #endif
 
 // ----------------------------------------------------------------------------
@@ -43,29 +129,302 @@ static size_t active_mb_id_i = MB_IDS_LEN;
  * @param e Message bus event information, not used.
  */
 static void radiobridge_onRadioData(MicroBitEvent e) {
+    (void)e;
     if (radiobridge_data_callback == NULL) return;
 
+    PROFILER_START(profile_start);
     radio_packet_t data;
     PacketBuffer radio_packet = uBit.radio.datagram.recv();
-    if (radio_packet.length() != sizeof(data)) {
-        // TODO: Maybe ignore the packet instead? or issue error to callback?
-        uBit.panic(240);
+    const size_t radio_packet_len = (size_t)radio_packet.length();
+    if (radio_packet_len >= RADIO_BATCH_HEADER_LEN && radio_packet.getBytes()[0] == RADIO_PKT_SENSOR_BATCH) {
+        radio_batch_packet_t batch;
+        memcpy(&batch, radio_packet.getBytes(), radio_packet_len <= sizeof(batch) ? radio_packet_len : sizeof(batch));
+        data = { };
+        if (batch.sample_count == 0 || batch.sample_count > RADIO_BATCH_SAMPLES_MAX ||
+                radio_packet_len != RADIO_BATCH_HEADER_LEN + (batch.sample_count * sizeof(radio_batch_sample_t))) {
+            // Dropped, only the packet type goes to the callback to count it
+            data.packet_type = RADIO_PKT_SENSOR_BATCH;
+            data.mb_id = batch.mb_id;
+            radiobridge_data_callback(&data);
+            PROFILER_END(PROFILER_STAGE_RADIO_RX, profile_start);
+            return;
+        }
+        // Each sample goes to the callback as a single sample packet
+        data.packet_type = RADIO_PKT_SENSOR_DATA;
+        data.cmd_type = RADIO_CMD_INVALID;
+        data.mb_id = batch.mb_id;
+        for (size_t i = 0; i < batch.sample_count; i++) {
+            const radio_batch_sample_t *sample = &batch.samples[i];
+            data.id = batch.id + i;
+            data.sensor_data.accelerometer_x = sample->accelerometer_x;
+            data.sensor_data.accelerometer_y = sample->accelerometer_y;
+            data.sensor_data.accelerometer_z = sample->accelerometer_z;
+            data.sensor_data.button_a = (sample->buttons >> 0) & 1;
+            data.sensor_data.button_b = (sample->buttons >> 1) & 1;
+            data.sensor_data.button_logo = (sample->buttons >> 2) & 1;
+            data.sensor_data.capture_time_us = batch.capture_time_us + sample->capture_delta_us;
+            radiobridge_data_callback(&data);
+        }
+        PROFILER_END(PROFILER_STAGE_RADIO_RX, profile_start);
+        return;
     }
-    memcpy(&data, radio_packet.getBytes(), sizeof(data));
+    if (radio_packet_len != sizeof(data) && radio_packet_len != RADIO_PACKET_LEGACY_LEN) {
+        // Dropped, the callback only gets a packet type to count it, as the
+        // packet can't be trusted to be what its own type says
+        data = { };
+        data.packet_type = RADIO_PKT_TYPE_LEN;
+        radiobridge_data_callback(&data);
+        PROFILER_END(PROFILER_STAGE_RADIO_RX, profile_start);
+        return;
+    }
+    // The packets from the earlier remote micro:bits don't have the capture time
+    data = { };
+    memcpy(&data, radio_packet.getBytes(), radio_packet_len);
 
-    radiobridge_data_callback(&data);
+    // The replies to a radio frequency switch are not for the callback
+    if (data.packet_type == RADIO_PKT_RESPONSE && data.cmd_type == RADIO_CMD_CHANNEL) {
+        radiobridge_onChannelReply(&data);
+    } else {
+        radiobridge_data_callback(&data);
+    }
+    PROFILER_END(PROFILER_STAGE_RADIO_RX, profile_start);
 }
 #endif
 
 #if CONFIG_ENABLED(RADIO_REMOTE)
 /**
- * @brief Sends the periodic radio data.
+ * @brief Sample ID of the last sensor sample, the ID of the sensor data
+ * packets, or of the first sample in the multi-sample packets. It's a
+ * counter, not a randomised ID, as the bridge counts the lost, duplicated
+ * and reordered packets, and finds the restarts, from the gaps between IDs.
+ */
+static uint32_t radiotx_sample_id = 0;
+
+/**
+ * @brief Sampling period and samples per packet, from the bridge period, and
+ * the absolute time of the next sample.
+ */
+static uint32_t radiotx_period_us = RADIO_SAMPLE_PERIOD_MS * 1000;
+static size_t radiotx_batch_samples = RADIO_BATCH_SAMPLES;
+static CODAL_TIMESTAMP radiotx_next_sample_us = 0;
+static volatile bool radiotx_period_changed = false;
+
+/**
+ * @brief The sample is taken this long before the bridge needs it, for the
+ * radio packet to get there in time.
+ */
+static const uint32_t RADIOTX_SAMPLE_LEAD_US = 2000;
+
+// Event used to wake up the main fiber, any component ID not used by CODAL
+static const uint16_t RADIOTX_EVT_ID = 9510;
+static const uint16_t RADIOTX_EVT_SAMPLE = 1;
+static const uint16_t RADIOTX_EVT_PERIOD = 2;
+static const uint16_t RADIOTX_EVT_BEACON = 3;
+// Samples closer than this are busy waited, as the timer event could fire
+// before the main fiber starts waiting for it
+static const CODAL_TIMESTAMP RADIOTX_SPIN_US = 100;
+
+/**
+ * @brief Change-driven mode settings from the bridge, and the last sample
+ * sent, to compare the new samples against.
+ */
+static uint16_t radiotx_deadband_mg = 0;
+static uint32_t radiotx_heartbeat_us = 0;
+static radio_batch_sample_t radiotx_last_sent = { };
+static CODAL_TIMESTAMP radiotx_last_sent_us = 0;
+
+/**
+ * @brief Time-slotted mode from the bridge beacons, this micro:bit slot and
+ * the absolute time of the next one. Without any beacons for a few frames
+ * the packets are sent as soon as they are ready again.
+ */
+static uint32_t radiotx_frame_us = 0;
+static uint8_t radiotx_slot = RADIO_SLOT_NONE;
+static CODAL_TIMESTAMP radiotx_beacon_us = 0;
+static CODAL_TIMESTAMP radiotx_next_slot_us = 0;
+static const uint32_t RADIOTX_BEACON_TIMEOUT_FRAMES = 4;
+
+/**
+ * @brief Radio frequency this micro:bit is on, and the one it switches to.
+ * After a switch it goes back to the previous frequency if the bridge doesn't
+ * confirm it on the new one within a timeout.
+ */
+static uint8_t radiotx_frequency = 0;
+static uint8_t radiotx_frequency_target = 0;
+static uint8_t radiotx_frequency_previous = 0;
+static uint32_t radiotx_channel_switch_id = 0;
+static const uint32_t RADIOTX_CHANNEL_CONFIRM_TIMEOUT_US = 100000;
+// The replies from each micro:bit are spread over a few ms, so that they
+// don't all collide after each announcement
+static const uint32_t RADIOTX_CHANNEL_REPLY_SPREAD = 4;
+static const uint32_t RADIOTX_CHANNEL_REPLY_STEP_US = 1000;
+
+// Not RADIOTX_EVT_ID, so they don't wake up the main fiber
+static const uint16_t RADIOTX_CHANNEL_EVT_ID = 9512;
+static const uint16_t RADIOTX_CHANNEL_EVT_SWITCH = 1;
+static const uint16_t RADIOTX_CHANNEL_EVT_TIMEOUT = 2;
+static const uint16_t RADIOTX_CHANNEL_EVT_REPLY = 3;
+
+/**
+ * @return True if the packets are only sent in this micro:bit slot.
+ */
+static bool radiotx_slotted(const CODAL_TIMESTAMP now_us) {
+    return radiotx_frame_us != 0 && (now_us - radiotx_beacon_us) < (RADIOTX_BEACON_TIMEOUT_FRAMES * radiotx_frame_us);
+}
+
+/**
+ * @brief Reads the sensors into a sample, without its capture time delta.
+ */
+static void radiotx_readSample(radio_batch_sample_t *sample) {
+    sample->capture_delta_us = 0;
+    sample->accelerometer_x = (int16_t)uBit.accelerometer.getX();
+    sample->accelerometer_y = (int16_t)uBit.accelerometer.getY();
+    sample->accelerometer_z = (int16_t)uBit.accelerometer.getZ();
+    sample->buttons = (uint8_t)((uBit.buttonA.isPressed() ? 1 : 0) | (uBit.buttonB.isPressed() ? 2 : 0) |
+                                (uBit.logo.isPressed() ? 4 : 0));
+}
+
+/**
+ * @brief In the change-driven mode checks if a sample has to be sent, when
+ * any button or accelerometer axis has changed by more than the deadband
+ * from the last sample sent, or the heartbeat has expired. Every sample is
+ * sent outside of this mode.
+ *
+ * @return True if the sample has to be sent, which is then the last sent.
+ */
+static bool radiotx_sampleChanged(const radio_batch_sample_t *sample, const CODAL_TIMESTAMP now_us) {
+    if (radiotx_heartbeat_us != 0 && (now_us - radiotx_last_sent_us) < radiotx_heartbeat_us &&
+            sample->buttons == radiotx_last_sent.buttons &&
+            abs(sample->accelerometer_x - radiotx_last_sent.accelerometer_x) <= radiotx_deadband_mg &&
+            abs(sample->accelerometer_y - radiotx_last_sent.accelerometer_y) <= radiotx_deadband_mg &&
+            abs(sample->accelerometer_z - radiotx_last_sent.accelerometer_z) <= radiotx_deadband_mg) {
+        return false;
+    }
+    radiotx_last_sent = *sample;
+    radiotx_last_sent_us = now_us;
+    return true;
+}
+
+#if RADIO_BATCH_SAMPLES > 1
+/**
+ * @brief The multi-sample packet being filled, sent once it is full.
+ */
+static radio_batch_packet_t radiotx_batch = { };
+
+/**
+ * @brief Sends the samples in the multi-sample packet, if there are any.
+ */
+static void radiotx_sendBatch() {
+    if (radiotx_batch.sample_count == 0) return;
+
+    const size_t len = RADIO_BATCH_HEADER_LEN + (radiotx_batch.sample_count * sizeof(radio_batch_sample_t));
+    uint8_t radio_data[sizeof(radiotx_batch)];
+    memcpy(radio_data, &radiotx_batch, len);
+    uBit.radio.datagram.send(radio_data, len);
+    radiotx_batch.sample_count = 0;
+}
+
+/**
+ * @brief Drops the oldest sample of a full multi-sample packet still waiting
+ * for its slot, the bridge counts it as lost.
+ */
+static void radiotx_dropOldestSample() {
+    const uint16_t shift_us = radiotx_batch.samples[1].capture_delta_us;
+    for (size_t i = 1; i < radiotx_batch.sample_count; i++) {
+        radiotx_batch.samples[i - 1] = radiotx_batch.samples[i];
+        radiotx_batch.samples[i - 1].capture_delta_us -= shift_us;
+    }
+    radiotx_batch.sample_count--;
+    radiotx_batch.id++;
+    radiotx_batch.capture_time_us += shift_us;
+}
+
+/**
+ * @brief Sends the samples waiting for this micro:bit slot.
+ */
+static void radiotx_sendSlot() {
+    radiotx_sendBatch();
+}
+
+/**
+ * @brief Adds a sensor sample to the multi-sample packet, and sends it when
+ * it is full. In the change-driven mode the unchanged samples are skipped,
+ * and the packet is sent straight away, as the next sample could be a
+ * heartbeat away. In the time-slotted mode the packet waits for the slot,
+ * and if it fills up before then the oldest sample is dropped.
  */
 static void radiotx_sendPeriodicData() {
-    // TODO: Use a randomised ID instead of a counter
-    static uint32_t id = 0;
-    id++;
+    const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+    const bool slotted = radiotx_slotted(now_us);
+    radio_batch_sample_t sample;
+    radiotx_readSample(&sample);
+    if (!radiotx_sampleChanged(&sample, now_us)) {
+        if (!slotted) radiotx_sendBatch();
+        return;
+    }
+    // Only the samples sent have an ID, so the bridge doesn't count the skipped ones as lost
+    radiotx_sample_id++;
+
+    const uint32_t capture_time_us = (uint32_t)now_us;
+    // The sample can't be in the same packet if its capture time delta doesn't fit
+    if (radiotx_batch.sample_count > 0 && (capture_time_us - radiotx_batch.capture_time_us) > UINT16_MAX) {
+        radiotx_sendBatch();
+    }
+    if (radiotx_batch.sample_count == 0) {
+        radiotx_batch.packet_type = RADIO_PKT_SENSOR_BATCH;
+        radiotx_batch.padding = 0;
+        radiotx_batch.id = radiotx_sample_id;
+        radiotx_batch.mb_id = microbit_serial_number();
+        radiotx_batch.capture_time_us = capture_time_us;
+    }
+    if (radiotx_batch.sample_count == RADIO_BATCH_SAMPLES) radiotx_dropOldestSample();
+    sample.capture_delta_us = (uint16_t)(capture_time_us - radiotx_batch.capture_time_us);
+    radiotx_batch.samples[radiotx_batch.sample_count++] = sample;
+    if (!slotted && radiotx_batch.sample_count >= radiotx_batch_samples) {
+        radiotx_sendBatch();
+    }
+}
+#else
+/**
+ * @brief The latest sensor data packet waiting for this micro:bit slot.
+ */
+static radio_packet_t radiotx_pending = { };
+static bool radiotx_pending_valid = false;
+
+/**
+ * @brief Sends a sensor data packet.
+ */
+static void radiotx_sendPacket(const radio_packet_t *data) {
+    uint8_t radio_data[sizeof(*data)];
+    memcpy(radio_data, data, sizeof(*data));
 
+    uBit.radio.datagram.send(radio_data, sizeof(*data));
+}
+
+/**
+ * @brief Sends the packet waiting for this micro:bit slot, if there is one.
+ */
+static void radiotx_sendSlot() {
+    if (!radiotx_pending_valid) return;
+    radiotx_sendPacket(&radiotx_pending);
+    radiotx_pending_valid = false;
+}
+
+/**
+ * @brief Sends the periodic radio data, in the change-driven mode only if
+ * the sample has changed or the heartbeat has expired. In the time-slotted
+ * mode the packet waits for the slot, replacing any older one.
+ */
+static void radiotx_sendPeriodicData() {
+    const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+    radio_batch_sample_t sample;
+    radiotx_readSample(&sample);
+    if (!radiotx_sampleChanged(&sample, now_us)) return;
+
+    radiotx_sample_id++;
+    const uint32_t id = radiotx_sample_id;
+
+    const uint32_t capture_time_us = (uint32_t)now_us;
     radio_packet_t data = {
         .packet_type = RADIO_PKT_SENSOR_DATA,
         .cmd_type = RADIO_CMD_INVALID,
@@ -73,45 +432,183 @@ static void radiotx_sendPeriodicData() {
         .id = id,
         .mb_id = microbit_serial_number(),
         .sensor_data = {
-            .accelerometer_x = uBit.accelerometer.getX(),
-            .accelerometer_y = uBit.accelerometer.getY(),
-            .accelerometer_z = uBit.accelerometer.getZ(),
-            .button_a = (uint8_t)uBit.buttonA.isPressed(),
-            .button_b = (uint8_t)uBit.buttonB.isPressed(),
-            .button_logo = (uint8_t)uBit.logo.isPressed(),
+            .accelerometer_x = sample.accelerometer_x,
+            .accelerometer_y = sample.accelerometer_y,
+            .accelerometer_z = sample.accelerometer_z,
+            .button_a = (uint8_t)(sample.buttons & 1),
+            .button_b = (uint8_t)((sample.buttons >> 1) & 1),
+            .button_logo = (uint8_t)((sample.buttons >> 2) & 1),
             .padding = 0,
+            .capture_time_us = capture_time_us,
         },
     };
-
-    uint8_t radio_data[sizeof(data)];
-    memcpy(radio_data, &data, sizeof(data));
-
-    uBit.radio.datagram.send(radio_data, sizeof(data));
+    if (radiotx_slotted(now_us)) {
+        radiotx_pending = data;
+        radiotx_pending_valid = true;
+        return;
+    }
+    radiotx_sendPacket(&data);
 }
 #endif
+#endif
 
 
 // ----------------------------------------------------------------------------
 // BRIDGE FUNCTIONS -----------------------------------------------------------
 // ----------------------------------------------------------------------------
 #if CONFIG_ENABLED(RADIO_BRIDGE)
+/**
+ * @return The first hash table bucket to probe for a micro:bit ID.
+ */
+static inline size_t radiobridge_hashBucket(const uint32_t mb_id) {
+    // Multiplicative hash, as serial numbers from a batch can share bits
+    const uint32_t hash = mb_id * 2654435761UL;
+    return (size_t)(hash ^ (hash >> 16)) & (MB_HASH_LEN - 1);
+}
+
+/**
+ * @return The entry index of a micro:bit ID, or MB_REMOTE_NONE if it's not
+ *         in the registry.
+ */
+static uint8_t radiobridge_findRemote(const uint32_t mb_id) {
+    if (mb_id == 0) return MB_REMOTE_NONE;
+    for (size_t b = radiobridge_hashBucket(mb_id); mb_hash[b] != 0; b = (b + 1) & (MB_HASH_LEN - 1)) {
+        if (mb_remotes[mb_hash[b] - 1].mb_id == mb_id) return mb_hash[b] - 1;
+    }
+    return MB_REMOTE_NONE;
+}
+
+/**
+ * @brief Removes an entry from the hash table, moving back the entries
+ * after it in the same probe run, so that no tombstones are needed.
+ */
+static void radiobridge_unhashRemote(const uint8_t index) {
+    size_t hole = radiobridge_hashBucket(mb_remotes[index].mb_id);
+    while (mb_hash[hole] != index + 1) hole = (hole + 1) & (MB_HASH_LEN - 1);
+
+    for (size_t b = (hole + 1) & (MB_HASH_LEN - 1); mb_hash[b] != 0; b = (b + 1) & (MB_HASH_LEN - 1)) {
+        // Only move back an entry if its home bucket isn't between the hole and it
+        const size_t home = radiobridge_hashBucket(mb_remotes[mb_hash[b] - 1].mb_id);
+        if (((b - home) & (MB_HASH_LEN - 1)) >= ((b - hole) & (MB_HASH_LEN - 1))) {
+            mb_hash[hole] = mb_hash[b];
+            hole = b;
+        }
+    }
+    mb_hash[hole] = 0;
+}
+
+/**
+ * @brief Takes an entry out of the recently heard list.
+ */
+static void radiobridge_lruUnlink(const uint8_t index) {
+    mb_remote_t *remote = &mb_remotes[index];
+    if (remote->lru_prev == MB_REMOTE_NONE) lru_head = remote->lru_next;
+    else mb_remotes[remote->lru_prev].lru_next = remote->lru_next;
+    if (remote->lru_next == MB_REMOTE_NONE) lru_tail = remote->lru_prev;
+    else mb_remotes[remote->lru_next].lru_prev = remote->lru_prev;
+}
+
+/**
+ * @brief Adds an entry at the head of the recently heard list.
+ */
+static void radiobridge_lruPushHead(const uint8_t index) {
+    mb_remote_t *remote = &mb_remotes[index];
+    remote->lru_prev = MB_REMOTE_NONE;
+    remote->lru_next = lru_head;
+    if (lru_head == MB_REMOTE_NONE) lru_tail = index;
+    else mb_remotes[lru_head].lru_prev = index;
+    lru_head = index;
+}
+
+/**
+ * @brief Marks a remote micro:bit as just heard, at the head of the list.
+ */
+static void radiobridge_touchRemote(const uint8_t index, const uint32_t time) {
+    mb_remotes[index].time = time;
+    if (lru_head == index) return;
+    radiobridge_lruUnlink(index);
+    radiobridge_lruPushHead(index);
+}
+
+/**
+ * @brief Forgets a remote micro:bit, its entry goes back to the free list.
+ */
+static void radiobridge_removeRemote(const uint8_t index) {
+    radiobridge_unhashRemote(index);
+    radiobridge_lruUnlink(index);
+    mb_remotes[index] = { };
+    mb_remotes[index].lru_next = free_head;
+    free_head = index;
+}
+
+/**
+ * @return The least recently heard remote micro:bit that is not the active
+ *         one, or MB_REMOTE_NONE.
+ */
+static uint8_t radiobridge_lruOldestInactive() {
+    uint8_t index = lru_tail;
+    if (index != MB_REMOTE_NONE && index == active_mb_index) index = mb_remotes[index].lru_prev;
+    return index;
+}
+
+/**
+ * @brief Forgets the inactive remote micro:bits that haven't been heard for
+ * a while, they are all at the tail of the list.
+ */
+static void radiobridge_expireRemotes(const uint32_t now) {
+    static const uint32_t TIME_TO_FORGET_MS = 3000;
+
+    // Comparing the elapsed time is also correct in the first seconds after boot
+    uint8_t index;
+    while ((index = radiobridge_lruOldestInactive()) != MB_REMOTE_NONE &&
+            (now - mb_remotes[index].time) > TIME_TO_FORGET_MS) {
+        radiobridge_removeRemote(index);
+    }
+}
+
+/**
+ * @brief Adds a micro:bit ID to the registry, without any sensor data packets
+ * received yet. If it's full it's not added, as the entries are only reused
+ * once they expire, so that the multi remote indexes don't change while
+ * their remote micro:bits are still sending.
+ *
+ * @return The new entry index, or MB_REMOTE_NONE if it could not be added.
+ */
+static uint8_t radiobridge_addRemote(const uint32_t mb_id, const uint32_t time) {
+    if (mb_id == 0) return MB_REMOTE_NONE;
+    if (free_head == MB_REMOTE_NONE && mb_remotes_used < MB_REMOTES_LEN) {
+        // Entries that have never been used are not in the free list
+        free_head = mb_remotes_used++;
+        mb_remotes[free_head].lru_next = MB_REMOTE_NONE;
+    }
+    if (free_head == MB_REMOTE_NONE) return MB_REMOTE_NONE;
+    const uint8_t index = free_head;
+    free_head = mb_remotes[index].lru_next;
+
+    mb_remotes[index] = { };
+    mb_remotes[index].mb_id = mb_id;
+    mb_remotes[index].time = time;
+    radiobridge_lruPushHead(index);
+
+    size_t b = radiobridge_hashBucket(mb_id);
+    while (mb_hash[b] != 0) b = (b + 1) & (MB_HASH_LEN - 1);
+    mb_hash[b] = index + 1;
+    return index;
+}
+
 void radiobridge_init(const radio_data_callback_t callback, const uint8_t radio_frequency) {
     radiobridge_data_callback = callback;
     uBit.radio.enable();
     uBit.radio.setTransmitPower(MICROBIT_RADIO_POWER_LEVELS - 1);
     uBit.radio.setFrequencyBand(radio_frequency);
+    channel_frequency = radio_frequency;
     uBit.messageBus.listen(MICROBIT_ID_RADIO, MICROBIT_RADIO_EVT_DATAGRAM, radiobridge_onRadioData);
-}
-
-int radiobridge_setRadioFrequencyAllMbs(const uint8_t radio_frequency) {
-    // TODO: Figure out a way to broadcast the frequency to all micro:bits
-    //       and make sure they all have received the command to change their
-    //       frequency
-    return uBit.radio.setFrequencyBand(radio_frequency);
+    uBit.messageBus.listen(RADIOBRIDGE_EVT_ID, MICROBIT_EVT_ANY, radiobridge_onChannelEvent);
 }
 
 void radiobridge_sendCommand(const uint32_t mb_id, const radio_cmd_type_t cmd, const radio_cmd_t *value) {
-    // TODO: Use a randomised ID instead of a counter
+    // The remote micro:bits don't look at the ID of the commands, only the
+    // channel announcements have their own, so a counter is enough
     static uint32_t id = 0;
     id++;
 
@@ -123,6 +620,7 @@ void radiobridge_sendCommand(const uint32_t mb_id, const radio_cmd_type_t cmd, c
         .mb_id = mb_id,
         .cmd_data = { },
     };
+    if (value != NULL) radio_cmd.cmd_data = *value;
     // uBit.serial.printf("[RADIO CMD] Sending command %d to %x\n", cmd, mb_id);
 
     uint8_t radio_data[sizeof(radio_cmd)];
@@ -131,70 +629,288 @@ void radiobridge_sendCommand(const uint32_t mb_id, const radio_cmd_type_t cmd, c
     uBit.radio.datagram.send(radio_data, sizeof(radio_data));
 }
 
+/**
+ * @brief Updates the sequence counters of a remote micro:bit with a received
+ * sensor data packet ID.
+ */
+static radio_seq_t radiobridge_updateSeq(mb_remote_t *remote, const uint32_t packet_id) {
+    radio_seq_stats_t *seq_stats = &remote->seq_stats;
+    // Unsigned subtraction, correct across the packet ID wrap around
+    const int32_t diff = (int32_t)(packet_id - remote->seq);
+
+    if (seq_stats->received == 0 || diff > MB_SEQ_MAX_GAP || diff <= -MB_SEQ_WINDOW) {
+        // First packet from this micro:bit, or it has restarted
+        remote->seq = packet_id;
+        remote->seq_window = 1;
+        seq_stats->received++;
+        return RADIO_SEQ_NEW;
+    }
+    if (diff > 0) {
+        seq_stats->lost += (uint32_t)(diff - 1);
+        remote->seq = packet_id;
+        remote->seq_window = (diff < MB_SEQ_WINDOW) ? ((remote->seq_window << diff) | 1) : 1;
+        seq_stats->received++;
+        return RADIO_SEQ_NEW;
+    }
+    const uint32_t packet_bit = 1UL << (uint32_t)(-diff);
+    if (remote->seq_window & packet_bit) {
+        seq_stats->duplicated++;
+        return RADIO_SEQ_DUPLICATE;
+    }
+    // This packet was counted as lost when the newer one arrived
+    remote->seq_window |= packet_bit;
+    if (seq_stats->lost > 0) seq_stats->lost--;
+    seq_stats->reordered++;
+    seq_stats->received++;
+    return RADIO_SEQ_REORDERED;
+}
+
 void radiobridge_setActiveRemoteMbId(const uint32_t mb_id) {
-    uint32_t oldest_mb_time = 0xFFFFFFFF;
-    size_t oldest_mb_index = 0;
-    for (size_t i = 0; i < MB_IDS_LEN; i++) {
-        if (mb_ids[i][MB_IDS_ID] == mb_id) {
-            // ID on the list already, so ensure it's the active one and return
-            mb_ids[i][MB_IDS_TIME] = uBit.systemTime();
-            active_mb_id_i = i;
-            return;
-        }
-        if (mb_ids[i][MB_IDS_TIME] < oldest_mb_time) {
-            // This will either save the first empty or the oldest slot
-            oldest_mb_time = mb_ids[i][MB_IDS_TIME];
-            oldest_mb_index = i;
+    const uint32_t now = uBit.systemTime();
+    uint8_t index = radiobridge_findRemote(mb_id);
+    if (index == MB_REMOTE_NONE) {
+        // Set the new active one first, so that any remote can be replaced, as
+        // the host has chosen it, while the ones heard have to wait for space
+        active_mb_index = MB_REMOTE_NONE;
+        if (free_head == MB_REMOTE_NONE && mb_remotes_used == MB_REMOTES_LEN) {
+            const uint8_t oldest = radiobridge_lruOldestInactive();
+            if (oldest != MB_REMOTE_NONE) radiobridge_removeRemote(oldest);
         }
+        index = radiobridge_addRemote(mb_id, now);
+    } else {
+        radiobridge_touchRemote(index, now);
     }
-    // The ID is not in the list yet, so store it in first empty or oldest slot
-    mb_ids[oldest_mb_index][MB_IDS_ID] = mb_id;
-    mb_ids[oldest_mb_index][MB_IDS_TIME] = uBit.systemTime();
-    active_mb_id_i = oldest_mb_index;
+    active_mb_index = index;
 }
 
-void radiobridge_updateRemoteMbIds(const uint32_t mb_id) {
-    static const uint32_t TIME_TO_FORGET_MS = 3000;
+radio_seq_t radiobridge_updateRemoteMbIds(const uint32_t mb_id, const uint32_t packet_id, size_t *remote_index) {
+    const uint32_t now = uBit.systemTime();
 
-    uint32_t now = uBit.systemTime();
-    uint32_t time_threshold = now - TIME_TO_FORGET_MS;
+    radiobridge_expireRemotes(now);
+    uint8_t index = radiobridge_findRemote(mb_id);
+    if (index == MB_REMOTE_NONE) {
+        index = radiobridge_addRemote(mb_id, now);
+    } else {
+        radiobridge_touchRemote(index, now);
+    }
+    // If we don't have an active micro:bit, the first one heard is set as active
+    if (active_mb_index == MB_REMOTE_NONE) active_mb_index = index;
 
-    // If we don't have an active micro:bit, add to top of array and set as active
-    if (active_mb_id_i == MB_IDS_LEN) {
-        mb_ids[0][MB_IDS_ID] = mb_id;
-        mb_ids[0][MB_IDS_TIME] = now;
-        active_mb_id_i = 0;
+    // Without an entry the sequence can't be tracked, so take any packet as new
+    if (index == MB_REMOTE_NONE) {
+        *remote_index = MB_REMOTES_LEN;
+        return RADIO_SEQ_NEW;
+    }
+    *remote_index = index;
+    return radiobridge_updateSeq(&mb_remotes[index], packet_id);
+}
+
+uint32_t radiobridge_getRemoteMbId(const size_t remote_index) {
+    if (remote_index >= MB_REMOTES_LEN) return 0;
+    return mb_remotes[remote_index].mb_id;
+}
+
+int radiobridge_getRemoteSeqStats(const uint32_t mb_id, radio_seq_stats_t *seq_stats) {
+    const uint8_t index = radiobridge_findRemote(mb_id);
+    if (index == MB_REMOTE_NONE) return MICROBIT_INVALID_PARAMETER;
+    *seq_stats = mb_remotes[index].seq_stats;
+    return MICROBIT_OK;
+}
+
+void radiobridge_sendPeriod(const uint32_t mb_id, const uint32_t period_us, const uint32_t phase_us,
+                            const uint16_t deadband_mg, const uint16_t heartbeat_ms) {
+    uint32_t batch_samples = (RADIO_PACKET_INTERVAL_MIN_US + period_us - 1) / period_us;
+    if (batch_samples < 1) batch_samples = 1;
+    if (batch_samples > RADIO_BATCH_SAMPLES) batch_samples = RADIO_BATCH_SAMPLES;
+
+    const radio_cmd_period_t period = {
+        .period_us = period_us,
+        .phase_us = phase_us,
+        .batch_samples = (uint8_t)batch_samples,
+        .padding = 0,
+        .deadband_mg = deadband_mg,
+        .heartbeat_ms = heartbeat_ms,
+        .padding2 = { },
+    };
+    radio_cmd_t value;
+    memcpy(&value, &period, sizeof(value));
+    radiobridge_sendCommand(mb_id, RADIO_CMD_PERIOD, &value);
+}
+
+uint32_t radiobridge_sendBeacon(const uint32_t period_us) {
+    // The slots are the registry entries, so they only change when a remote
+    // micro:bit is forgotten, plus one slot for the beacon and one for the
+    // remote micro:bits not in the registry yet
+    uint32_t frame_us = (mb_remotes_used + 2) * RADIO_SLOT_US;
+    if (frame_us < RADIO_PACKET_INTERVAL_MIN_US) frame_us = RADIO_PACKET_INTERVAL_MIN_US;
+    if (period_us > 0) frame_us = ((frame_us + period_us - 1) / period_us) * period_us;
+
+    radio_cmd_beacon_t beacon = {
+        .frame_us = frame_us,
+        .slot_us = RADIO_SLOT_US,
+        .slot_count = mb_remotes_used,
+        .slot = RADIO_SLOT_NONE,
+        .slot_mb_id = 0,
+        .padding = { },
+    };
+    // Each beacon assigns the next slot in use, in turn
+    static uint8_t next_slot = 0;
+    for (size_t i = 0; i < mb_remotes_used; i++) {
+        const uint8_t index = (uint8_t)((next_slot + i) % mb_remotes_used);
+        if (mb_remotes[index].mb_id == 0) continue;
+        beacon.slot = index;
+        beacon.slot_mb_id = mb_remotes[index].mb_id;
+        next_slot = index + 1;
+        break;
+    }
+
+    radio_cmd_t value;
+    memcpy(&value, &beacon, sizeof(value));
+    radiobridge_sendCommand(0, RADIO_CMD_BEACON, &value);
+    return frame_us;
+}
+
+/**
+ * @brief Broadcasts a radio frequency switch, with the time left until it,
+ * or 0 to confirm or cancel it.
+ */
+static void radiobridge_sendChannel(const uint8_t frequency, const uint32_t switch_in_us) {
+    const radio_cmd_channel_t channel = {
+        .frequency = frequency,
+        .padding = { },
+        .switch_in_us = switch_in_us,
+        .switch_id = channel_switch_id,
+        .padding2 = { },
+    };
+    radio_cmd_t value;
+    memcpy(&value, &channel, sizeof(value));
+    radiobridge_sendCommand(0, RADIO_CMD_CHANNEL, &value);
+}
+
+/**
+ * @brief Sets all the remote micro:bits that have sent sensor data to wait
+ * for their reply to the switch.
+ *
+ * @return True if there is any remote micro:bit to wait for.
+ */
+static bool radiobridge_channelWaitAll() {
+    bool waiting = false;
+    for (size_t i = 0; i < mb_remotes_used; i++) {
+        mb_remotes[i].channel_wait = mb_remotes[i].mb_id != 0 && mb_remotes[i].seq_stats.received > 0;
+        waiting |= mb_remotes[i].channel_wait;
+    }
+    return waiting;
+}
+
+/**
+ * @brief Announces the switch with a new switch ID and time, the replies to
+ * any previous announcement don't count for this one.
+ */
+static void radiobridge_announceChannel(const CODAL_TIMESTAMP now_us) {
+    // Each announcement has a new ID, so the late replies to the previous
+    // attempts, or to a cancelled switch, can't be taken for this one
+    static uint32_t switch_id = 0;
+    channel_switch_id = ++switch_id;
+    channel_switch_us = now_us + RADIO_CHANNEL_SWITCH_DELAY_US;
+    channel_attempts++;
+    radiobridge_sendChannel(channel_target, RADIO_CHANNEL_SWITCH_DELAY_US);
+}
+
+static void radiobridge_onChannelReply(const radio_packet_t *packet) {
+    if (channel_state != RADIO_CHANNEL_ANNOUNCING || packet->id != channel_switch_id) return;
+
+    const uint8_t index = radiobridge_findRemote(packet->mb_id);
+    if (index != MB_REMOTE_NONE) mb_remotes[index].channel_wait = false;
+}
+
+/**
+ * @brief Timer event handler for each step of the radio frequency switch.
+ *
+ * The announcement is repeated every tick until a guard time before the
+ * switch, for the remote micro:bits that missed it or whose reply was lost.
+ */
+static void radiobridge_onChannelEvent(MicroBitEvent e) {
+    const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+
+    if (e.value == RADIOBRIDGE_EVT_CHANNEL_SWITCH) {
+        if (channel_state != RADIO_CHANNEL_SWITCHING) return;
+        uBit.radio.setFrequencyBand(channel_target);
+        channel_frequency = channel_target;
+        channel_state = RADIO_CHANNEL_CONFIRMING;
+        channel_until_us = now_us + RADIO_CHANNEL_CONFIRM_US;
+        radiobridge_sendChannel(channel_frequency, 0);
         return;
     }
+    if (e.value != RADIOBRIDGE_EVT_CHANNEL_TICK) return;
 
-    bool found_mb_id = false;
-    uint32_t oldest_mb_time = 0xFFFFFFFF;
-    size_t oldest_mb_index = MB_IDS_LEN;
-    for (size_t i = 0; i < MB_IDS_LEN; i++) {
-        if (mb_ids[i][MB_IDS_ID] == mb_id) {
-            mb_ids[i][MB_IDS_TIME] = now;
-            found_mb_id = true;
-        } else {
-            if (mb_ids[i][MB_IDS_ID] == GET_ACTIVE_MB_ID()) {
-                // We don't want to remove the active micro:bit from the list
-                continue;
-            }
-            if (mb_ids[i][MB_IDS_TIME] < time_threshold) {
-                // It's been too long since this inactive micro:bit was heard, forget it
-                mb_ids[i][MB_IDS_ID] = 0;
-                mb_ids[i][MB_IDS_TIME] = 0;
+    switch (channel_state) {
+        case RADIO_CHANNEL_ANNOUNCING: {
+            if ((now_us + RADIO_CHANNEL_GUARD_US) < channel_switch_us) {
+                radiobridge_sendChannel(channel_target, (uint32_t)(channel_switch_us - now_us));
+                break;
             }
-            if (mb_ids[i][MB_IDS_TIME] < oldest_mb_time) {
-                // This will either save the first empty or the oldest inactive slot
-                oldest_mb_time = mb_ids[i][MB_IDS_TIME];
-                oldest_mb_index = i;
+            bool waiting = false;
+            for (size_t i = 0; i < mb_remotes_used; i++) waiting |= mb_remotes[i].channel_wait;
+            if (!waiting) {
+                channel_state = RADIO_CHANNEL_SWITCHING;
+                system_timer_event_after_us(channel_switch_us > now_us ? channel_switch_us - now_us : 1,
+                                            RADIOBRIDGE_EVT_ID, RADIOBRIDGE_EVT_CHANNEL_SWITCH);
+            } else if (channel_attempts < RADIO_CHANNEL_ATTEMPTS) {
+                // The remote micro:bits that replied before reschedule their switch as well
+                radiobridge_channelWaitAll();
+                radiobridge_announceChannel(now_us);
+            } else {
+                // Roll back, the remote micro:bits that still switch go back
+                // without the confirmation on the new frequency
+                channel_state = RADIO_CHANNEL_CANCELLING;
+                channel_until_us = channel_switch_us + RADIO_CHANNEL_GUARD_US;
+                radiobridge_sendChannel(channel_frequency, 0);
             }
+            break;
         }
+        case RADIO_CHANNEL_CONFIRMING:
+        case RADIO_CHANNEL_CANCELLING:
+            if (now_us < channel_until_us) {
+                radiobridge_sendChannel(channel_frequency, 0);
+                break;
+            }
+            channel_state = RADIO_CHANNEL_IDLE;
+            system_timer_cancel_event(RADIOBRIDGE_EVT_ID, RADIOBRIDGE_EVT_CHANNEL_TICK);
+            break;
+        default:
+            break;
     }
-    if (!found_mb_id && oldest_mb_index != MB_IDS_LEN) {
-        mb_ids[oldest_mb_index][MB_IDS_ID] = mb_id;
-        mb_ids[oldest_mb_index][MB_IDS_TIME] = now;
+}
+
+int radiobridge_setRadioFrequencyAllMbs(const uint8_t radio_frequency) {
+    if (radio_frequency > MAX_RADIO_FREQUENCY) return MICROBIT_INVALID_PARAMETER;
+    if (channel_state != RADIO_CHANNEL_IDLE) return MICROBIT_BUSY;
+    if (radio_frequency == channel_frequency) return MICROBIT_OK;
+
+    // Without any remote micro:bits to tell there is nothing to wait for
+    if (!radiobridge_channelWaitAll()) return radiobridge_setRadioFrequency(radio_frequency);
+
+    channel_state = RADIO_CHANNEL_ANNOUNCING;
+    channel_target = radio_frequency;
+    channel_attempts = 0;
+    radiobridge_announceChannel(system_timer_current_time_us());
+    system_timer_event_every_us(RADIO_CHANNEL_TICK_US, RADIOBRIDGE_EVT_ID, RADIOBRIDGE_EVT_CHANNEL_TICK);
+    return MICROBIT_OK;
+}
+
+int radiobridge_setRadioFrequency(const uint8_t radio_frequency) {
+    if (channel_state != RADIO_CHANNEL_IDLE) {
+        channel_state = RADIO_CHANNEL_IDLE;
+        system_timer_cancel_event(RADIOBRIDGE_EVT_ID, RADIOBRIDGE_EVT_CHANNEL_TICK);
+        system_timer_cancel_event(RADIOBRIDGE_EVT_ID, RADIOBRIDGE_EVT_CHANNEL_SWITCH);
     }
+    const int result = uBit.radio.setFrequencyBand(radio_frequency);
+    if (result == MICROBIT_OK) channel_frequency = radio_frequency;
+    return result;
+}
+
+uint8_t radiobridge_getRadioFrequency() {
+    return channel_frequency;
 }
 
 /**
@@ -207,23 +923,22 @@ void radiobridge_switchNextRemoteMicrobit() {
     last_switch_time = uBit.systemTime();
 
     // Nothing to do if there is no active micro:bit
-    if (active_mb_id_i == MB_IDS_LEN) return;
-    // Or if the active micro:bit somehow does not have an ID assigned
-    // TODO: This is an error condition, we should do something to recover
-    if (GET_ACTIVE_MB_ID() == 0) return;
-
-    // Rotate the active micro:bit ID to the next one in the mb_ids array that has a value
-    // If there isn't any other active micro:bits, then the current active will be picked again
-    size_t next_active_mb_id_i = active_mb_id_i;
+    if (active_mb_index == MB_REMOTE_NONE) return;
+
+    // Rotate the active micro:bit to the next entry in use, in index order as
+    // the recently heard order changes with every packet. If there isn't any
+    // other active micro:bits, then the current active will be picked again
+    size_t next_active_mb_index = active_mb_index;
     do {
-        next_active_mb_id_i = (next_active_mb_id_i + 1) % MB_IDS_LEN;
-    } while (mb_ids[next_active_mb_id_i][MB_IDS_ID] == 0);
-    active_mb_id_i = next_active_mb_id_i;
-    radiobridge_sendCommand(GET_ACTIVE_MB_ID(), RADIO_CMD_BLINK);
+        next_active_mb_index = (next_active_mb_index + 1) % MB_REMOTES_LEN;
+    } while (mb_remotes[next_active_mb_index].mb_id == 0);
+    active_mb_index = (uint8_t)next_active_mb_index;
+    radiobridge_sendCommand(mb_remotes[active_mb_index].mb_id, RADIO_CMD_BLINK);
 }
 
 uint32_t radiobridge_getActiveRemoteMbId() {
-    return GET_ACTIVE_MB_ID();
+    if (active_mb_index == MB_REMOTE_NONE) return 0;
+    return mb_remotes[active_mb_index].mb_id;
 }
 #endif
 
@@ -249,14 +964,130 @@ static void radiotx_cmd_blink(const radio_cmd_t *value) {
     });
 }
 
+/**
+ * @brief Sets the sampling period and change-driven mode to the bridge ones,
+ * and if the phase is included the next sample is taken just before the
+ * bridge needs it.
+ */
+static void radiotx_cmd_period(const radio_cmd_t *value) {
+    radio_cmd_period_t period;
+    memcpy(&period, value, sizeof(period));
+    if (period.period_us == 0) return;
+
+    const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+    radiotx_period_us = period.period_us;
+    radiotx_batch_samples = period.batch_samples;
+    if (radiotx_batch_samples < 1) radiotx_batch_samples = 1;
+    if (radiotx_batch_samples > RADIO_BATCH_SAMPLES) radiotx_batch_samples = RADIO_BATCH_SAMPLES;
+    radiotx_deadband_mg = period.deadband_mg;
+    radiotx_heartbeat_us = period.heartbeat_ms * 1000;
+    if (period.phase_us != RADIO_PHASE_NONE) {
+        // The next sample a lead time before the bridge deadline, within the next period
+        const uint32_t offset_us = ((period.phase_us % radiotx_period_us) + radiotx_period_us -
+                                    (RADIOTX_SAMPLE_LEAD_US % radiotx_period_us)) % radiotx_period_us;
+        radiotx_next_sample_us = now_us + offset_us;
+    } else if (radiotx_next_sample_us > now_us + radiotx_period_us) {
+        radiotx_next_sample_us = now_us + radiotx_period_us;
+    }
+    radiotx_period_changed = true;
+    // Wake up the main fiber to wait for the new sample time
+    MicroBitEvent(RADIOTX_EVT_ID, RADIOTX_EVT_PERIOD);
+}
+
+/**
+ * @brief Starts a time-slotted frame, the next packet is sent in this
+ * micro:bit slot, or in the slot after the last one if it hasn't been
+ * assigned one yet.
+ */
+static void radiotx_cmd_beacon(const radio_cmd_t *value) {
+    radio_cmd_beacon_t beacon;
+    memcpy(&beacon, value, sizeof(beacon));
+    if (beacon.frame_us == 0 || beacon.slot_us == 0) return;
+
+    const CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+    if (beacon.slot_mb_id == microbit_serial_number()) {
+        radiotx_slot = beacon.slot;
+    } else if (beacon.slot == radiotx_slot || radiotx_slot >= beacon.slot_count) {
+        // The bridge has forgotten this micro:bit, and it might have given its slot away
+        radiotx_slot = RADIO_SLOT_NONE;
+    }
+    const uint32_t slot_index = (radiotx_slot != RADIO_SLOT_NONE ? radiotx_slot : beacon.slot_count) + 1;
+    radiotx_frame_us = beacon.frame_us;
+    radiotx_beacon_us = now_us;
+    radiotx_next_slot_us = now_us + (slot_index * beacon.slot_us);
+    // Wake up the main fiber to wait for the slot
+    MicroBitEvent(RADIOTX_EVT_ID, RADIOTX_EVT_BEACON);
+}
+
+/**
+ * @brief Schedules the switch announced by the bridge, and replies to it. A
+ * switch to the current frequency, to confirm or cancel the last one, stops
+ * any pending switch or timeout.
+ */
+static void radiotx_cmd_channel(const radio_cmd_t *value) {
+    radio_cmd_channel_t channel;
+    memcpy(&channel, value, sizeof(channel));
+
+    system_timer_cancel_event(RADIOTX_CHANNEL_EVT_ID, RADIOTX_CHANNEL_EVT_SWITCH);
+    system_timer_cancel_event(RADIOTX_CHANNEL_EVT_ID, RADIOTX_CHANNEL_EVT_TIMEOUT);
+    if (channel.frequency == radiotx_frequency || channel.frequency > MAX_RADIO_FREQUENCY) return;
+    // A confirmation of a switch this micro:bit didn't make
+    if (channel.switch_in_us == 0) return;
+
+    radiotx_frequency_target = channel.frequency;
+    radiotx_channel_switch_id = channel.switch_id;
+    system_timer_event_after_us(channel.switch_in_us, RADIOTX_CHANNEL_EVT_ID, RADIOTX_CHANNEL_EVT_SWITCH);
+    const uint32_t reply_in_us =
+        ((microbit_serial_number() % RADIOTX_CHANNEL_REPLY_SPREAD) * RADIOTX_CHANNEL_REPLY_STEP_US) + 1;
+    system_timer_event_after_us(reply_in_us, RADIOTX_CHANNEL_EVT_ID, RADIOTX_CHANNEL_EVT_REPLY);
+}
+
+/**
+ * @brief Timer event handler for the radio frequency switch, the reply to
+ * the bridge, the switch itself, and going back when it's not confirmed.
+ */
+static void radiotx_onChannelEvent(MicroBitEvent e) {
+    switch (e.value) {
+        case RADIOTX_CHANNEL_EVT_REPLY: {
+            radio_packet_t reply = {
+                .packet_type = RADIO_PKT_RESPONSE,
+                .cmd_type = RADIO_CMD_CHANNEL,
+                .padding = 0,
+                .id = radiotx_channel_switch_id,
+                .mb_id = microbit_serial_number(),
+                .cmd_data = { },
+            };
+            uint8_t radio_data[sizeof(reply)];
+            memcpy(radio_data, &reply, sizeof(reply));
+            uBit.radio.datagram.send(radio_data, sizeof(radio_data));
+            break;
+        }
+        case RADIOTX_CHANNEL_EVT_SWITCH:
+            radiotx_frequency_previous = radiotx_frequency;
+            radiotx_frequency = radiotx_frequency_target;
+            uBit.radio.setFrequencyBand(radiotx_frequency);
+            system_timer_event_after_us(RADIOTX_CHANNEL_CONFIRM_TIMEOUT_US,
+                                        RADIOTX_CHANNEL_EVT_ID, RADIOTX_CHANNEL_EVT_TIMEOUT);
+            break;
+        case RADIOTX_CHANNEL_EVT_TIMEOUT:
+            radiotx_frequency = radiotx_frequency_previous;
+            uBit.radio.setFrequencyBand(radiotx_frequency);
+            break;
+        default:
+            break;
+    }
+}
+
 static void radiotx_onRadioData(MicroBitEvent e) {
     radio_packet_t received_cmd;
     PacketBuffer radio_packet = uBit.radio.datagram.recv();
-    if (radio_packet.length() != sizeof(received_cmd)) {
-        // TODO: Maybe ignore the packet instead? or issue error to callback?
-        uBit.panic(241);
-    }
-    memcpy(&received_cmd, radio_packet.getBytes(), sizeof(received_cmd));
+    // The multi-sample packets from other remote micro:bits, and any other
+    // packets with a different length, are not commands
+    const size_t radio_packet_len = (size_t)radio_packet.length();
+    if (radio_packet_len != sizeof(received_cmd) && radio_packet_len != RADIO_PACKET_LEGACY_LEN) return;
+    // The commands from an earlier bridge are shorter, without the padding at the end
+    received_cmd = { };
+    memcpy(&received_cmd, radio_packet.getBytes(), radio_packet_len);
 
     // Ignore packets that are not commands
     if (received_cmd.packet_type != RADIO_PKT_CMD) return;
@@ -264,38 +1095,92 @@ static void radiotx_onRadioData(MicroBitEvent e) {
     // Ignore commands for other boards, mb_id == 0 means command for all boards
     if (received_cmd.mb_id != 0 && received_cmd.mb_id != microbit_serial_number()) return;
 
-    // Execute the command
+    // Execute the command, if this remote micro:bit implements it
+    if (received_cmd.cmd_type >= RADIO_CMD_TYPE_LEN) return;
+    if (radiotx_cmd_functions[received_cmd.cmd_type] == NULL) return;
     radiotx_cmd_functions[received_cmd.cmd_type](&received_cmd.cmd_data);
 }
 
 void radiotx_mainLoop() {
     radiotx_cmd_functions[RADIO_CMD_BLINK] = radiotx_cmd_blink;
+    radiotx_cmd_functions[RADIO_CMD_PERIOD] = radiotx_cmd_period;
+    radiotx_cmd_functions[RADIO_CMD_BEACON] = radiotx_cmd_beacon;
+    radiotx_cmd_functions[RADIO_CMD_CHANNEL] = radiotx_cmd_channel;
 
     // Configure the radio, and configure frequency based on this micro:bit's ID
     uBit.radio.enable();
     uBit.radio.setTransmitPower(MICROBIT_RADIO_POWER_LEVELS - 1);
-    uint8_t radio_frequency = radio_getFrequencyFromId(microbit_serial_number());
-    uBit.radio.setFrequencyBand(radio_frequency);
+    radiotx_frequency = radio_getFrequencyFromId(microbit_serial_number());
+    uBit.radio.setFrequencyBand(radiotx_frequency);
     uBit.messageBus.listen(MICROBIT_ID_RADIO, MICROBIT_RADIO_EVT_DATAGRAM, radiotx_onRadioData);
+    uBit.messageBus.listen(RADIOTX_CHANNEL_EVT_ID, MICROBIT_EVT_ANY, radiotx_onChannelEvent);
+
+    // Sample the accelerometer as often as its values are sent
+    uBit.accelerometer.setPeriod(RADIO_SAMPLE_PERIOD_MS);
 
     uBit.display.print(IMG_RUNNING);
     bool broadcast_sensors = true;
 
+    // Samples are taken on absolute deadlines, a period apart, so that the
+    // rate doesn't drift with the time it takes to take and send them, and
+    // in the time-slotted mode the packets are sent on the slot deadlines
+    radiotx_next_sample_us = system_timer_current_time_us();
     while (true) {
-        if (broadcast_sensors) {
-            radiotx_sendPeriodicData();
+        CODAL_TIMESTAMP now_us = system_timer_current_time_us();
+        const bool slotted = radiotx_slotted(now_us);
+        const CODAL_TIMESTAMP wake_us = (slotted && radiotx_next_slot_us < radiotx_next_sample_us) ?
+                                        radiotx_next_slot_us : radiotx_next_sample_us;
+        if ((now_us + RADIOTX_SPIN_US) < wake_us) {
+            system_timer_event_after_us(wake_us - now_us, RADIOTX_EVT_ID, RADIOTX_EVT_SAMPLE);
+            fiber_wait_for_event(RADIOTX_EVT_ID, MICROBIT_EVT_ANY);
+            system_timer_cancel_event(RADIOTX_EVT_ID, RADIOTX_EVT_SAMPLE);
+            continue;
+        }
+        while ((now_us = system_timer_current_time_us()) < wake_us);
+
+        if (now_us >= radiotx_next_sample_us) {
+            if (radiotx_period_changed) {
+                radiotx_period_changed = false;
+#if RADIO_BATCH_SAMPLES > 1
+                // The samples with the previous period go in their own packet, unless it has to wait for its slot
+                if (!slotted) radiotx_sendBatch();
+#endif
+                const int accelerometer_period_ms = (int)(radiotx_period_us / 1000);
+                uBit.accelerometer.setPeriod(accelerometer_period_ms > 0 ? accelerometer_period_ms : 1);
+            }
+
+            if (broadcast_sensors) {
+                radiotx_sendPeriodicData();
+            }
+
+            // If already past the next sample time skip it, instead of a burst to catch up
+            radiotx_next_sample_us += radiotx_period_us;
+            now_us = system_timer_current_time_us();
+            if (now_us >= radiotx_next_sample_us) {
+                radiotx_next_sample_us += (((now_us - radiotx_next_sample_us) / radiotx_period_us) + 1) * radiotx_period_us;
+            }
+        }
+
+        if (slotted && now_us >= radiotx_next_slot_us) {
+            radiotx_sendSlot();
+            // Until the next beacon the slots follow the last one, a frame apart
+            radiotx_next_slot_us += radiotx_frame_us;
+            if (now_us >= radiotx_next_slot_us) {
+                radiotx_next_slot_us += (((now_us - radiotx_next_slot_us) / radiotx_frame_us) + 1) * radiotx_frame_us;
+            }
         }
 
 #if CONFIG_ENABLED(DEV_MODE)
         // For development and testing, start or stop broadcasting data
         if (uBit.buttonA.isPressed()) {
             broadcast_sensors = !broadcast_sensors;
+#if RADIO_BATCH_SAMPLES > 1
+            if (!broadcast_sensors) radiotx_sendBatch();
+#endif
             uBit.display.print(broadcast_sensors ? IMG_RUNNING : IMG_WAITING);
             uBit.sleep(300);
         }
 #endif
-
-        uBit.sleep(10);
     }
 }
 #endif
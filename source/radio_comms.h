@@ -1,11 +1,22 @@
-
 #pragma once
 
+#include <stddef.h>
 #include "cmsis_compiler.h"
 #include "main.h"
 
 #define MAX_RADIO_FREQUENCY 83
 
+/**
+ * @brief Number of remote micro:bits the bridge keeps track of, each one
+ * with its own index, can be changed with the RADIO_REMOTES_LEN build flag.
+ * The index is sent as two hex digits in the multi remote messages.
+ */
+#ifndef RADIO_REMOTES_LEN
+#define RADIO_REMOTES_LEN   32
+#endif
+static_assert(RADIO_REMOTES_LEN >= 2 && RADIO_REMOTES_LEN <= 255,
+              "RADIO_REMOTES_LEN must fit in the 2 hex digit remote index");
+
 /**
  * @brief List of radio packet types
  */
@@ -13,6 +24,7 @@ typedef enum {
     RADIO_PKT_SENSOR_DATA = 0,
     RADIO_PKT_CMD,
     RADIO_PKT_RESPONSE,
+    RADIO_PKT_SENSOR_BATCH,
     RADIO_PKT_TYPE_LEN,
 } radio_packet_type_t;
 
@@ -21,6 +33,9 @@ typedef enum {
     RADIO_CMD_HELLO,
     RADIO_CMD_BLINK,
     RADIO_CMD_DISPLAY,
+    RADIO_CMD_PERIOD,
+    RADIO_CMD_BEACON,
+    RADIO_CMD_CHANNEL,
     RADIO_CMD_TYPE_LEN,
 } radio_cmd_type_t;
 
@@ -32,6 +47,8 @@ typedef __PACKED_STRUCT radio_sensor_data_s {
     uint8_t button_b;
     uint8_t button_logo;
     uint8_t padding;
+    // Lower 32 bits of the remote micro:bit microsecond clock when the sample was taken
+    uint32_t capture_time_us;
 } radio_sensor_data_t;
 
 typedef __PACKED_STRUCT radio_cmd_s {
@@ -47,6 +64,64 @@ typedef __PACKED_STRUCT radio_cmd_display_s {
     uint8_t padding[11];
 } radio_cmd_display_t;
 
+/**
+ * @brief Value for the radio_cmd_period_t phase_us to keep the remote
+ * micro:bit sampling phase, and only change its period.
+ */
+#define RADIO_PHASE_NONE    0xFFFFFFFF
+
+typedef __PACKED_STRUCT radio_cmd_period_s {
+    uint32_t period_us;
+    // Time from when the command is sent until the bridge needs the next sample
+    uint32_t phase_us;
+    uint8_t batch_samples;
+    uint8_t padding;
+    // Change-driven mode, the samples within the deadband of the last one sent
+    // are skipped until the heartbeat, off with a heartbeat of 0
+    uint16_t deadband_mg;
+    uint16_t heartbeat_ms;
+    uint8_t padding2[2];
+} radio_cmd_period_t;
+
+/**
+ * @brief Value for the radio_cmd_beacon_t slot without a slot assignment,
+ * and for the remote micro:bits without a slot.
+ */
+#define RADIO_SLOT_NONE     0xFF
+
+/**
+ * @brief Beacon at the start of each time-slotted frame. The remote
+ * micro:bit in slot N sends its packets (N + 1) slots after the beacon, the
+ * first slot is left for the bridge, and the remote micro:bits without a slot
+ * use the one after the last slot. Each beacon assigns one of the slots.
+ */
+typedef __PACKED_STRUCT radio_cmd_beacon_s {
+    uint32_t frame_us;
+    uint16_t slot_us;
+    uint8_t slot_count;
+    // Slot assigned by this beacon, or RADIO_SLOT_NONE
+    uint8_t slot;
+    uint32_t slot_mb_id;
+    uint8_t padding[4];
+} radio_cmd_beacon_t;
+
+/**
+ * @brief Radio frequency switch, the remote micro:bits reply with a
+ * RADIO_PKT_RESPONSE packet with the same command type and switch ID, and
+ * switch at the same time as the bridge. After the switch the bridge sends
+ * it again on the new frequency, with a switch_in_us of 0, to confirm it,
+ * without it the remote micro:bits go back to the previous frequency. A
+ * switch to the frequency the remote micro:bit is already on cancels it.
+ */
+typedef __PACKED_STRUCT radio_cmd_channel_s {
+    uint8_t frequency;
+    uint8_t padding[3];
+    // Time from when the command is sent until the switch
+    uint32_t switch_in_us;
+    uint32_t switch_id;
+    uint8_t padding2[4];
+} radio_cmd_channel_t;
+
 /**
  * @brief Data sent over radio.
  */
@@ -59,6 +134,9 @@ typedef __PACKED_STRUCT radio_packet_s {
     union {
         radio_cmd_t cmd_data;
         radio_cmd_display_s cmd_display;
+        radio_cmd_period_t cmd_period;
+        radio_cmd_beacon_t cmd_beacon;
+        radio_cmd_channel_t cmd_channel;
         radio_sensor_data_t sensor_data;
     };
 } radio_packet_t;
@@ -66,19 +144,143 @@ typedef __PACKED_STRUCT radio_packet_s {
 static_assert(sizeof(radio_cmd_t) == 16, "radio_cmd_t should be 16 bytes");
 static_assert(sizeof(radio_cmd_t) == sizeof(radio_cmd_display_t),
     "radio_cmd_display_t should be same size as radio_cmd_t");
-static_assert(sizeof(radio_sensor_data_s) == sizeof(radio_sensor_data_s),
-    "radio_sensor_data_s should be same size as radio_cmd_t");
-static_assert(sizeof(radio_packet_t) == 28, "radio_packet_t should be 28 bytes");
+static_assert(sizeof(radio_cmd_t) == sizeof(radio_cmd_period_t),
+    "radio_cmd_period_t should be same size as radio_cmd_t");
+static_assert(sizeof(radio_cmd_t) == sizeof(radio_cmd_beacon_t),
+    "radio_cmd_beacon_t should be same size as radio_cmd_t");
+static_assert(sizeof(radio_cmd_t) == sizeof(radio_cmd_channel_t),
+    "radio_cmd_channel_t should be same size as radio_cmd_t");
+static_assert(sizeof(radio_sensor_data_t) == 20, "radio_sensor_data_t should be 20 bytes");
+static_assert(sizeof(radio_packet_t) == 32, "radio_packet_t should be 32 bytes");
+static_assert(sizeof(radio_packet_t) <= MICROBIT_RADIO_MAX_PACKET_SIZE,
+    "radio_packet_t does not fit in a single radio datagram");
+
+/**
+ * @brief Length of the radio_packet_t sent by the earlier versions, without
+ * the sensor data capture_time_us. These packets are still accepted, with a
+ * capture time of 0, and the commands fit in them.
+ */
+#define RADIO_PACKET_LEGACY_LEN     offsetof(radio_packet_t, sensor_data.capture_time_us)
+static_assert(RADIO_PACKET_LEGACY_LEN == 28, "The earlier radio_packet_t was 28 bytes");
+static_assert(RADIO_PACKET_LEGACY_LEN == offsetof(radio_packet_t, cmd_data) + sizeof(radio_cmd_t),
+    "The commands should fit in the earlier radio_packet_t");
+
+/**
+ * @brief One sample of a multi-sample sensor data packet. The accelerometer
+ * values are in milli-g, so they fit in 16 bits in any accelerometer range.
+ */
+typedef __PACKED_STRUCT radio_batch_sample_s {
+    // Microseconds since the capture_time_us of the packet
+    uint16_t capture_delta_us;
+    int16_t accelerometer_x;
+    int16_t accelerometer_y;
+    int16_t accelerometer_z;
+    // Bit 0 for button A, bit 1 for button B and bit 2 for the logo
+    uint8_t buttons;
+} radio_batch_sample_t;
+
+#define RADIO_BATCH_HEADER_LEN  16
+#define RADIO_BATCH_SAMPLES_MAX \
+    ((MICROBIT_RADIO_MAX_PACKET_SIZE - RADIO_BATCH_HEADER_LEN) / sizeof(radio_batch_sample_t))
+
+/**
+ * @brief Variable length sensor data packet, with consecutive samples from a
+ * remote micro:bit, as many as fit in a radio datagram. Only the first
+ * sample_count samples are sent.
+ */
+typedef __PACKED_STRUCT radio_batch_packet_s {
+    uint8_t packet_type;
+    uint8_t sample_count;
+    uint16_t padding;
+    // Sample ID of the first sample, the next ones have consecutive IDs
+    uint32_t id;
+    uint32_t mb_id;
+    // Lower 32 bits of the remote micro:bit microsecond clock for the first sample
+    uint32_t capture_time_us;
+    radio_batch_sample_t samples[RADIO_BATCH_SAMPLES_MAX];
+} radio_batch_packet_t;
+
+static_assert(sizeof(radio_batch_sample_t) == 9, "radio_batch_sample_t should be 9 bytes");
+static_assert(offsetof(radio_batch_packet_t, samples) == RADIO_BATCH_HEADER_LEN,
+    "radio_batch_packet_t header should be RADIO_BATCH_HEADER_LEN bytes");
+
+/**
+ * @brief Maximum samples per sensor data packet sent by the remote
+ * micro:bit, and its sampling period until the bridge sends its own, can be
+ * changed with the RADIO_BATCH_SAMPLES and RADIO_SAMPLE_PERIOD_MS build
+ * flags. With one sample per packet the fixed size radio_packet_t is sent
+ * instead, as it was before the batch packets.
+ */
+#ifndef RADIO_BATCH_SAMPLES
+#define RADIO_BATCH_SAMPLES     4
+#endif
+#ifndef RADIO_SAMPLE_PERIOD_MS
+#define RADIO_SAMPLE_PERIOD_MS  5
+#endif
+static_assert(RADIO_BATCH_SAMPLES >= 1 && RADIO_BATCH_SAMPLES <= RADIO_BATCH_SAMPLES_MAX,
+    "RADIO_BATCH_SAMPLES don't fit in MICROBIT_RADIO_MAX_PACKET_SIZE, see codal.json");
+static_assert(RADIO_BATCH_SAMPLES * RADIO_SAMPLE_PERIOD_MS * 1000 <= UINT16_MAX,
+    "The capture time of the last sample in a batch doesn't fit in capture_delta_us");
+
+/**
+ * @brief With shorter bridge periods the remote micro:bit sends several
+ * samples per packet, to keep its packet rate at most one every 10 ms.
+ */
+#define RADIO_PACKET_INTERVAL_MIN_US    10000
+
+/**
+ * @brief Length of each slot in the time-slotted mode, enough for a full
+ * radio packet and the clock drift between beacons, can be changed with
+ * the RADIO_SLOT_US build flag.
+ */
+#ifndef RADIO_SLOT_US
+#define RADIO_SLOT_US                   1000
+#endif
+static_assert(RADIO_SLOT_US >= 500 && RADIO_SLOT_US <= UINT16_MAX,
+    "RADIO_SLOT_US should fit a radio packet, and in radio_cmd_beacon_t");
 
 /**
  * @brief Type definition for the callback with the received radio data.
  *
+ * The samples of a multi-sample packet are unpacked, and the callback is
+ * called with each one of them, in order, as a single sample packet with
+ * its own sample ID. A malformed packet is dropped, and the callback is
+ * only called with its packet type, so it can be counted: RADIO_PKT_SENSOR_BATCH
+ * for a multi-sample packet, and RADIO_PKT_TYPE_LEN for a packet of any other
+ * length than radio_packet_t.
+ *
  * @param sensor_data Pointer to the radio data received.
  *                    Data must be copied from this pointer as it will be
  *                    destroyed after the callback.
  */
 typedef void (*radio_data_callback_t)(const radio_packet_t *radio_packet);
 
+/**
+ * @brief How a received sensor data packet fits in the sequence of packets
+ * from its remote micro:bit, see radiobridge_updateRemoteMbIds().
+ */
+typedef enum radio_seq_e {
+    RADIO_SEQ_NEW = 0,          // Newer than any previous packet
+    RADIO_SEQ_DUPLICATE,        // Already received
+    RADIO_SEQ_REORDERED,        // Older than the last packet, but not received before
+} radio_seq_t;
+
+/**
+ * @brief Sequence counters of the sensor data packets from a remote
+ * micro:bit, since it was first heard.
+ *
+ * A gap in the packet IDs is counted as lost packets, and if any of them
+ * arrive later they are counted as reordered instead. A packet ID far behind
+ * the newest one is taken as the remote micro:bit restarting, and the
+ * counters carry on from it.
+ */
+typedef struct radio_seq_stats_s {
+    uint32_t received;
+    uint32_t lost;
+    uint32_t duplicated;
+    uint32_t reordered;
+} radio_seq_stats_t;
+
 
 #if CONFIG_ENABLED(RADIO_BRIDGE)
 /**
@@ -90,19 +292,39 @@ typedef void (*radio_data_callback_t)(const radio_packet_t *radio_packet);
 void radiobridge_init(const radio_data_callback_t callback, const uint8_t radio_frequency);
 
 /**
- * @brief Changes the radio frequency of the remote micro:bits and the
- *        bridge micro:bits.
- * 
- * TODO: Currently this function only changes the bridge radio frequency,
- *       need to design a plan to change the remote micro:bit as well.
+ * @brief Starts switching the radio frequency of the remote micro:bits and
+ *        the bridge micro:bit.
+ *
+ * The switch is announced to the remote micro:bits, and once all the ones
+ * that have sent sensor data have replied, they all switch at the same
+ * time. If any replies are missing it's announced again with a later
+ * switch time, and after a few attempts it's cancelled, staying on the
+ * current frequency. Without any remote micro:bits the bridge switches
+ * straight away.
  *
  * @param radio_frequency The new radio frequency to set.
  *
- * @return MICROBIT_OK if the radio frequency was set successfully to all
- *         micro:bits, or a MICROBIT error value otherwise.
+ * @return MICROBIT_OK if the switch has started, MICROBIT_BUSY if there is
+ *         already one in progress, or a MICROBIT error value otherwise.
  */
 int radiobridge_setRadioFrequencyAllMbs(const uint8_t radio_frequency);
 
+/**
+ * @brief Changes only the bridge radio frequency, straight away, and cancels
+ * any switch in progress.
+ *
+ * @param radio_frequency The new radio frequency to set.
+ *
+ * @return MICROBIT_OK, or a MICROBIT error value.
+ */
+int radiobridge_setRadioFrequency(const uint8_t radio_frequency);
+
+/**
+ * @return The radio frequency the bridge is on, which only changes at the
+ *         end of a successful switch.
+ */
+uint8_t radiobridge_getRadioFrequency();
+
 /**
  * @brief Sends a command to the radio sender.
  *
@@ -112,9 +334,40 @@ int radiobridge_setRadioFrequencyAllMbs(const uint8_t radio_frequency);
  */
 void radiobridge_sendCommand(const uint32_t mb_id, const radio_cmd_type_t cmd, const radio_cmd_t *value = NULL);
 
+/**
+ * @brief Sends the bridge sampling period to the remote micro:bits, so that
+ * they send a sample per period. Only as many samples per packet as needed
+ * to keep the packets at least RADIO_PACKET_INTERVAL_MIN_US apart are sent.
+ *
+ * @param mb_id The remote micro:bit ID, or 0 for all of them.
+ * @param period_us The bridge period.
+ * @param phase_us Time until the bridge needs the next sample, for the
+ *        remote to sample just before it, or RADIO_PHASE_NONE.
+ * @param deadband_mg The change in any accelerometer axis for a sample to be
+ *        sent, in the change-driven mode.
+ * @param heartbeat_ms The longest time between samples in the change-driven
+ *        mode, or 0 to send every sample.
+ */
+void radiobridge_sendPeriod(const uint32_t mb_id, const uint32_t period_us, const uint32_t phase_us,
+                            const uint16_t deadband_mg = 0, const uint16_t heartbeat_ms = 0);
+
+/**
+ * @brief Broadcasts the beacon at the start of a time-slotted frame. Each
+ * remote micro:bit in the registry has the slot of its entry index, the
+ * same as its multi remote index, and each beacon assigns the next one.
+ *
+ * @param period_us The bridge period, the frame is a multiple of it.
+ *
+ * @return The frame length, until the next beacon is due.
+ */
+uint32_t radiobridge_sendBeacon(const uint32_t period_us);
+
 /**
  * @brief Sets the provided remote micro:bit ID as the active one.
- * 
+ *
+ * If all the indexes are taken, it replaces the least recently heard
+ * inactive remote micro:bit.
+ *
  * @param mb_id The micro:bit ID to set as active.
  */
 void radiobridge_setActiveRemoteMbId(const uint32_t mb_id) ;
@@ -125,11 +378,45 @@ void radiobridge_setActiveRemoteMbId(const uint32_t mb_id) ;
 uint32_t radiobridge_getActiveRemoteMbId();
 
 /**
- * @brief Updates the list of micro:bit IDs that have been seen recently.
- * 
- * @param mb_id The micro:bit ID to mark as active.
+ * @brief Updates the list of micro:bit IDs that have been seen recently,
+ * and the sequence counters of the remote micro:bit.
+ *
+ * A remote micro:bit keeps the same index until it hasn't been heard for
+ * a few seconds, only then its index can be reused by a different one. When
+ * all the indexes are taken, the packets from new remote micro:bits have no
+ * index until one expires, only radiobridge_setActiveRemoteMbId() replaces
+ * the least recently heard inactive one. Finding the micro:bit takes
+ * constant time.
+ *
+ * @param mb_id The micro:bit ID of the received sensor data packet.
+ * @param packet_id The ID of the received sensor data packet.
+ * @param remote_index Output with the index of the remote micro:bit, or
+ *        RADIO_REMOTES_LEN if there wasn't space to keep track of it.
+ *
+ * @return Where the packet fits in the sequence from the remote micro:bit,
+ *         only RADIO_SEQ_NEW packets have fresh sensor data.
+ */
+radio_seq_t radiobridge_updateRemoteMbIds(const uint32_t mb_id, const uint32_t packet_id, size_t *remote_index);
+
+/**
+ * @param remote_index The index of a remote micro:bit, as set by
+ *        radiobridge_updateRemoteMbIds().
+ *
+ * @return The micro:bit ID of the remote micro:bit with that index, or 0 if
+ *         there isn't one.
+ */
+uint32_t radiobridge_getRemoteMbId(const size_t remote_index);
+
+/**
+ * @brief Gets the sequence counters of a remote micro:bit.
+ *
+ * @param mb_id The micro:bit ID of the remote micro:bit.
+ * @param seq_stats Output with the sequence counters.
+ *
+ * @return MICROBIT_OK, or MICROBIT_INVALID_PARAMETER if the remote
+ *         micro:bit has not been heard recently.
  */
-void radiobridge_updateRemoteMbIds(const uint32_t mb_id);
+int radiobridge_getRemoteSeqStats(const uint32_t mb_id, radio_seq_stats_t *seq_stats);
 
 /**
  * @brief Switches the active remote micro:bit to the next available remote
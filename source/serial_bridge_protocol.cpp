@@ -1,4 +1,3 @@
-#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include "serial_bridge_protocol.h"
@@ -8,130 +7,600 @@
 #define CLAMP(x, min, max)      MIN(MAX(x, min), max)
 
 static size_t CMD_MAX_LEN = 0;
+
+// Open addressed table to find the command types by name, filled in sbp_init()
+// with the command type + 1, so that zero is an empty slot
+#define CMD_LOOKUP_LEN          64
+static_assert(SBP_CMD_TYPE_LEN <= (CMD_LOOKUP_LEN / 2), "Command lookup table is too full");
+static uint8_t cmd_lookup[CMD_LOOKUP_LEN] = { };
+
 static sbp_cmd_callbacks_t cmd_cbk = { };
 
+// Set to send a keyframe as the next delta periodic message
+static bool delta_force_keyframe = true;
+
 // ----------------------------------------------------------------------------
 // HELPER FUNCTIONS -----------------------------------------------------------
 // ----------------------------------------------------------------------------
 
-static_assert(sizeof(unsigned long) == sizeof(uint32_t),
-              "uintFromCommandValue() depends on unsigned long being 32 bits");
-
-static uint32_t uintFromCommandValue(const char *value_str, const size_t value_str_len, uint32_t *value) {
-    // Convert into a null terminated string
-    char value_str_terminated[value_str_len + 1];
-    for (size_t i = 0; i < value_str_len; i++) {
-        value_str_terminated[i] = value_str[i];
-    }
-    value_str_terminated[value_str_len] = '\0';
-
-    // Convert value_str into an integer
-    char *endptr;
-    unsigned long result = strtoul(value_str_terminated, &endptr, 10);
-    if (endptr != &value_str_terminated[value_str_len]) {
+/**
+ * @brief Parses a decimal command value in place, without sign or whitespace.
+ * @return SBP_SUCCESS, or SBP_ERROR_CMD_VALUE if the value is not a number
+ *         or it doesn't fit in 32 bits.
+ */
+static int uintFromCommandValue(const char *value_str, const size_t value_str_len, uint32_t *value) {
+    if (value_str_len == 0) {
         return SBP_ERROR_CMD_VALUE;
     }
-    if (*value == 0 && !(value_str_len == 1 && value_str[0] == '0')) {
-        return SBP_ERROR_CMD_VALUE;
+    uint32_t result = 0;
+    for (size_t i = 0; i < value_str_len; i++) {
+        // Characters below '0' wrap around to large values and fail the check too
+        const uint32_t digit = (uint32_t)(value_str[i] - '0');
+        if (digit > 9 || result > ((UINT32_MAX - digit) / 10)) {
+            return SBP_ERROR_CMD_VALUE;
+        }
+        result = (result * 10) + digit;
     }
-    *value = (uint32_t)result;
+    *value = result;
     return SBP_SUCCESS;
 }
 
-// ----------------------------------------------------------------------------
-// PRIVATE FUNCTIONS ----------------------------------------------------------
-// ----------------------------------------------------------------------------
+static inline size_t cmdTypeHash(const char *str, const size_t len) {
+    return (((size_t)str[0] * 31) + ((size_t)str[len - 1] * 7) + len) & (CMD_LOOKUP_LEN - 1);
+}
 
 /**
- * @brief Parse a protocol message as a command.
+ * @brief Adds all the command types to the lookup table, done once in sbp_init().
+ */
+static void cmdTypeLookupInit() {
+    memset(cmd_lookup, 0, sizeof(cmd_lookup));
+    for (size_t i = 0; i < SBP_CMD_TYPE_LEN; i++) {
+        size_t slot = cmdTypeHash(sbp_cmd_type_str[i], strlen(sbp_cmd_type_str[i]));
+        while (cmd_lookup[slot] != 0) {
+            slot = (slot + 1) & (CMD_LOOKUP_LEN - 1);
+        }
+        cmd_lookup[slot] = (uint8_t)(i + 1);
+    }
+}
+
+/**
+ * @brief Finds the command type from its name.
  *
- * @param msg String of the protocol message to parse.
- * @param msg_len The length of the protocol message string
- *                (not including null terminator).
- * @param cmd Pointer to the command structure to populate.
- * @return Success or error code.
+ * @param str The command type name (not null terminated).
+ * @param len The length of the name.
+ * @return The command type, or SBP_CMD_TYPE_LEN if it's not a valid command.
  */
-static int sbp_parseCommand(const char *msg, const size_t msg_len, sbp_cmd_t *cmd) {
-    const char *msg_start = msg;
-    sbp_cmd_type_t cmd_type = SBP_CMD_TYPE_LEN;
-    size_t id_start = 0;
-    const size_t id_len_max = 8;
-    size_t id_len = 0;
-    size_t value_start = 0;
-    size_t value_len = 0;
-
-    // The first character should be the message type, in this case the
-    // command type, followed by a '['
-    if (*msg++ != sbp_msg_type_char[SBP_MSG_COMMAND]) {
-        return SBP_ERROR_MSG_TYPE;
+static sbp_cmd_type_t cmdTypeLookup(const char *str, const size_t len) {
+    if (len == 0 || len > CMD_MAX_LEN) {
+        return SBP_CMD_TYPE_LEN;
     }
-    if (*msg++ != '[') {
-        return SBP_ERROR_PROTOCOL_FORMAT;
+    // Linear probing until an empty slot, the table is never more than half full
+    for (size_t slot = cmdTypeHash(str, len); cmd_lookup[slot] != 0; slot = (slot + 1) & (CMD_LOOKUP_LEN - 1)) {
+        const char *cmd_type_str = sbp_cmd_type_str[cmd_lookup[slot] - 1];
+        if (strncmp(cmd_type_str, str, len) == 0 && cmd_type_str[len] == '\0') {
+            return (sbp_cmd_type_t)(cmd_lookup[slot] - 1);
+        }
     }
+    return SBP_CMD_TYPE_LEN;
+}
 
-    // The characters until ']' (max 8 chars) should be the command ID with a valid hex number
-    id_start = msg - msg_start;
-    for (id_len = 0; id_len < id_len_max; id_len++, msg++) {
-        if (*msg == ']') {
-            break;
-        }
-        if (!(*msg >= '0' && *msg <= '9') &&
-                !(*msg >= 'A' && *msg <= 'F') &&
-                    !(*msg >= 'a' && *msg <= 'f')) {
-            return SBP_ERROR_PROTOCOL_FORMAT;
-        }
+static inline bool isHexChar(const char c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f');
+}
+
+/**
+ * @brief Copies a string literal (without null terminator) into a buffer.
+ * @return Pointer to the next character after the copied literal.
+ */
+#define STR_APPEND_LITERAL(dst, literal) \
+    ((char *)memcpy((dst), (literal), sizeof(literal) - 1) + sizeof(literal) - 1)
+
+/** Longest hex representation of a uint32_t, e.g. "FFFFFFFF" */
+#define HEX_STR_MAX_LEN         8
+
+/**
+ * @brief Writes the hex representation (uppercase, no padding) of a value.
+ * Equivalent to snprintf "%lX".
+ * @return Pointer to the next character after the written digits.
+ */
+static inline char *strAppendHex(char *str, uint32_t value) {
+    static const char hex_chars[] = "0123456789ABCDEF";
+    char digits[HEX_STR_MAX_LEN];
+    size_t digits_len = 0;
+    do {
+        digits[digits_len++] = hex_chars[value & 0xF];
+        value >>= 4;
+    } while (value);
+    while (digits_len) {
+        *str++ = digits[--digits_len];
     }
-    if (id_len == 0 || *msg++ != ']') {
-        return SBP_ERROR_PROTOCOL_FORMAT;
+    return str;
+}
+
+/**
+ * @brief Writes the hex representation (uppercase) of a value with a fixed
+ * number of digits. Equivalent to snprintf "%0<digits>X".
+ * @return Pointer to the next character after the written digits.
+ */
+static inline char *strAppendHexFixed(char *str, uint32_t value, const size_t digits) {
+    static const char hex_chars[] = "0123456789ABCDEF";
+    for (size_t i = digits; i > 0; i--) {
+        str[i - 1] = hex_chars[value & 0xF];
+        value >>= 4;
     }
+    return str + digits;
+}
 
-    // The following characters should be the command type, followed by a '['
-    char cmd_type_str[CMD_MAX_LEN + 1] = { 0 };
-    for (size_t i = 0; i < CMD_MAX_LEN; i++, msg++) {
-        if (*msg == '[') {
-            break;
-        }
-        cmd_type_str[i] = *msg;
+/** Longest decimal representation of a uint32_t, e.g. "4294967295" */
+#define DEC_STR_MAX_LEN         10
+/** Longest decimal representation of an int, e.g. "-2147483648" */
+#define INT_STR_MAX_LEN         (DEC_STR_MAX_LEN + 1)
+
+/**
+ * @brief Writes the decimal representation of an unsigned value.
+ * Equivalent to snprintf "%lu".
+ * @return Pointer to the next character after the written digits.
+ */
+static inline char *strAppendUint(char *str, uint32_t value) {
+    char digits[DEC_STR_MAX_LEN];
+    size_t digits_len = 0;
+    do {
+        digits[digits_len++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    while (digits_len) {
+        *str++ = digits[--digits_len];
     }
-    // We might have reached the max command string length without
-    // finding the '[' yet, but in that case it should be the next character
-    if (*msg != '[' && *(++msg) != '[') {
-        return SBP_ERROR_PROTOCOL_FORMAT;
+    return str;
+}
+
+/**
+ * @brief Writes the decimal representation of a value.
+ * Equivalent to snprintf "%d".
+ * @return Pointer to the next character after the written digits.
+ */
+static inline char *strAppendInt(char *str, const int value) {
+    // Negate as unsigned to correctly handle INT_MIN
+    uint32_t abs_value = (uint32_t)value;
+    if (value < 0) {
+        *str++ = '-';
+        abs_value = 0u - abs_value;
     }
-    msg++;
+    return strAppendUint(str, abs_value);
+}
 
-    // Find the command type in the list of valid commands
-    for (size_t i = 0; i < SBP_CMD_TYPE_LEN; i++) {
-        if (strncmp(cmd_type_str, sbp_cmd_type_str[i], CMD_MAX_LEN) == 0) {
-            cmd_type = (sbp_cmd_type_t)i;
-            break;
+/**
+ * @brief Type for the functions that encode the fields of a single sensor
+ * type into a periodic message.
+ * @return Pointer to the next character after the written field.
+ */
+typedef char *(*periodic_field_encoder_t)(char *str, const sbp_sensor_data_t *data);
+
+static char *verboseFieldAcc(char *str, const sbp_sensor_data_t *data) {
+    str = STR_APPEND_LITERAL(str, SBP_SENSOR_STR_ACC_X "[");
+    str = strAppendInt(str, data->accelerometer_x);
+    str = STR_APPEND_LITERAL(str, "]" SBP_SENSOR_STR_ACC_Y "[");
+    str = strAppendInt(str, data->accelerometer_y);
+    str = STR_APPEND_LITERAL(str, "]" SBP_SENSOR_STR_ACC_Z "[");
+    str = strAppendInt(str, data->accelerometer_z);
+    *str++ = ']';
+    return str;
+}
+
+static char *verboseFieldMag(char *str, const sbp_sensor_data_t *data) {
+    str = STR_APPEND_LITERAL(str, SBP_SENSOR_STR_MAG_X "[");
+    str = strAppendInt(str, data->magnetometer_x);
+    str = STR_APPEND_LITERAL(str, "]" SBP_SENSOR_STR_MAG_Y "[");
+    str = strAppendInt(str, data->magnetometer_y);
+    str = STR_APPEND_LITERAL(str, "]" SBP_SENSOR_STR_MAG_Z "[");
+    str = strAppendInt(str, data->magnetometer_z);
+    *str++ = ']';
+    return str;
+}
+
+static char *verboseFieldBtn(char *str, const sbp_sensor_data_t *data) {
+    str = STR_APPEND_LITERAL(str, SBP_SENSOR_STR_BTN_A "[");
+    *str++ = '0' + data->button_a;
+    str = STR_APPEND_LITERAL(str, "]" SBP_SENSOR_STR_BTN_B "[");
+    *str++ = '0' + data->button_b;
+    *str++ = ']';
+    return str;
+}
+
+static char *verboseFieldBtnLogo(char *str, const sbp_sensor_data_t *data) {
+    str = STR_APPEND_LITERAL(str, SBP_SENSOR_STR_BTN_LOGO "[");
+    *str++ = '0' + data->button_logo;
+    *str++ = ']';
+    return str;
+}
+
+static char *verboseFieldBtnPins(char *str, const sbp_sensor_data_t *data) {
+    str = STR_APPEND_LITERAL(str, SBP_SENSOR_STR_BTN_P0 "[");
+    *str++ = '0' + data->button_p0;
+    str = STR_APPEND_LITERAL(str, "]" SBP_SENSOR_STR_BTN_P1 "[");
+    *str++ = '0' + data->button_p1;
+    str = STR_APPEND_LITERAL(str, "]" SBP_SENSOR_STR_BTN_P2 "[");
+    *str++ = '0' + data->button_p2;
+    *str++ = ']';
+    return str;
+}
+
+static char *verboseFieldTemp(char *str, const sbp_sensor_data_t *data) {
+    str = STR_APPEND_LITERAL(str, SBP_SENSOR_STR_TEMP "[");
+    str = strAppendInt(str, data->temperature);
+    *str++ = ']';
+    return str;
+}
+
+static char *verboseFieldLight(char *str, const sbp_sensor_data_t *data) {
+    str = STR_APPEND_LITERAL(str, SBP_SENSOR_STR_LIGHT "[");
+    str = strAppendInt(str, data->light_level);
+    *str++ = ']';
+    return str;
+}
+
+static char *verboseFieldSound(char *str, const sbp_sensor_data_t *data) {
+    str = STR_APPEND_LITERAL(str, SBP_SENSOR_STR_SOUND "[");
+    str = strAppendInt(str, data->sound_level);
+    *str++ = ']';
+    return str;
+}
+
+static char *compactFieldAcc(char *str, const sbp_sensor_data_t *data) {
+    // Accelerometer max is +/- 2 g, so we can use 12 bits (3 Hex digits) per axis
+    str = strAppendHexFixed(str, CLAMP(data->accelerometer_x, -2048, 2047) + 2048, 3);
+    str = strAppendHexFixed(str, CLAMP(data->accelerometer_y, -2048, 2047) + 2048, 3);
+    return strAppendHexFixed(str, CLAMP(data->accelerometer_z, -2048, 2047) + 2048, 3);
+}
+
+static char *compactFieldMag(char *str, const sbp_sensor_data_t *data) {
+    // 20 bits per axis is about 10 times the Earth's magnetic field in nT
+    str = strAppendHexFixed(str, CLAMP(data->magnetometer_x, -0x80000, 0x7FFFF) + 0x80000, 5);
+    str = strAppendHexFixed(str, CLAMP(data->magnetometer_y, -0x80000, 0x7FFFF) + 0x80000, 5);
+    return strAppendHexFixed(str, CLAMP(data->magnetometer_z, -0x80000, 0x7FFFF) + 0x80000, 5);
+}
+
+static char *compactFieldBtn(char *str, const sbp_sensor_data_t *data) {
+    // Buttons are 1 bit each, with button A as the LSB
+    return strAppendHexFixed(str, (data->button_a & 0x01) | ((data->button_b & 0x01) << 1), 1);
+}
+
+static char *compactFieldBtnLogo(char *str, const sbp_sensor_data_t *data) {
+    return strAppendHexFixed(str, data->button_logo & 0x01, 1);
+}
+
+static char *compactFieldBtnPins(char *str, const sbp_sensor_data_t *data) {
+    // Pins are 1 bit each, with P0 as the LSB
+    return strAppendHexFixed(str, (data->button_p0 & 0x01) |
+                                  ((data->button_p1 & 0x01) << 1) |
+                                  ((data->button_p2 & 0x01) << 2), 1);
+}
+
+static char *compactFieldTemp(char *str, const sbp_sensor_data_t *data) {
+    return strAppendHexFixed(str, CLAMP(data->temperature, -128, 127) + 128, 2);
+}
+
+static char *compactFieldLight(char *str, const sbp_sensor_data_t *data) {
+    return strAppendHexFixed(str, CLAMP(data->light_level, 0, 255), 2);
+}
+
+static char *compactFieldSound(char *str, const sbp_sensor_data_t *data) {
+    return strAppendHexFixed(str, CLAMP(data->sound_level, 0, 255), 2);
+}
+
+/**
+ * @brief Field encoders and their worst case length for each periodic
+ * message format, indexed by sbp_sensor_type_t.
+ */
+static const periodic_field_encoder_t VERBOSE_FIELD_ENCODERS[SBP_SENSOR_TYPE_LEN] = {
+    verboseFieldAcc, verboseFieldMag, verboseFieldBtn, verboseFieldBtnLogo,
+    verboseFieldBtnPins, verboseFieldTemp, verboseFieldLight, verboseFieldSound,
+};
+static constexpr uint8_t VERBOSE_FIELD_MAX_LEN[SBP_SENSOR_TYPE_LEN] = {
+    3 * (sizeof(SBP_SENSOR_STR_ACC_X "[]") - 1 + INT_STR_MAX_LEN),  // SBP_SENSOR_TYPE_ACC
+    3 * (sizeof(SBP_SENSOR_STR_MAG_X "[]") - 1 + INT_STR_MAX_LEN),  // SBP_SENSOR_TYPE_MAG
+    2 * (sizeof(SBP_SENSOR_STR_BTN_A "[0]") - 1),                   // SBP_SENSOR_TYPE_BTN
+    sizeof(SBP_SENSOR_STR_BTN_LOGO "[0]") - 1,                      // SBP_SENSOR_TYPE_BTN_LOGO
+    3 * (sizeof(SBP_SENSOR_STR_BTN_P0 "[0]") - 1),                  // SBP_SENSOR_TYPE_BTN_PINS
+    sizeof(SBP_SENSOR_STR_TEMP "[]") - 1 + INT_STR_MAX_LEN,         // SBP_SENSOR_TYPE_TEMP
+    sizeof(SBP_SENSOR_STR_LIGHT "[]") - 1 + INT_STR_MAX_LEN,        // SBP_SENSOR_TYPE_LIGHT
+    sizeof(SBP_SENSOR_STR_SOUND "[]") - 1 + INT_STR_MAX_LEN,        // SBP_SENSOR_TYPE_SOUND
+};
+/** "P[FFFFFFFF]" header, and the separator plus null terminator */
+#define VERBOSE_FIXED_MAX_LEN   (sizeof("P[]") - 1 + HEX_STR_MAX_LEN + SBP_MSG_SEPARATOR_LEN + 1)
+/** Each "TS[4294967295]" or "TR[4294967295]" timestamp */
+#define VERBOSE_TIMESTAMP_MAX_LEN   (sizeof(SBP_TIMESTAMP_STR_LOCAL "[]") - 1 + DEC_STR_MAX_LEN)
+/** The "RL[4294967295]" radio loss */
+#define VERBOSE_RADIO_LOSS_MAX_LEN  (sizeof(SBP_RADIO_LOSS_STR "[]") - 1 + DEC_STR_MAX_LEN)
+
+static const periodic_field_encoder_t COMPACT_FIELD_ENCODERS[SBP_SENSOR_TYPE_LEN] = {
+    compactFieldAcc, compactFieldMag, compactFieldBtn, compactFieldBtnLogo,
+    compactFieldBtnPins, compactFieldTemp, compactFieldLight, compactFieldSound,
+};
+static constexpr uint8_t COMPACT_FIELD_MAX_LEN[SBP_SENSOR_TYPE_LEN] = {
+    3 * 3,  // SBP_SENSOR_TYPE_ACC
+    3 * 5,  // SBP_SENSOR_TYPE_MAG
+    1,      // SBP_SENSOR_TYPE_BTN
+    1,      // SBP_SENSOR_TYPE_BTN_LOGO
+    1,      // SBP_SENSOR_TYPE_BTN_PINS
+    2,      // SBP_SENSOR_TYPE_TEMP
+    2,      // SBP_SENSOR_TYPE_LIGHT
+    2,      // SBP_SENSOR_TYPE_SOUND
+};
+/** "P" + 2 digits ID header, and the separator plus null terminator */
+#define COMPACT_FIXED_MAX_LEN   (1 + 2 + SBP_MSG_SEPARATOR_LEN + 1)
+/** Each timestamp is a fixed 8 hex digits */
+#define COMPACT_TIMESTAMP_LEN   HEX_STR_MAX_LEN
+
+/**
+ * @brief Calculates at compile time the worst case length of a periodic
+ * message, including the null terminator, for a sensor mask.
+ */
+static constexpr int periodicMaxLen(const uint8_t *fields_max_len, const int fixed_max_len,
+                                    const uint8_t sensors_mask, const size_t i = 0) {
+    return (i == SBP_SENSOR_TYPE_LEN) ? fixed_max_len :
+        (((sensors_mask >> i) & 0x01) ? fields_max_len[i] : 0) +
+            periodicMaxLen(fields_max_len, fixed_max_len, sensors_mask, i + 1);
+}
+
+// The longest messages are the ones with all sensors, both timestamps and the radio loss enabled
+static_assert(periodicMaxLen(VERBOSE_FIELD_MAX_LEN, VERBOSE_FIXED_MAX_LEN + (2 * VERBOSE_TIMESTAMP_MAX_LEN) +
+                             VERBOSE_RADIO_LOSS_MAX_LEN, 0xFF) ==
+                  SBP_VERBOSE_STR_MAX_LEN,
+              "SBP_VERBOSE_STR_MAX_LEN does not match the verbose field lengths");
+static_assert(periodicMaxLen(COMPACT_FIELD_MAX_LEN, COMPACT_FIXED_MAX_LEN + (2 * COMPACT_TIMESTAMP_LEN), 0xFF) ==
+                  SBP_COMPACT_STR_MAX_LEN,
+              "SBP_COMPACT_STR_MAX_LEN does not match the compact field lengths");
+
+/**
+ * @brief A periodic message encoder specialised for a sensor mask, with
+ * only the field encoders for the enabled sensors, in order.
+ */
+typedef struct periodic_encoder_s {
+    uint8_t fields_len;
+    uint8_t max_len;
+    periodic_field_encoder_t fields[SBP_SENSOR_TYPE_LEN];
+} periodic_encoder_t;
+
+// Until a start command selects the sensors the messages only have the header
+static periodic_encoder_t verbose_encoder = { 0, VERBOSE_FIXED_MAX_LEN, { } };
+static periodic_encoder_t compact_encoder = { 0, COMPACT_FIXED_MAX_LEN, { } };
+
+/**
+ * @brief Configures a periodic encoder for the enabled sensors, so that each
+ * message doesn't need to check the sensor mask again.
+ */
+static void periodicEncoderSelect(
+    periodic_encoder_t *encoder, const sbp_sensors_t sensors,
+    const periodic_field_encoder_t *field_encoders, const uint8_t *fields_max_len, const int fixed_max_len
+) {
+    encoder->fields_len = 0;
+    for (size_t i = 0; i < SBP_SENSOR_TYPE_LEN; i++) {
+        if (sensors.raw & (1 << i)) {
+            encoder->fields[encoder->fields_len++] = field_encoders[i];
         }
     }
-    if (cmd_type == SBP_CMD_TYPE_LEN) {
-        return SBP_ERROR_CMD_TYPE;
+    encoder->max_len = (uint8_t)periodicMaxLen(fields_max_len, fixed_max_len, sensors.raw);
+}
+
+static void verboseEncoderSelect(const sbp_sensors_t sensors) {
+    periodicEncoderSelect(&verbose_encoder, sensors,
+                          VERBOSE_FIELD_ENCODERS, VERBOSE_FIELD_MAX_LEN, VERBOSE_FIXED_MAX_LEN);
+}
+
+static void compactEncoderSelect(const sbp_sensors_t sensors) {
+    periodicEncoderSelect(&compact_encoder, sensors,
+                          COMPACT_FIELD_ENCODERS, COMPACT_FIELD_MAX_LEN, COMPACT_FIXED_MAX_LEN);
+}
+
+/**
+ * @brief Finishes a periodic message encoded into str, which is either
+ * str_buffer itself or a scratch buffer, by copying it into str_buffer and
+ * adding the null terminator.
+ *
+ * If the message doesn't fit, str_buffer is filled with as much of the
+ * message as possible and it's still terminated by the message separator.
+ *
+ * @return The message length (without null terminator) or SBP_ERROR_LEN.
+ */
+static int periodicStrFinish(const char *str, const int str_len, char *str_buffer, const int str_buffer_len) {
+    if (str_len < str_buffer_len) {
+        if (str != str_buffer) {
+            memcpy(str_buffer, str, str_len);
+        }
+        str_buffer[str_len] = '\0';
+        return str_len;
+    }
+    const int first_char_index = str_buffer_len - (SBP_MSG_SEPARATOR_LEN + 1);
+    if (str != str_buffer) {
+        memcpy(str_buffer, str, first_char_index);
     }
+    for (size_t i = 0; i < SBP_MSG_SEPARATOR_LEN; i++) {
+        str_buffer[first_char_index + i] = SBP_MSG_SEPARATOR[i];
+    }
+    str_buffer[str_buffer_len - 1] = '\0';
+    return SBP_ERROR_LEN;
+}
 
-    // Find the value length, which is the number of characters between the '[' and ']'
-    value_start = msg - msg_start;
-    for (value_len = 0; value_len < (msg_len - value_start); value_len++, msg++) {
-        if (*msg == ']') {
-            break;
+/**
+ * @brief Calculates the CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of a
+ * buffer, using a 16 entry table to process a nibble at a time.
+ */
+static uint16_t crc16Ccitt(const uint8_t *data, const size_t data_len) {
+    static const uint16_t crc_table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    };
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < data_len; i++) {
+        crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+    return crc;
+}
+
+/**
+ * @brief COBS encodes a buffer and adds the 0x00 frame delimiter.
+ *
+ * The output buffer must be at least data_len + (data_len / 254) + 2 bytes.
+ *
+ * @return The number of bytes written to the output buffer.
+ */
+static size_t cobsEncode(const uint8_t *data, const size_t data_len, uint8_t *output) {
+    size_t code_i = 0;
+    size_t output_i = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < data_len; i++) {
+        if (data[i] != 0) {
+            output[output_i++] = data[i];
+            code++;
         }
+        if (data[i] == 0 || (code == 0xFF && (i + 1) < data_len)) {
+            output[code_i] = code;
+            code = 1;
+            code_i = output_i++;
+        }
+    }
+    output[code_i] = code;
+    output[output_i++] = 0x00;
+    return output_i;
+}
+
+static inline uint8_t *bufAppendU16(uint8_t *buf, const uint16_t value) {
+    *buf++ = (uint8_t)value;
+    *buf++ = (uint8_t)(value >> 8);
+    return buf;
+}
+
+static inline uint8_t *bufAppendI32(uint8_t *buf, const int32_t value) {
+    buf = bufAppendU16(buf, (uint16_t)value);
+    return bufAppendU16(buf, (uint16_t)((uint32_t)value >> 16));
+}
+
+/**
+ * @brief Packs all the enabled button states into a single byte, as used by
+ * the binary periodic formats.
+ * bit 0 = A, 1 = B, 2 = logo, 3 = P0, 4 = P1, 5 = P2
+ */
+static inline uint8_t packedButtons(const sbp_sensors_t enabled_data, const sbp_sensor_data_t *data) {
+    uint8_t buttons = 0;
+    if (enabled_data.buttons) {
+        buttons |= (data->button_a & 0x01) | ((data->button_b & 0x01) << 1);
     }
-    if (*msg != ']' || msg_len != (size_t)(msg - msg_start + 1)) {
-        return SBP_ERROR_PROTOCOL_FORMAT;
+    if (enabled_data.button_logo) {
+        buttons |= (data->button_logo & 0x01) << 2;
     }
+    if (enabled_data.button_pins) {
+        buttons |= ((data->button_p0 & 0x01) << 3) |
+                   ((data->button_p1 & 0x01) << 4) |
+                   ((data->button_p2 & 0x01) << 5);
+    }
+    return buttons;
+}
 
-    // Only populate cmd structure if the command is valid, which it is at this point
-    cmd->type = cmd_type;
-    cmd->line = msg_start;
-    cmd->line_len = msg_len;
-    cmd->id = msg_start + id_start;
-    cmd->id_len = id_len;
-    cmd->value = msg_start + value_start;
-    cmd->value_len = value_len;
+/**
+ * @brief Number of bytes for each sample in the binary periodic format.
+ */
+static size_t binarySampleLen(const sbp_sensors_t enabled_data) {
+    size_t sample_len = 0;
+    if (enabled_data.accelerometer) sample_len += 3 * 2;
+    if (enabled_data.magnetometer) sample_len += 3 * 4;
+    if (enabled_data.buttons || enabled_data.button_logo || enabled_data.button_pins) sample_len += 1;
+    if (enabled_data.temperature) sample_len += 1;
+    if (enabled_data.light_level) sample_len += 1;
+    if (enabled_data.sound_level) sample_len += 1;
+    return sample_len;
+}
 
-    return SBP_SUCCESS;
+static inline uint8_t *bufAppendVarint(uint8_t *buf, uint32_t value) {
+    while (value >= 0x80) {
+        *buf++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *buf++ = (uint8_t)value;
+    return buf;
+}
+
+static inline uint32_t zigzagEncode(const int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/**
+ * @brief Flattens the enabled sensor data into a list of values, with the
+ * same order and grouping as the binary periodic format.
+ *
+ * @param values Output array, at least SBP_DELTA_VALUES_MAX long.
+ * @return The number of values written.
+ */
+static size_t sensorDataValues(const sbp_sensors_t enabled_data, const sbp_sensor_data_t *data, int32_t *values) {
+    size_t values_len = 0;
+    if (enabled_data.accelerometer) {
+        values[values_len++] = data->accelerometer_x;
+        values[values_len++] = data->accelerometer_y;
+        values[values_len++] = data->accelerometer_z;
+    }
+    if (enabled_data.magnetometer) {
+        values[values_len++] = data->magnetometer_x;
+        values[values_len++] = data->magnetometer_y;
+        values[values_len++] = data->magnetometer_z;
+    }
+    if (enabled_data.buttons || enabled_data.button_logo || enabled_data.button_pins) {
+        values[values_len++] = packedButtons(enabled_data, data);
+    }
+    if (enabled_data.temperature) {
+        values[values_len++] = data->temperature;
+    }
+    if (enabled_data.light_level) {
+        values[values_len++] = data->light_level;
+    }
+    if (enabled_data.sound_level) {
+        values[values_len++] = data->sound_level;
+    }
+    return values_len;
+}
+
+// ----------------------------------------------------------------------------
+// PRIVATE FUNCTIONS ----------------------------------------------------------
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Stops parsing the current command line, the error is reported
+ * when its separator is received.
+ */
+static int sbp_parserDiscard(sbp_cmd_parser_t *parser, const int error) {
+    parser->state = SBP_PARSER_DISCARD;
+    parser->error = error;
+    return SBP_PARSER_INCOMPLETE;
+}
+
+/**
+ * @brief Completes the current command line and resets the parser for the
+ * next one. The line buffer is kept intact, as the command points into it.
+ */
+static int sbp_parserEndLine(sbp_cmd_parser_t *parser, sbp_cmd_t *cmd) {
+    int result = SBP_ERROR_PROTOCOL_FORMAT;
+    if (parser->state == SBP_PARSER_END) {
+        parser->line[parser->line_len] = '\0';
+        cmd->type = parser->type;
+        cmd->line = parser->line;
+        cmd->line_len = parser->line_len;
+        cmd->id = &parser->line[2];
+        cmd->id_len = parser->id_len;
+        cmd->value = &parser->line[parser->value_start];
+        cmd->value_len = parser->line_len - parser->value_start - 1;
+        result = SBP_SUCCESS;
+    } else if (parser->state == SBP_PARSER_DISCARD) {
+        result = parser->error;
+    } else if (parser->line_len == 0) {
+        // Empty lines are ignored
+        result = SBP_PARSER_INCOMPLETE;
+    }
+
+    parser->state = SBP_PARSER_MSG_TYPE;
+    parser->error = SBP_SUCCESS;
+    parser->line_len = 0;
+    parser->id_len = 0;
+    return result;
 }
 
 /**
@@ -199,7 +668,7 @@ static int sbp_generateErrorResponseStr(const sbp_cmd_t *cmd, const uint8_t erro
         str_buffer,
         str_buffer_len,
         "R[%.*s]ERROR[%d]" SBP_MSG_SEPARATOR,
-        cmd->id_len, cmd->id,
+        (int)cmd->id_len, cmd->id,
         error_code
     );
     if (cx < 1) return SBP_ERROR_ENCODING;
@@ -207,6 +676,97 @@ static int sbp_generateErrorResponseStr(const sbp_cmd_t *cmd, const uint8_t erro
     return cx;
 }
 
+/**
+ * @brief Parses the value of the start commands, a single letter for each
+ * sensor type, e.g. "AMBL" for accelerometer, magnetometer, buttons and
+ * light level.
+ *
+ * @param value The command value string (not null terminated).
+ * @param value_len The length of the value string.
+ * @param sensors Output with the sensors enabled in the value.
+ * @return SBP_SUCCESS or SBP_ERROR_CMD_VALUE if a character is not a sensor.
+ */
+static int sbp_parseSensorList(const char *value, const size_t value_len, sbp_sensors_t *sensors) {
+    sensors->raw = 0;
+    for (size_t i = 0; i < value_len; i++) {
+        bool valid_value = false;
+        for (size_t j = 0; j < SBP_SENSOR_TYPE_LEN; j++) {
+            if (value[i] == sbp_sensor_type[j]) {
+                sensors->raw |= (uint8_t)(1 << j);
+                valid_value = true;
+                break;
+            }
+        }
+        if (!valid_value) {
+            return SBP_ERROR_CMD_VALUE;
+        }
+    }
+    return SBP_SUCCESS;
+}
+
+/**
+ * @brief Shortest period for a batch size, SBP_CMD_PERIOD_BATCH_MIN only
+ * when batching and without any text periodic messages running, as only the
+ * binary format batches the samples.
+ *
+ * @param protocol_state The protocol state with the periodic messages running.
+ * @param batch_size The batch size to check the period for.
+ * @return The shortest period in milliseconds.
+ */
+static uint32_t sbp_periodMin(const sbp_state_t *protocol_state, const uint8_t batch_size) {
+    const bool binary = !protocol_state->send_periodic || protocol_state->periodic_mode == SBP_PERIODIC_MODE_BINARY;
+    return (batch_size > 1 && binary) ? SBP_CMD_PERIOD_BATCH_MIN : SBP_CMD_PERIOD_MIN;
+}
+
+/**
+ * @brief Enables the periodic messages in the protocol state and runs the
+ * start command callback.
+ *
+ * If the callback fails the protocol state is restored.
+ *
+ * @param protocol_state The protocol state to update.
+ * @param mode The format to use for the periodic messages.
+ * @param sensors The sensors to include in the periodic messages.
+ * @param callback The start command callback, can be NULL.
+ * @return SBP_SUCCESS, SBP_ERROR_CMD_VALUE if the period is too short for
+ *         the mode, or SBP_ERROR_INTERNAL if the callback failed.
+ */
+static int sbp_startPeriodic(
+    sbp_state_t *protocol_state, const sbp_periodic_mode_t mode,
+    const sbp_sensors_t sensors, const sbp_cmd_callback_t callback
+) {
+    // Only the binary format batches samples, the rest can't keep up with short periods
+    if (mode != SBP_PERIODIC_MODE_BINARY && protocol_state->period_ms < SBP_CMD_PERIOD_MIN) {
+        return SBP_ERROR_CMD_VALUE;
+    }
+
+    // Save the state in case we need to restore it due to an error on the callback
+    bool original_send_periodic = protocol_state->send_periodic;
+    sbp_periodic_mode_t original_periodic_mode = protocol_state->periodic_mode;
+    sbp_sensors_t original_sensors = protocol_state->sensors;
+
+    protocol_state->send_periodic = true;
+    protocol_state->periodic_mode = mode;
+    protocol_state->sensors = sensors;
+
+    if (callback && callback(protocol_state) != SBP_SUCCESS) {
+        protocol_state->send_periodic = original_send_periodic;
+        protocol_state->periodic_mode = original_periodic_mode;
+        protocol_state->sensors = original_sensors;
+        return SBP_ERROR_INTERNAL;
+    }
+
+    // Specialise the text encoders for the new sensors before the first message
+    if (mode == SBP_PERIODIC_MODE_VERBOSE) {
+        verboseEncoderSelect(sensors);
+    } else if (mode == SBP_PERIODIC_MODE_COMPACT || mode == SBP_PERIODIC_MODE_MULTI) {
+        compactEncoderSelect(sensors);
+    }
+    protocol_state->periodic_stats = { };
+    protocol_state->runtime_stats = { };
+    return SBP_SUCCESS;
+}
+
 /**
  * @brief Process a command to generate the appropriate response message.
  * 
@@ -225,6 +785,7 @@ static int sbp_processCommandResponse(
     switch (received_cmd->type) {
         case SBP_CMD_HANDSHAKE: {
             // TODO: Return an error if the value is not empty
+            protocol_state->handshake = true;
             return sbp_generateResponseStr(received_cmd, SBP_PROTOCOL_VERSION, 1, str_buffer, str_buffer_len);
         }
         case SBP_CMD_RADIOFREQ: {
@@ -232,16 +793,28 @@ static int sbp_processCommandResponse(
             // 1. An empty value - it returns the current frequency
             // 2. A value - it sets the frequency and returns the final frequency configured
             //    If the frequency was already saved to flash it cannot be changed, so this value might be different
+            //    The radio bridge only starts the switch, and returns the frequency it's still on until it's done
             if (received_cmd->value_len != 0) {
                 uint32_t radio_frequency;
                 int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &radio_frequency);
                 if (result != SBP_SUCCESS || radio_frequency > SBP_CMD_RADIO_FREQ_MAX) {
                     return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
                 }
+                const uint8_t previous_radio_frequency = protocol_state->radio_frequency;
                 protocol_state->radio_frequency = (uint8_t)radio_frequency;
 
-                if (cmd_cbk.radioFrequency && cmd_cbk.radioFrequency(protocol_state) != SBP_SUCCESS) {
-                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                if (cmd_cbk.radioFrequency) {
+                    int result = cmd_cbk.radioFrequency(protocol_state);
+                    if (result < SBP_SUCCESS) {
+                        protocol_state->radio_frequency = previous_radio_frequency;
+                        uint8_t error_code;
+                        switch (result) {
+                            case SBP_ERROR_BUSY:     error_code = SBP_ERROR_CODE_BUSY; break;
+                            case SBP_ERROR_INTERNAL: error_code = SBP_ERROR_CODE_INTERNAL_ERROR; break;
+                            default:                 error_code = SBP_ERROR_CODE_INVALID_VALUE; break;
+                        }
+                        return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+                    }
                 }
             }
 
@@ -301,9 +874,10 @@ static int sbp_processCommandResponse(
         }
         case SBP_CMD_PERIOD: {
             // TODO: Make this also a "get" command when value is empty?
-            uint32_t period_ms;
+            uint32_t period_ms = 0;
             int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &period_ms);
-            if (result != SBP_SUCCESS || period_ms < SBP_CMD_PERIOD_MIN || period_ms > SBP_CMD_PERIOD_MAX) {
+            if (result != SBP_SUCCESS || period_ms < sbp_periodMin(protocol_state, protocol_state->batch_size) ||
+                    period_ms > SBP_CMD_PERIOD_MAX) {
                 return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
             }
             protocol_state->period_ms = (uint16_t)period_ms;
@@ -330,67 +904,443 @@ static int sbp_processCommandResponse(
             return sbp_generateResponseStr(received_cmd, response_hw_version, 1, str_buffer, str_buffer_len);
         }
         case SBP_CMD_START: {
-            // The value format for the start command is a single letter for each sensor type
-            // e.g. "AMBL" for accelerometer, magnetometer, buttons and light level
             sbp_sensors_t sensors;
-            sensors.raw = 0;
-            for (size_t i = 0; i < received_cmd->value_len; i++) {
-                char value_char = *(received_cmd->value + i);
-                bool valid_value = false;
-                for (size_t j = 0; j < SBP_SENSOR_TYPE_LEN; j++) {
-                    if (value_char == sbp_sensor_type[j]) {
-                        sensors.raw |= (uint8_t)(1 << j);
-                        valid_value = true;
-                        break;
+            if (sbp_parseSensorList(received_cmd->value, received_cmd->value_len, &sensors) != SBP_SUCCESS) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            int result = sbp_startPeriodic(protocol_state, SBP_PERIODIC_MODE_VERBOSE, sensors, cmd_cbk.start);
+            if (result != SBP_SUCCESS) {
+                uint8_t error_code = (result == SBP_ERROR_CMD_VALUE) ?
+                        SBP_ERROR_CODE_INVALID_VALUE : SBP_ERROR_CODE_INTERNAL_ERROR;
+                return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+            }
+            return sbp_generateResponseStr(received_cmd, NULL, 0, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_ZSTART: {
+            sbp_sensors_t sensors;
+            if (sbp_parseSensorList(received_cmd->value, received_cmd->value_len, &sensors) != SBP_SUCCESS) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            // An empty value keeps the original ZSTART behaviour of streaming
+            // accelerometer and buttons
+            if (received_cmd->value_len == 0) {
+                sensors.accelerometer = true;
+                sensors.buttons = true;
+            }
+            int result = sbp_startPeriodic(protocol_state, SBP_PERIODIC_MODE_COMPACT, sensors, cmd_cbk.zstart);
+            if (result != SBP_SUCCESS) {
+                uint8_t error_code = (result == SBP_ERROR_CMD_VALUE) ?
+                        SBP_ERROR_CODE_INVALID_VALUE : SBP_ERROR_CODE_INTERNAL_ERROR;
+                return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+            }
+            return sbp_generateResponseStr(received_cmd, NULL, 0, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_BSTART: {
+            sbp_sensors_t sensors;
+            if (sbp_parseSensorList(received_cmd->value, received_cmd->value_len, &sensors) != SBP_SUCCESS) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            int result = sbp_startPeriodic(protocol_state, SBP_PERIODIC_MODE_BINARY, sensors, cmd_cbk.bstart);
+            if (result != SBP_SUCCESS) {
+                uint8_t error_code = (result == SBP_ERROR_CMD_VALUE) ?
+                        SBP_ERROR_CODE_INVALID_VALUE : SBP_ERROR_CODE_INTERNAL_ERROR;
+                return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+            }
+            return sbp_generateResponseStr(received_cmd, NULL, 0, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_DSTART: {
+            sbp_sensors_t sensors;
+            if (sbp_parseSensorList(received_cmd->value, received_cmd->value_len, &sensors) != SBP_SUCCESS) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            int result = sbp_startPeriodic(protocol_state, SBP_PERIODIC_MODE_DELTA, sensors, cmd_cbk.dstart);
+            if (result != SBP_SUCCESS) {
+                uint8_t error_code = (result == SBP_ERROR_CMD_VALUE) ?
+                        SBP_ERROR_CODE_INVALID_VALUE : SBP_ERROR_CODE_INTERNAL_ERROR;
+                return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+            }
+            delta_force_keyframe = true;
+            return sbp_generateResponseStr(received_cmd, NULL, 0, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_MSTART: {
+            sbp_sensors_t sensors;
+            if (sbp_parseSensorList(received_cmd->value, received_cmd->value_len, &sensors) != SBP_SUCCESS) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            // Like ZSTART, an empty value streams the accelerometer and buttons
+            if (received_cmd->value_len == 0) {
+                sensors.accelerometer = true;
+                sensors.buttons = true;
+            }
+            int result = sbp_startPeriodic(protocol_state, SBP_PERIODIC_MODE_MULTI, sensors, cmd_cbk.mstart);
+            if (result != SBP_SUCCESS) {
+                uint8_t error_code = (result == SBP_ERROR_CMD_VALUE) ?
+                        SBP_ERROR_CODE_INVALID_VALUE : SBP_ERROR_CODE_INTERNAL_ERROR;
+                return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+            }
+            return sbp_generateResponseStr(received_cmd, NULL, 0, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_DKEY: {
+            // This command has two modes, both request a keyframe as the next delta message:
+            // 1. An empty value - it returns the current keyframe interval
+            // 2. A value - it sets the keyframe interval and returns it
+            if (received_cmd->value_len != 0) {
+                uint32_t keyframe_interval;
+                int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &keyframe_interval);
+                if (result != SBP_SUCCESS ||
+                        keyframe_interval < SBP_CMD_DELTA_KEYFRAME_MIN ||
+                        keyframe_interval > SBP_CMD_DELTA_KEYFRAME_MAX) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+                protocol_state->delta_keyframe_interval = (uint16_t)keyframe_interval;
+            }
+            delta_force_keyframe = true;
+
+            // Convert protocol_state->delta_keyframe_interval (uint16_t) into a string
+            char response_interval[6] = { 0 };
+            size_t interval_str_len = snprintf(response_interval, 6, "%u", (unsigned int)protocol_state->delta_keyframe_interval);
+            if (interval_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_interval, interval_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_BATCH: {
+            // Empty value indicates a read command only
+            if (received_cmd->value_len != 0) {
+                uint32_t batch_size;
+                int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &batch_size);
+                if (result != SBP_SUCCESS || batch_size < SBP_CMD_BATCH_MIN || batch_size > SBP_CMD_BATCH_MAX) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+                // Periods shorter than SBP_CMD_PERIOD_MIN are only allowed when batching
+                if (protocol_state->period_ms < sbp_periodMin(protocol_state, (uint8_t)batch_size)) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+                protocol_state->batch_size = (uint8_t)batch_size;
+            }
+
+            // Convert protocol_state->batch_size (uint8_t) into a string
+            char response_batch[4] = { 0 };
+            size_t batch_str_len = snprintf(response_batch, 4, "%u", (unsigned int)protocol_state->batch_size);
+            if (batch_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_batch, batch_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_TIMESTAMPS: {
+            // Empty value indicates a read command only, otherwise sets the
+            // timestamps added to the verbose and compact periodic messages
+            if (received_cmd->value_len != 0) {
+                uint32_t timestamps;
+                int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &timestamps);
+                if (result != SBP_SUCCESS || timestamps > SBP_TIMESTAMPS_REMOTE) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+                const sbp_timestamps_t original_timestamps = protocol_state->timestamps;
+                protocol_state->timestamps = (sbp_timestamps_t)timestamps;
+
+                if (cmd_cbk.timestamps && cmd_cbk.timestamps(protocol_state) != SBP_SUCCESS) {
+                    protocol_state->timestamps = original_timestamps;
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+            }
+
+            const char response_timestamps = '0' + (char)protocol_state->timestamps;
+            return sbp_generateResponseStr(received_cmd, &response_timestamps, 1, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_CAPTURE: {
+            // Value is "samples,rate_hz", the capture starts straight away and
+            // the samples are sent as binary frames once it finishes
+            const char *comma = (const char *)memchr(received_cmd->value, ',', received_cmd->value_len);
+            if (comma == NULL || protocol_state->send_periodic) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            const size_t samples_len = comma - received_cmd->value;
+            uint32_t samples, rate_hz;
+            if (uintFromCommandValue(received_cmd->value, samples_len, &samples) != SBP_SUCCESS ||
+                    uintFromCommandValue(comma + 1, received_cmd->value_len - samples_len - 1, &rate_hz) != SBP_SUCCESS ||
+                    samples < SBP_CMD_CAPTURE_SAMPLES_MIN || samples > SBP_CMD_CAPTURE_SAMPLES_MAX ||
+                    rate_hz < SBP_CMD_CAPTURE_RATE_MIN || rate_hz > SBP_CMD_CAPTURE_RATE_MAX) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            protocol_state->capture_samples = (uint16_t)samples;
+            protocol_state->capture_rate_hz = (uint16_t)rate_hz;
+
+            if (cmd_cbk.capture) {
+                int result = cmd_cbk.capture(protocol_state);
+                if (result < SBP_SUCCESS) {
+                    uint8_t error_code;
+                    switch (result) {
+                        case SBP_ERROR_CMD_REPEATED: error_code = SBP_ERROR_CODE_VALUE_ALREADY_SET; break;
+                        case SBP_ERROR_INTERNAL:     error_code = SBP_ERROR_CODE_INTERNAL_ERROR; break;
+                        default:                     error_code = SBP_ERROR_CODE_INVALID_VALUE; break;
                     }
+                    return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
                 }
-                if (!valid_value) {
+            }
+            // Convert the capture samples and rate (uint16_t) into a "samples,rate_hz" string
+            char response_capture[12] = { 0 };
+            int capture_str_len = snprintf(response_capture, sizeof(response_capture), "%u,%u",
+                    (unsigned int)protocol_state->capture_samples, (unsigned int)protocol_state->capture_rate_hz);
+            if (capture_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_capture, capture_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_BAUD: {
+            // Empty value indicates a read command only, otherwise switches to the new
+            // baud rate after this response, or confirms the switch if already at it
+            if (received_cmd->value_len != 0) {
+                uint32_t baudrate = 0;
+                int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &baudrate);
+                bool supported = false;
+                for (size_t i = 0; i < SBP_BAUDRATES_LEN; i++) {
+                    if (baudrate == sbp_baudrates[i]) supported = true;
+                }
+                // The periodic messages would be corrupted by the switch, and it's only
+                // negotiated with a host that has already completed the handshake
+                if (result != SBP_SUCCESS || !supported || protocol_state->send_periodic ||
+                        !protocol_state->handshake) {
                     return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
                 }
+                const uint32_t original_baudrate = protocol_state->baudrate;
+                protocol_state->baudrate = baudrate;
+
+                if (cmd_cbk.baudrate) {
+                    result = cmd_cbk.baudrate(protocol_state);
+                    if (result < SBP_SUCCESS) {
+                        protocol_state->baudrate = original_baudrate;
+                        uint8_t error_code;
+                        switch (result) {
+                            case SBP_ERROR_CMD_REPEATED: error_code = SBP_ERROR_CODE_VALUE_ALREADY_SET; break;
+                            case SBP_ERROR_INTERNAL:     error_code = SBP_ERROR_CODE_INTERNAL_ERROR; break;
+                            default:                     error_code = SBP_ERROR_CODE_INVALID_VALUE; break;
+                        }
+                        return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+                    }
+                }
             }
-            // Save the state in case we need to restore it due to an error on the callback
-            bool original_send_periodic = protocol_state->send_periodic;
-            bool original_periodic_compact = protocol_state->periodic_compact;
-            sbp_sensors_t original_sensors = protocol_state->sensors;
-            protocol_state->send_periodic = true;
-            protocol_state->periodic_compact = false;
-            protocol_state->sensors = sensors;
-
-            if (cmd_cbk.start && cmd_cbk.start(protocol_state) != SBP_SUCCESS) {
-                protocol_state->send_periodic = original_send_periodic;
-                protocol_state->periodic_compact = original_periodic_compact;
-                protocol_state->sensors = original_sensors;
-                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INTERNAL_ERROR, str_buffer, str_buffer_len);
+
+            // Convert protocol_state->baudrate (uint32_t) into a string
+            char response_baudrate[11] = { 0 };
+            int baudrate_str_len = snprintf(response_baudrate, sizeof(response_baudrate), "%lu",
+                    (unsigned long)protocol_state->baudrate);
+            if (baudrate_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_baudrate, baudrate_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_JITTER: {
+            // Read only, returns "deadlines,missed,mean late us,max late us"
+            if (received_cmd->value_len != 0) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
             }
+            const sbp_periodic_stats_t *stats = &protocol_state->periodic_stats;
+            const uint32_t late_mean_us = stats->deadlines ? (uint32_t)(stats->late_sum_us / stats->deadlines) : 0;
 
-            return sbp_generateResponseStr(received_cmd, NULL, 0, str_buffer, str_buffer_len);
+            char response_jitter[44] = { 0 };
+            int jitter_str_len = snprintf(response_jitter, sizeof(response_jitter), "%lu,%lu,%lu,%lu",
+                    (unsigned long)stats->deadlines, (unsigned long)stats->missed,
+                    (unsigned long)late_mean_us, (unsigned long)stats->late_max_us);
+            if (jitter_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_jitter, jitter_str_len, str_buffer, str_buffer_len);
         }
-        case SBP_CMD_ZSTART: {
-            // Save the state in case we need to restore it due to an error on the callback
-            bool original_send_periodic = protocol_state->send_periodic;
-            bool original_periodic_compact = protocol_state->periodic_compact;
-            sbp_sensors_t original_sensors = protocol_state->sensors;
-
-            protocol_state->send_periodic = true;
-            protocol_state->periodic_compact = true;
-            protocol_state->sensors.raw = 0;
-            // TODO: Currently hardcoding this command to only send accelerometer and buttons
-            //       as that's all that is implemented right now
-            protocol_state->sensors.accelerometer = true;
-            protocol_state->sensors.buttons = true;
-
-            if (cmd_cbk.zstart && cmd_cbk.zstart(protocol_state) != SBP_SUCCESS) {
-                protocol_state->send_periodic = original_send_periodic;
-                protocol_state->periodic_compact = original_periodic_compact;
-                protocol_state->sensors = original_sensors;
-                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INTERNAL_ERROR, str_buffer, str_buffer_len);
+        case SBP_CMD_STATS: {
+            // Read only, returns "deadlines,missed,stale,min slack us,mean slack us,commands,
+            // serial TX bytes,radio received,radio accepted,radio ignored,messages,encode us"
+            if (received_cmd->value_len != 0) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
             }
+            const sbp_periodic_stats_t *periodic = &protocol_state->periodic_stats;
+            const sbp_runtime_stats_t *stats = &protocol_state->runtime_stats;
+            const uint32_t slack_mean_us = periodic->deadlines ? (uint32_t)(stats->slack_sum_us / periodic->deadlines) : 0;
 
-            return sbp_generateResponseStr(received_cmd, NULL, 0, str_buffer, str_buffer_len);
+            char response_stats[132] = { 0 };
+            int stats_str_len = snprintf(response_stats, sizeof(response_stats),
+                    "%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu",
+                    (unsigned long)periodic->deadlines, (unsigned long)periodic->missed,
+                    (unsigned long)stats->stale, (unsigned long)stats->slack_min_us,
+                    (unsigned long)slack_mean_us, (unsigned long)stats->commands,
+                    (unsigned long)stats->serial_tx_bytes, (unsigned long)stats->radio_received,
+                    (unsigned long)stats->radio_accepted, (unsigned long)stats->radio_ignored,
+                    (unsigned long)stats->messages, (unsigned long)stats->encode_us);
+            if (stats_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_stats, stats_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_PROFILE: {
+            // Value is the profiled stage, the callback fills in its histogram, and the
+            // response is "count,mean ns,max ns" followed by the bucket counts
+            uint32_t stage;
+            int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &stage);
+            if (result != SBP_SUCCESS) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            protocol_state->profile_stage = stage;
+            result = cmd_cbk.profile ? cmd_cbk.profile(protocol_state) : SBP_ERROR_NOT_IMPLEMENTED;
+            if (result < SBP_SUCCESS) {
+                uint8_t error_code = (result == SBP_ERROR_CMD_VALUE) ?
+                        SBP_ERROR_CODE_INVALID_VALUE : SBP_ERROR_CODE_INTERNAL_ERROR;
+                return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+            }
+            const sbp_histogram_t *histogram = &protocol_state->profile;
+            const uint32_t mean_ns = histogram->count ? (uint32_t)(histogram->sum_ns / histogram->count) : 0;
+
+            char response_profile[132] = { 0 };
+            char *str = response_profile;
+            str += snprintf(str, 34, "%lu,%lu,%lu", (unsigned long)histogram->count,
+                    (unsigned long)mean_ns, (unsigned long)histogram->max_ns);
+            for (size_t i = 0; i < SBP_HISTOGRAM_BUCKETS; i++) {
+                str += snprintf(str, 7, ",%u", (unsigned int)histogram->buckets[i]);
+            }
+            const int profile_str_len = str - response_profile;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_profile, profile_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_RADIO_LOSS: {
+            // Value is the remote micro:bit ID, or empty for the active one, the callback
+            // fills in its counters, and the response is "received,lost,duplicated,reordered"
+            uint32_t radio_loss_id = 0;
+            if (received_cmd->value_len != 0) {
+                int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &radio_loss_id);
+                if (result != SBP_SUCCESS || radio_loss_id == 0) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+            }
+            protocol_state->radio_loss_id = radio_loss_id;
+            int result = cmd_cbk.radioLoss ? cmd_cbk.radioLoss(protocol_state) : SBP_ERROR_NOT_IMPLEMENTED;
+            if (result < SBP_SUCCESS) {
+                uint8_t error_code = (result == SBP_ERROR_CMD_VALUE) ?
+                        SBP_ERROR_CODE_INVALID_VALUE : SBP_ERROR_CODE_INTERNAL_ERROR;
+                return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+            }
+            const sbp_radio_loss_t *radio_loss = &protocol_state->radio_loss;
+
+            char response_radio_loss[44] = { 0 };
+            int radio_loss_str_len = snprintf(response_radio_loss, sizeof(response_radio_loss), "%lu,%lu,%lu,%lu",
+                    (unsigned long)radio_loss->received, (unsigned long)radio_loss->lost,
+                    (unsigned long)radio_loss->duplicated, (unsigned long)radio_loss->reordered);
+            if (radio_loss_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_radio_loss, radio_loss_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_RADIO_LOSS_MSG: {
+            // Empty value indicates a read command only, otherwise 1 adds the radio loss
+            // to the verbose periodic messages, and 0 removes it. Only the builds that
+            // track the radio loss, with the RLOSS callback, accept it.
+            if (received_cmd->value_len != 0) {
+                uint32_t radio_loss_msg;
+                int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &radio_loss_msg);
+                if (result != SBP_SUCCESS || radio_loss_msg > 1) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+                if (cmd_cbk.radioLoss == NULL) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INTERNAL_ERROR, str_buffer, str_buffer_len);
+                }
+                protocol_state->radio_loss_msg = radio_loss_msg == 1;
+            }
+
+            const char response_radio_loss_msg = protocol_state->radio_loss_msg ? '1' : '0';
+            return sbp_generateResponseStr(received_cmd, &response_radio_loss_msg, 1, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_REMOTE_INDEX: {
+            // Value is a remote index from the MSTART messages, the callback fills in
+            // the micro:bit ID with that index, which is the response value
+            uint32_t remote_index;
+            int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &remote_index);
+            if (result != SBP_SUCCESS || remote_index > UINT8_MAX) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+            }
+            protocol_state->remote_index = (uint8_t)remote_index;
+            result = cmd_cbk.remoteIndex ? cmd_cbk.remoteIndex(protocol_state) : SBP_ERROR_NOT_IMPLEMENTED;
+            if (result < SBP_SUCCESS) {
+                uint8_t error_code = (result == SBP_ERROR_CMD_VALUE) ?
+                        SBP_ERROR_CODE_INVALID_VALUE : SBP_ERROR_CODE_INTERNAL_ERROR;
+                return sbp_generateErrorResponseStr(received_cmd, error_code, str_buffer, str_buffer_len);
+            }
+
+            // Convert protocol_state->remote_index_id into a string, max value 2*32
+            char response_mb_id[12] = { 0 };
+            size_t mb_id_str_len = snprintf(response_mb_id, 12, "%u", (unsigned int)protocol_state->remote_index_id);
+            if (mb_id_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_mb_id, mb_id_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_RADIO_CHANGE: {
+            // Empty value indicates a read command only, otherwise "deadband_mg,heartbeat_ms"
+            // makes the remote micro:bits only send the samples that change more than the
+            // deadband, or once per heartbeat, and "0,0" sends every sample again. Only the
+            // radio bridge builds, with the callback, accept it.
+            if (received_cmd->value_len != 0) {
+                const char *comma = (const char *)memchr(received_cmd->value, ',', received_cmd->value_len);
+                if (comma == NULL) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+                const size_t deadband_len = comma - received_cmd->value;
+                uint32_t deadband_mg, heartbeat_ms;
+                if (uintFromCommandValue(received_cmd->value, deadband_len, &deadband_mg) != SBP_SUCCESS ||
+                        uintFromCommandValue(comma + 1, received_cmd->value_len - deadband_len - 1, &heartbeat_ms) != SBP_SUCCESS ||
+                        deadband_mg > SBP_CMD_RADIO_DEADBAND_MAX ||
+                        (heartbeat_ms == 0 && deadband_mg != 0) ||
+                        (heartbeat_ms != 0 && (heartbeat_ms < SBP_CMD_RADIO_HEARTBEAT_MIN ||
+                                               heartbeat_ms > SBP_CMD_RADIO_HEARTBEAT_MAX))) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+                if (cmd_cbk.radioChange == NULL) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INTERNAL_ERROR, str_buffer, str_buffer_len);
+                }
+                protocol_state->radio_deadband_mg = (uint16_t)deadband_mg;
+                protocol_state->radio_heartbeat_ms = (uint16_t)heartbeat_ms;
+                int result = cmd_cbk.radioChange(protocol_state);
+                if (result < SBP_SUCCESS) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INTERNAL_ERROR, str_buffer, str_buffer_len);
+                }
+            }
+
+            // Convert the deadband and heartbeat (uint16_t) into a "deadband_mg,heartbeat_ms" string
+            char response_radio_change[12] = { 0 };
+            int radio_change_str_len = snprintf(response_radio_change, sizeof(response_radio_change), "%u,%u",
+                    (unsigned int)protocol_state->radio_deadband_mg, (unsigned int)protocol_state->radio_heartbeat_ms);
+            if (radio_change_str_len < 1) return SBP_ERROR_ENCODING;
+
+            return sbp_generateResponseStr(
+                    received_cmd, response_radio_change, radio_change_str_len, str_buffer, str_buffer_len);
+        }
+        case SBP_CMD_RADIO_SLOTS: {
+            // Empty value indicates a read command only, otherwise 1 starts sending the
+            // time-slotted beacons to the remote micro:bits, and 0 stops them. Only the
+            // radio bridge builds, with the callback, accept it.
+            if (received_cmd->value_len != 0) {
+                uint32_t radio_slots;
+                int result = uintFromCommandValue(received_cmd->value, received_cmd->value_len, &radio_slots);
+                if (result != SBP_SUCCESS || radio_slots > 1) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INVALID_VALUE, str_buffer, str_buffer_len);
+                }
+                if (cmd_cbk.radioSlots == NULL) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INTERNAL_ERROR, str_buffer, str_buffer_len);
+                }
+                protocol_state->radio_slots = radio_slots == 1;
+                result = cmd_cbk.radioSlots(protocol_state);
+                if (result < SBP_SUCCESS) {
+                    return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INTERNAL_ERROR, str_buffer, str_buffer_len);
+                }
+            }
+
+            const char response_radio_slots = protocol_state->radio_slots ? '1' : '0';
+            return sbp_generateResponseStr(received_cmd, &response_radio_slots, 1, str_buffer, str_buffer_len);
         }
         case SBP_CMD_STOP: {
             // TODO: Return an error if the value is not empty
             protocol_state->send_periodic = false;
+            if (cmd_cbk.stop && cmd_cbk.stop(protocol_state) != SBP_SUCCESS) {
+                return sbp_generateErrorResponseStr(received_cmd, SBP_ERROR_CODE_INTERNAL_ERROR, str_buffer, str_buffer_len);
+            }
             return sbp_generateResponseStr(received_cmd, NULL, 0, str_buffer, str_buffer_len);
         }
         default:
@@ -407,6 +1357,7 @@ int sbp_init(sbp_cmd_callbacks_t *cmd_callbacks, sbp_state_t *protocol_state) {
     for (int i = 0; i < SBP_CMD_TYPE_LEN; i++) {
         CMD_MAX_LEN = MAX(CMD_MAX_LEN, strlen(sbp_cmd_type_str[i]));
     }
+    cmdTypeLookupInit();
 
     // Configure the callbacks
     cmd_cbk = *cmd_callbacks;
@@ -415,243 +1366,340 @@ int sbp_init(sbp_cmd_callbacks_t *cmd_callbacks, sbp_state_t *protocol_state) {
     if (protocol_state->hw_version == 0 ||
         protocol_state->sw_version == NULL ||
         protocol_state->radio_frequency > SBP_CMD_RADIO_FREQ_MAX ||
-        protocol_state->period_ms < SBP_CMD_PERIOD_MIN) {
+        protocol_state->period_ms < SBP_CMD_PERIOD_MIN ||
+        protocol_state->delta_keyframe_interval < SBP_CMD_DELTA_KEYFRAME_MIN ||
+        protocol_state->batch_size < SBP_CMD_BATCH_MIN ||
+        protocol_state->batch_size > SBP_CMD_BATCH_MAX ||
+        protocol_state->timestamps > SBP_TIMESTAMPS_REMOTE ||
+        protocol_state->baudrate != SBP_DEFAULT_BAUDRATE ||
+        protocol_state->radio_loss_msg ||
+        protocol_state->radio_heartbeat_ms != 0 ||
+        protocol_state->radio_slots) {
         return SBP_ERROR;
     }
 
     return SBP_SUCCESS;
 }
 
+void sbp_selectPeriodicEncoders(const sbp_sensors_t enabled_data) {
+    verboseEncoderSelect(enabled_data);
+    compactEncoderSelect(enabled_data);
+}
+
 int sbp_sensorDataPeriodicStr(
-    const sbp_sensors_t enabled_data, const sbp_sensor_data_t *data,
-    char *str_buffer, const int str_buffer_len
+    const sbp_sensor_data_t *data,
+    char *str_buffer, const int str_buffer_len, const sbp_timestamps_t timestamps, const bool radio_loss
 ) {
-    int serial_data_length = 0;
     static uint32_t packet_id = 0;
+    const periodic_encoder_t *encoder = &verbose_encoder;
+    const int max_len = encoder->max_len + ((int)timestamps * VERBOSE_TIMESTAMP_MAX_LEN) +
+                        (radio_loss ? VERBOSE_RADIO_LOSS_MAX_LEN : 0);
 
-    int cx = snprintf(
-        str_buffer + serial_data_length,
-        str_buffer_len - serial_data_length,
-        "P[%lX]",
-        packet_id++
-    );
-    if (cx > 0) {
-        serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-    } else {
-        return SBP_ERROR_ENCODING;
-    }
+    // Single bounds check with the worst case length for the enabled sensors,
+    // if it doesn't fit encode into a scratch buffer and check the real length
+    char scratch_buffer[SBP_VERBOSE_STR_MAX_LEN];
+    char *const str_start = (str_buffer_len >= max_len) ? str_buffer : scratch_buffer;
+    char *str = str_start;
 
-    if (enabled_data.accelerometer) {
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            SBP_SENSOR_STR_ACC_X "[%d]" SBP_SENSOR_STR_ACC_Y "[%d]" SBP_SENSOR_STR_ACC_Z "[%d]",
-            data->accelerometer_x,
-            data->accelerometer_y,
-            data->accelerometer_z
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
+    str = STR_APPEND_LITERAL(str, "P[");
+    str = strAppendHex(str, packet_id++);
+    *str++ = ']';
+    if (timestamps >= SBP_TIMESTAMPS_LOCAL) {
+        str = STR_APPEND_LITERAL(str, SBP_TIMESTAMP_STR_LOCAL "[");
+        str = strAppendUint(str, data->timestamp_us);
+        *str++ = ']';
     }
-    if (enabled_data.magnetometer) {
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            SBP_SENSOR_STR_MAG_X "[%d]" SBP_SENSOR_STR_MAG_Y "[%d]" SBP_SENSOR_STR_MAG_Z "[%d]",
-            data->magnetometer_x,
-            data->magnetometer_y,
-            data->magnetometer_z
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
+    if (timestamps >= SBP_TIMESTAMPS_REMOTE) {
+        str = STR_APPEND_LITERAL(str, SBP_TIMESTAMP_STR_REMOTE "[");
+        str = strAppendUint(str, data->remote_timestamp_us);
+        *str++ = ']';
     }
-    if (enabled_data.buttons) {
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            SBP_SENSOR_STR_BTN_A "[%d]" SBP_SENSOR_STR_BTN_B "[%d]",
-            data->button_a,
-            data->button_b
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
+    if (radio_loss) {
+        str = STR_APPEND_LITERAL(str, SBP_RADIO_LOSS_STR "[");
+        str = strAppendUint(str, data->radio_lost);
+        *str++ = ']';
     }
-    if (enabled_data.button_logo) {
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            SBP_SENSOR_STR_BTN_LOGO "[%d]",
-            data->button_logo
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
+    for (size_t i = 0; i < encoder->fields_len; i++) {
+        str = encoder->fields[i](str, data);
     }
-    if (enabled_data.button_pins) {
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            SBP_SENSOR_STR_BTN_P0 "[%d]" SBP_SENSOR_STR_BTN_P1 "[%d]" SBP_SENSOR_STR_BTN_P2 "[%d]",
-            data->button_p0,
-            data->button_p1,
-            data->button_p2
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
+    str = STR_APPEND_LITERAL(str, SBP_MSG_SEPARATOR);
+
+    return periodicStrFinish(str_start, str - str_start, str_buffer, str_buffer_len);
+}
+
+/**
+ * @brief Encodes a compact periodic message, with the 2 hex digit remote
+ * index after the message ID when remote_index is not negative, see
+ * sbp_compactSensorDataPeriodicStr() and sbp_multiSensorDataPeriodicStr().
+ */
+static int compactPeriodicStr(
+    const sbp_sensor_data_t *data, const int remote_index,
+    char *str_buffer, const int str_buffer_len, const sbp_timestamps_t timestamps
+) {
+    // The message ID is only 1 byte long
+    static uint8_t packet_id = 0;
+    const periodic_encoder_t *encoder = &compact_encoder;
+    const int max_len = encoder->max_len + ((int)timestamps * COMPACT_TIMESTAMP_LEN) + (remote_index >= 0 ? 2 : 0);
+
+    // All fields are fixed width, so max_len is the actual length
+    char scratch_buffer[SBP_MULTI_STR_MAX_LEN];
+    char *const str_start = (str_buffer_len >= max_len) ? str_buffer : scratch_buffer;
+    char *str = str_start;
+
+    *str++ = sbp_msg_type_char[SBP_MSG_PERIODIC];
+    str = strAppendHexFixed(str, packet_id++, 2);
+    if (remote_index >= 0) {
+        str = strAppendHexFixed(str, (uint32_t)remote_index, 2);
     }
-    if (enabled_data.temperature) {
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            SBP_SENSOR_STR_TEMP "[%d]",
-            data->temperature
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
+    if (timestamps >= SBP_TIMESTAMPS_LOCAL) {
+        str = strAppendHexFixed(str, data->timestamp_us, COMPACT_TIMESTAMP_LEN);
     }
-    if (enabled_data.light_level) {
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            SBP_SENSOR_STR_LIGHT "[%d]",
-            data->light_level
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
+    if (timestamps >= SBP_TIMESTAMPS_REMOTE) {
+        str = strAppendHexFixed(str, data->remote_timestamp_us, COMPACT_TIMESTAMP_LEN);
     }
-    if (enabled_data.sound_level) {
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            SBP_SENSOR_STR_SOUND "[%d]",
-            data->sound_level
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
-    }
-
-    // Ensure the string ends with the message separator and a null terminator
-    if ((str_buffer_len - serial_data_length) >= (int)(SBP_MSG_SEPARATOR_LEN + 1)) {
-        serial_data_length += snprintf(
-            str_buffer + serial_data_length, SBP_MSG_SEPARATOR_LEN + 1, SBP_MSG_SEPARATOR
-        );
-    } else {
-        const size_t first_char_index = str_buffer_len - (SBP_MSG_SEPARATOR_LEN + 1);
-        for (size_t i = 0; i < SBP_MSG_SEPARATOR_LEN; i++) {
-            str_buffer[first_char_index + i] = SBP_MSG_SEPARATOR[i];
-        }
-        str_buffer[str_buffer_len - 1] = '\0';
-        return SBP_ERROR_LEN;
+    for (size_t i = 0; i < encoder->fields_len; i++) {
+        str = encoder->fields[i](str, data);
     }
+    str = STR_APPEND_LITERAL(str, SBP_MSG_SEPARATOR);
 
-    return serial_data_length;
+    return periodicStrFinish(str_start, str - str_start, str_buffer, str_buffer_len);
 }
 
 int sbp_compactSensorDataPeriodicStr(
-    const sbp_sensors_t enabled_data, const sbp_sensor_data_t *data,
-    char *str_buffer, const int str_buffer_len
+    const sbp_sensor_data_t *data,
+    char *str_buffer, const int str_buffer_len, const sbp_timestamps_t timestamps
 ) {
-    int serial_data_length = 0;
-    // The message ID is only 1 byte long
-    static uint8_t packet_id = 0;
+    return compactPeriodicStr(data, -1, str_buffer, str_buffer_len, timestamps);
+}
 
-    int cx = snprintf(
-        str_buffer + serial_data_length,
-        str_buffer_len - serial_data_length,
-        "P%02X", packet_id++
-    );
-    if (cx > 0) {
-        serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-    } else {
-        return SBP_ERROR_ENCODING;
+int sbp_multiSensorDataPeriodicStr(
+    const sbp_sensor_data_t *data, const uint8_t remote_index,
+    char *str_buffer, const int str_buffer_len, const sbp_timestamps_t timestamps
+) {
+    return compactPeriodicStr(data, remote_index, str_buffer, str_buffer_len, timestamps);
+}
+
+size_t sbp_binaryMaxSamples(const sbp_sensors_t enabled_data) {
+    const size_t sample_len = binarySampleLen(enabled_data);
+    if (sample_len == 0) return SBP_CMD_BATCH_MAX;
+    return MIN((SBP_BINARY_RECORD_MAX_LEN - SBP_BINARY_HEADER_LEN - 2) / sample_len, SBP_CMD_BATCH_MAX);
+}
+
+/**
+ * @brief Encodes a binary record with the given sequence number, see
+ * sbp_binarySensorDataPeriodic().
+ */
+static int binaryRecordFrame(
+    const uint16_t seq, const sbp_sensors_t enabled_data, const sbp_sensor_data_t *samples,
+    const size_t samples_len, uint8_t *buffer, const int buffer_len
+) {
+    // Records shorter than 0x51 bytes ensure the first COBS byte is never 'R'
+    // and that COBS only adds a single overhead byte
+    static_assert((SBP_BINARY_RECORD_MAX_LEN + 1) < 'R', "Binary record too long");
+    static_assert((SBP_BINARY_HEADER_LEN + SBP_BINARY_SAMPLE_MAX_LEN + 2) <= SBP_BINARY_RECORD_MAX_LEN,
+                  "A binary record must fit at least one sample");
+    if (buffer_len < SBP_BINARY_FRAME_MAX_LEN) {
+        return SBP_ERROR_LEN;
+    }
+    if (samples_len == 0 || samples_len > sbp_binaryMaxSamples(enabled_data)) {
+        return SBP_ERROR_LEN;
     }
 
-    if (enabled_data.accelerometer) {
-        // Accelerometer max is +/- 2 g, so we can use 12 bits (3 Hex digits) per axis
-        uint16_t x = CLAMP(data->accelerometer_x, -2048, 2047) + 2048;
-        uint16_t y = CLAMP(data->accelerometer_y, -2048, 2047) + 2048;
-        uint16_t z = CLAMP(data->accelerometer_z, -2048, 2047) + 2048;
-
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            "%03X%03X%03X", x, y, z
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
+    uint8_t record[SBP_BINARY_RECORD_MAX_LEN];
+    uint8_t *rec = record;
+
+    rec = bufAppendU16(rec, seq);
+    *rec++ = enabled_data.raw;
+    *rec++ = (uint8_t)samples_len;
+
+    for (size_t i = 0; i < samples_len; i++) {
+        const sbp_sensor_data_t *data = &samples[i];
+        if (enabled_data.accelerometer) {
+            rec = bufAppendU16(rec, (uint16_t)CLAMP(data->accelerometer_x, INT16_MIN, INT16_MAX));
+            rec = bufAppendU16(rec, (uint16_t)CLAMP(data->accelerometer_y, INT16_MIN, INT16_MAX));
+            rec = bufAppendU16(rec, (uint16_t)CLAMP(data->accelerometer_z, INT16_MIN, INT16_MAX));
+        }
+        if (enabled_data.magnetometer) {
+            rec = bufAppendI32(rec, data->magnetometer_x);
+            rec = bufAppendI32(rec, data->magnetometer_y);
+            rec = bufAppendI32(rec, data->magnetometer_z);
+        }
+        if (enabled_data.buttons || enabled_data.button_logo || enabled_data.button_pins) {
+            *rec++ = packedButtons(enabled_data, data);
+        }
+        if (enabled_data.temperature) {
+            *rec++ = (uint8_t)(int8_t)CLAMP(data->temperature, INT8_MIN, INT8_MAX);
+        }
+        if (enabled_data.light_level) {
+            *rec++ = (uint8_t)CLAMP(data->light_level, 0, UINT8_MAX);
+        }
+        if (enabled_data.sound_level) {
+            *rec++ = (uint8_t)CLAMP(data->sound_level, 0, UINT8_MAX);
         }
     }
-    if (enabled_data.buttons) {
-        // Buttons are 1 bit each, with button A as the LSB
-        uint8_t buttons = (data->button_a & 0x01) | ((data->button_b & 0x01) << 1);
-
-        int cx = snprintf(
-            str_buffer + serial_data_length,
-            str_buffer_len - serial_data_length,
-            "%1X", buttons
-        );
-        if (cx > 0) {
-            serial_data_length += MIN(cx, str_buffer_len - serial_data_length - 1);
-        } else {
-            return SBP_ERROR_ENCODING;
-        }
-    }
-
-    // TODO: Only accelerometer and buttons implemented, other sensors are not
-    //       implemented yet
-    if (enabled_data.magnetometer || enabled_data.button_logo || enabled_data.button_pins ||
-        enabled_data.temperature || enabled_data.light_level || enabled_data.sound_level) {
-        return SBP_ERROR_NOT_IMPLEMENTED;
-    }
-
-    // Ensure the string ends with the message separator and a null terminator
-    if ((str_buffer_len - serial_data_length) >= (int)(SBP_MSG_SEPARATOR_LEN + 1)) {
-        serial_data_length += snprintf(
-            str_buffer + serial_data_length, SBP_MSG_SEPARATOR_LEN + 1, SBP_MSG_SEPARATOR
-        );
-    } else {
-        const size_t first_char_index = str_buffer_len - (SBP_MSG_SEPARATOR_LEN + 1);
-        for (size_t i = 0; i < SBP_MSG_SEPARATOR_LEN; i++) {
-            str_buffer[first_char_index + i] = SBP_MSG_SEPARATOR[i];
-        }
-        str_buffer[str_buffer_len - 1] = '\0';
+
+    rec = bufAppendU16(rec, crc16Ccitt(record, rec - record));
+
+    return (int)cobsEncode(record, rec - record, buffer);
+}
+
+int sbp_binarySensorDataPeriodic(
+    const sbp_sensors_t enabled_data, const sbp_sensor_data_t *samples, const size_t samples_len,
+    uint8_t *buffer, const int buffer_len
+) {
+    static uint16_t packet_id = 0;
+
+    const int result = binaryRecordFrame(packet_id, enabled_data, samples, samples_len, buffer, buffer_len);
+    if (result > 0) {
+        packet_id += samples_len;
+    }
+    return result;
+}
+
+int sbp_binaryCaptureData(
+    const uint16_t first_sample, const sbp_sensor_data_t *samples, const size_t samples_len,
+    uint8_t *buffer, const int buffer_len
+) {
+    sbp_sensors_t accelerometer_only;
+    accelerometer_only.accelerometer = true;
+    return binaryRecordFrame(first_sample, accelerometer_only, samples, samples_len, buffer, buffer_len);
+}
+
+int sbp_deltaSensorDataPeriodic(
+    const sbp_sensors_t enabled_data, const uint16_t keyframe_interval,
+    const sbp_sensor_data_t *data, uint8_t *buffer, const int buffer_len
+) {
+    static uint16_t packet_id = 0;
+    static uint16_t since_keyframe = 0;
+    static uint8_t previous_mask = 0;
+    static int32_t previous_values[SBP_DELTA_VALUES_MAX] = { };
+
+    static_assert((SBP_DELTA_RECORD_MAX_LEN + 1) < 'R', "Delta record too long");
+    if (buffer_len < SBP_DELTA_FRAME_MAX_LEN) {
         return SBP_ERROR_LEN;
     }
 
-    return serial_data_length;
+    int32_t values[SBP_DELTA_VALUES_MAX];
+    const size_t values_len = sensorDataValues(enabled_data, data, values);
+
+    const bool keyframe = delta_force_keyframe ||
+                          enabled_data.raw != previous_mask ||
+                          since_keyframe >= keyframe_interval;
+    if (keyframe) {
+        delta_force_keyframe = false;
+        since_keyframe = 0;
+        previous_mask = enabled_data.raw;
+        memset(previous_values, 0, sizeof(previous_values));
+    }
+    since_keyframe++;
+
+    uint8_t record[SBP_DELTA_RECORD_MAX_LEN];
+    uint8_t *rec = record;
+
+    *rec++ = keyframe ? 0x01 : 0x00;
+    rec = bufAppendU16(rec, packet_id++);
+    *rec++ = enabled_data.raw;
+    for (size_t i = 0; i < values_len; i++) {
+        // Keyframes are a delta against zero, the subtraction wraps around as unsigned
+        const int32_t delta = (int32_t)((uint32_t)values[i] - (uint32_t)previous_values[i]);
+        rec = bufAppendVarint(rec, zigzagEncode(delta));
+        previous_values[i] = values[i];
+    }
+
+    rec = bufAppendU16(rec, crc16Ccitt(record, rec - record));
+
+    return (int)cobsEncode(record, rec - record, buffer);
+}
+
+int sbp_parserFeed(sbp_cmd_parser_t *parser, const char c, sbp_cmd_t *cmd) {
+    static_assert(SBP_MSG_SEPARATOR_LEN == 1, "The parser expects a single character separator");
+    if (c == SBP_MSG_SEPARATOR[0]) {
+        return sbp_parserEndLine(parser, cmd);
+    }
+    if (parser->state == SBP_PARSER_DISCARD) {
+        return SBP_PARSER_INCOMPLETE;
+    }
+    if (parser->line_len >= SBP_CMD_LINE_MAX_LEN) {
+        return sbp_parserDiscard(parser, SBP_ERROR_LEN);
+    }
+
+    const size_t i = parser->line_len;
+    parser->line[parser->line_len++] = c;
+
+    switch (parser->state) {
+        case SBP_PARSER_MSG_TYPE:
+            // The first character should be the message type, in this case the command type
+            if (c != sbp_msg_type_char[SBP_MSG_COMMAND]) {
+                return sbp_parserDiscard(parser, SBP_ERROR_MSG_TYPE);
+            }
+            parser->state = SBP_PARSER_ID_START;
+            break;
+        case SBP_PARSER_ID_START:
+            if (c != '[') {
+                return sbp_parserDiscard(parser, SBP_ERROR_PROTOCOL_FORMAT);
+            }
+            parser->state = SBP_PARSER_ID;
+            break;
+        case SBP_PARSER_ID:
+            // The characters until ']' (max 8 chars) should be the command ID with a valid hex number
+            if (c == ']') {
+                if (parser->id_len == 0) {
+                    return sbp_parserDiscard(parser, SBP_ERROR_PROTOCOL_FORMAT);
+                }
+                parser->cmd_type_start = i + 1;
+                parser->state = SBP_PARSER_CMD_TYPE;
+            } else if (!isHexChar(c) || parser->id_len >= 8) {
+                return sbp_parserDiscard(parser, SBP_ERROR_PROTOCOL_FORMAT);
+            } else {
+                parser->id_len++;
+            }
+            break;
+        case SBP_PARSER_CMD_TYPE:
+            // The following characters should be the command type, followed by a '['
+            if (c == '[') {
+                parser->type = cmdTypeLookup(&parser->line[parser->cmd_type_start], i - parser->cmd_type_start);
+                if (parser->type == SBP_CMD_TYPE_LEN) {
+                    return sbp_parserDiscard(parser, SBP_ERROR_CMD_TYPE);
+                }
+                parser->value_start = i + 1;
+                parser->state = SBP_PARSER_VALUE;
+            } else if ((i - parser->cmd_type_start) >= CMD_MAX_LEN) {
+                return sbp_parserDiscard(parser, SBP_ERROR_PROTOCOL_FORMAT);
+            }
+            break;
+        case SBP_PARSER_VALUE:
+            if (c == ']') {
+                parser->state = SBP_PARSER_END;
+            }
+            break;
+        case SBP_PARSER_END:
+        default:
+            // Nothing is allowed between the closing ']' and the separator
+            return sbp_parserDiscard(parser, SBP_ERROR_PROTOCOL_FORMAT);
+    }
+    return SBP_PARSER_INCOMPLETE;
+}
+
+int sbp_processParsedCommand(const sbp_cmd_t *cmd, sbp_state_t *protocol_state, char *str_buffer, const size_t str_buffer_len) {
+    return sbp_processCommandResponse(cmd, protocol_state, str_buffer, str_buffer_len);
 }
 
 int sbp_processCommand(const ManagedString& msg, sbp_state_t *protocol_state, char *str_buffer, const size_t str_buffer_len) {
+    sbp_cmd_parser_t parser = { };
     sbp_cmd_t received_cmd = { };
     const char *msg_str = msg.toCharArray();
     const size_t msg_len = msg.length();
 
-    int result = sbp_parseCommand(msg_str, msg_len, &received_cmd);
+    for (size_t i = 0; i < msg_len; i++) {
+        // The message should not contain the separator
+        if (sbp_parserFeed(&parser, msg_str[i], &received_cmd) != SBP_PARSER_INCOMPLETE) {
+            return SBP_ERROR_PROTOCOL_FORMAT;
+        }
+    }
+    int result = sbp_parserFeed(&parser, SBP_MSG_SEPARATOR[0], &received_cmd);
+    if (result == SBP_PARSER_INCOMPLETE) {
+        return SBP_ERROR_MSG_TYPE;
+    }
     if (result != SBP_SUCCESS) {
         return result;
     }
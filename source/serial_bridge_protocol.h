@@ -8,9 +8,13 @@
 /** Default protocol state values */
 #define SBP_DEFAULT_RADIO_FREQ      42
 #define SBP_DEFAULT_SEND_PERIODIC   false
-#define SBP_DEFAULT_PERIODIC_Z      false
+#define SBP_DEFAULT_PERIODIC_MODE   SBP_PERIODIC_MODE_VERBOSE
 #define SBP_DEFAULT_PERIOD_MS       20
 #define SBP_DEFAULT_SENSORS         0
+#define SBP_DEFAULT_DELTA_KEYFRAME  50
+#define SBP_DEFAULT_BATCH_SIZE      1
+#define SBP_DEFAULT_TIMESTAMPS      SBP_TIMESTAMPS_NONE
+#define SBP_DEFAULT_BAUDRATE        115200
 
 /** Internal error codes */
 #define SBP_SUCCESS                 (0)
@@ -23,12 +27,14 @@
 #define SBP_ERROR_CMD_VALUE         (-7)
 #define SBP_ERROR_CMD_REPEATED      (-8)
 #define SBP_ERROR_INTERNAL          (-9)
+#define SBP_ERROR_BUSY              (-10)
 #define SBP_ERROR_NOT_IMPLEMENTED   (-100)
 
 /** External error codes */
 #define SBP_ERROR_CODE_INVALID_VALUE        1
 #define SBP_ERROR_CODE_VALUE_ALREADY_SET    2
 #define SBP_ERROR_CODE_INTERNAL_ERROR       3
+#define SBP_ERROR_CODE_BUSY                 4
 
 #define SBP_MSG_SEPARATOR           "\n"
 #define SBP_MSG_SEPARATOR_LEN       (sizeof(SBP_MSG_SEPARATOR) - 1)
@@ -64,6 +70,22 @@ typedef enum sbp_cmd_type_e {
     SBP_CMD_HWVERSION,
     SBP_CMD_START,
     SBP_CMD_ZSTART,
+    SBP_CMD_BSTART,
+    SBP_CMD_DSTART,
+    SBP_CMD_MSTART,
+    SBP_CMD_DKEY,
+    SBP_CMD_BATCH,
+    SBP_CMD_JITTER,
+    SBP_CMD_TIMESTAMPS,
+    SBP_CMD_CAPTURE,
+    SBP_CMD_BAUD,
+    SBP_CMD_STATS,
+    SBP_CMD_PROFILE,
+    SBP_CMD_RADIO_LOSS,
+    SBP_CMD_RADIO_LOSS_MSG,
+    SBP_CMD_REMOTE_INDEX,
+    SBP_CMD_RADIO_CHANGE,
+    SBP_CMD_RADIO_SLOTS,
     SBP_CMD_STOP,
     SBP_CMD_TYPE_LEN,
 } sbp_cmd_type_t;
@@ -78,6 +100,22 @@ const char* const sbp_cmd_type_str[SBP_CMD_TYPE_LEN] = {
     "HWVER",    // SBP_CMD_HWVERSION
     "START",    // SBP_CMD_START
     "ZSTART",   // SBP_CMD_ZSTART
+    "BSTART",   // SBP_CMD_BSTART
+    "DSTART",   // SBP_CMD_DSTART
+    "MSTART",   // SBP_CMD_MSTART
+    "DKEY",     // SBP_CMD_DKEY
+    "BATCH",    // SBP_CMD_BATCH
+    "JITTER",   // SBP_CMD_JITTER
+    "TS",       // SBP_CMD_TIMESTAMPS
+    "CAP",      // SBP_CMD_CAPTURE
+    "BAUD",     // SBP_CMD_BAUD
+    "STATS",    // SBP_CMD_STATS
+    "PROF",     // SBP_CMD_PROFILE
+    "RLOSS",    // SBP_CMD_RADIO_LOSS
+    "RLMSG",    // SBP_CMD_RADIO_LOSS_MSG
+    "RMBIDX",   // SBP_CMD_REMOTE_INDEX
+    "RCHG",     // SBP_CMD_RADIO_CHANGE
+    "RSLOT",    // SBP_CMD_RADIO_SLOTS
     "STOP",     // SBP_CMD_STOP
 };
 
@@ -85,7 +123,35 @@ const char* const sbp_cmd_type_str[SBP_CMD_TYPE_LEN] = {
 #define SBP_CMD_RADIO_FREQ_MIN      (0)
 #define SBP_CMD_RADIO_FREQ_MAX      (83)
 #define SBP_CMD_PERIOD_MIN          (10)
+#define SBP_CMD_PERIOD_BATCH_MIN    (2)     // Only when batching, without a text stream running
 #define SBP_CMD_PERIOD_MAX          (UINT16_MAX)
+#define SBP_CMD_BATCH_MIN           (1)
+#define SBP_CMD_BATCH_MAX           (32)
+#define SBP_CMD_DELTA_KEYFRAME_MIN  (1)
+#define SBP_CMD_DELTA_KEYFRAME_MAX  (UINT16_MAX)
+#define SBP_CMD_CAPTURE_SAMPLES_MIN (1)
+#define SBP_CMD_CAPTURE_SAMPLES_MAX (1024)
+#define SBP_CMD_CAPTURE_RATE_MIN    (1)
+#define SBP_CMD_CAPTURE_RATE_MAX    (1000)
+#define SBP_CMD_RADIO_DEADBAND_MAX  (2048)
+#define SBP_CMD_RADIO_HEARTBEAT_MIN (20)
+#define SBP_CMD_RADIO_HEARTBEAT_MAX (1000)  // Well within the bridge remote micro:bit timeout
+
+/**
+ * @brief Baud rates accepted by the BAUD command.
+ *
+ * The switch is only accepted after the HS handshake, and while the periodic
+ * messages are stopped. The BAUD command is sent at the current baud rate,
+ * and its response is the last message sent at that rate. The host then
+ * sends the same BAUD command at the new rate to confirm it, if this doesn't
+ * arrive within the timeout the micro:bit goes back to SBP_DEFAULT_BAUDRATE,
+ * and so should the host if it doesn't receive the confirmation response.
+ */
+#define SBP_BAUDRATES_LEN           5
+const uint32_t sbp_baudrates[SBP_BAUDRATES_LEN] = {
+    115200, 230400, 460800, 921600, 1000000,
+};
+#define SBP_BAUD_CONFIRM_TIMEOUT_MS (1000)
 
 /**
  * @brief Structure of function pointers to use as callbacks for each command.
@@ -99,8 +165,47 @@ typedef struct sbp_cmd_callback_s {
     sbp_cmd_callback_t remoteMbId;
     sbp_cmd_callback_t start;
     sbp_cmd_callback_t zstart;
+    sbp_cmd_callback_t bstart;
+    sbp_cmd_callback_t dstart;
+    sbp_cmd_callback_t mstart;
+    sbp_cmd_callback_t timestamps;
+    sbp_cmd_callback_t capture;
+    sbp_cmd_callback_t baudrate;
+    sbp_cmd_callback_t profile;
+    sbp_cmd_callback_t radioLoss;
+    sbp_cmd_callback_t remoteIndex;
+    sbp_cmd_callback_t radioChange;
+    sbp_cmd_callback_t radioSlots;
+    sbp_cmd_callback_t stop;
 } sbp_cmd_callbacks_t;
 
+/**
+ * @brief The formats available to send the periodic sensor data.
+ */
+typedef enum sbp_periodic_mode_e {
+    SBP_PERIODIC_MODE_VERBOSE,      // START command, sbp_sensorDataPeriodicStr()
+    SBP_PERIODIC_MODE_COMPACT,      // ZSTART command, sbp_compactSensorDataPeriodicStr()
+    SBP_PERIODIC_MODE_BINARY,       // BSTART command, sbp_binarySensorDataPeriodic()
+    SBP_PERIODIC_MODE_DELTA,        // DSTART command, sbp_deltaSensorDataPeriodic()
+    SBP_PERIODIC_MODE_MULTI,        // MSTART command, sbp_multiSensorDataPeriodicStr()
+} sbp_periodic_mode_t;
+
+/**
+ * @brief The timestamps added to the verbose and compact periodic messages,
+ * set with the TS command.
+ *
+ * Timestamps are the lower 32 bits of a microsecond clock, so they wrap
+ * around every ~71 minutes. Each value is also the number of timestamps
+ * added to the messages.
+ */
+typedef enum sbp_timestamps_e {
+    SBP_TIMESTAMPS_NONE = 0,
+    // Time the sample was taken, or received via radio in the bridge builds
+    SBP_TIMESTAMPS_LOCAL = 1,
+    // As above, plus the time the remote micro:bit took the sample, in its own clock
+    SBP_TIMESTAMPS_REMOTE = 2,
+} sbp_timestamps_t;
+
 /**
  * @brief All the string literals for the different sensor types and subtypes.
  */
@@ -123,6 +228,9 @@ typedef struct sbp_cmd_callback_s {
 #define SBP_SENSOR_STR_TEMP         "T"
 #define SBP_SENSOR_STR_LIGHT        "L"
 #define SBP_SENSOR_STR_SOUND        "S"
+#define SBP_TIMESTAMP_STR_LOCAL     "TS"
+#define SBP_TIMESTAMP_STR_REMOTE    "TR"
+#define SBP_RADIO_LOSS_STR          "RL"
 
 /**
  * @brief The sensor types do not include the subtypes
@@ -169,6 +277,40 @@ typedef struct sbp_cmd_s {
     size_t value_len;
 } sbp_cmd_t;
 
+/** Longest command line the parser accepts, excluding the separator */
+#define SBP_CMD_LINE_MAX_LEN        64
+
+/** Returned by sbp_parserFeed() while a command line is incomplete */
+#define SBP_PARSER_INCOMPLETE       (1)
+
+typedef enum sbp_parser_state_e {
+    SBP_PARSER_MSG_TYPE = 0,
+    SBP_PARSER_ID_START,
+    SBP_PARSER_ID,
+    SBP_PARSER_CMD_TYPE,
+    SBP_PARSER_VALUE,
+    SBP_PARSER_END,
+    SBP_PARSER_DISCARD,
+} sbp_parser_state_t;
+
+/**
+ * @brief Incremental command parser, fed one byte at a time.
+ *
+ * The command line is validated as it arrives and kept in the parser buffer,
+ * so the parsed sbp_cmd_t points into it without any further copies or heap
+ * allocations. A zero initialised instance is ready to use.
+ */
+typedef struct sbp_cmd_parser_s {
+    sbp_parser_state_t state;
+    int error;
+    sbp_cmd_type_t type;
+    size_t line_len;
+    size_t id_len;
+    size_t cmd_type_start;
+    size_t value_start;
+    char line[SBP_CMD_LINE_MAX_LEN + 1];
+} sbp_cmd_parser_t;
+
 /**
  * @brief Flags to hold which sensors are enabled in the protocol.
  * This might not be portable to other compilers, as how bitfields are packed
@@ -208,24 +350,121 @@ typedef struct sbp_sensor_data_s {
     bool button_p0 = 0;
     bool button_p1 = 0;
     bool button_p2 = 0;
+    uint32_t timestamp_us = 0;          // SBP_TIMESTAMPS_LOCAL
+    uint32_t remote_timestamp_us = 0;   // SBP_TIMESTAMPS_REMOTE
+    uint32_t radio_lost = 0;            // Lost radio packets from the active remote
     bool fresh_data = 0;
 } sbp_sensor_data_t;
 
+/**
+ * @brief Timing of the periodic messages since the last start command,
+ * updated by the periodic scheduler.
+ *
+ * Deadlines are absolute (start + n * period), so the lateness of each
+ * sample from its deadline does not accumulate into drift. Deadlines that
+ * could not be serviced before the following one are counted as missed.
+ */
+typedef struct sbp_periodic_stats_s {
+    uint32_t deadlines;
+    uint32_t missed;
+    uint32_t late_max_us;
+    uint64_t late_sum_us;
+} sbp_periodic_stats_t;
+
+/**
+ * @brief Runtime counters of the main loop and the radio path since the last
+ * start command, read with the STATS command. Only additions and comparisons,
+ * so they are always enabled.
+ *
+ * The slack is the idle time left before each periodic deadline, after the
+ * last command or message before it, zero when the main loop is late.
+ */
+typedef struct sbp_runtime_stats_s {
+    uint32_t stale;             // Deadlines without fresh data
+    uint32_t slack_min_us;
+    uint64_t slack_sum_us;
+    uint32_t commands;
+    uint32_t serial_tx_bytes;
+    uint32_t radio_received;    // Each sample of a multi-sample packet counts once
+    uint32_t radio_accepted;    // Sensor data from the active remote micro:bit
+    uint32_t radio_ignored;
+    uint32_t messages;          // Periodic messages sent
+    uint32_t encode_us;         // Time spent encoding the periodic messages
+} sbp_runtime_stats_t;
+
+/**
+ * @brief Latency histogram of a profiled stage, read with the PROF command.
+ *
+ * Bucket 0 counts the durations under 128 ns, and each bucket i after it
+ * from 64 * 2^i ns up to double that, with the last bucket also counting
+ * anything longer. The bucket counts saturate at UINT16_MAX.
+ */
+#define SBP_HISTOGRAM_BUCKETS       16
+typedef struct sbp_histogram_s {
+    uint32_t count;
+    uint32_t max_ns;
+    uint64_t sum_ns;
+    uint16_t buckets[SBP_HISTOGRAM_BUCKETS];
+} sbp_histogram_t;
+
+/**
+ * @brief Sequence counters of the radio packets from a remote micro:bit,
+ * read with the RLOSS command.
+ *
+ * A gap in the packet IDs is counted as lost packets, and the ones that
+ * arrive later are counted as reordered instead.
+ */
+typedef struct sbp_radio_loss_s {
+    uint32_t received;
+    uint32_t lost;
+    uint32_t duplicated;
+    uint32_t reordered;
+} sbp_radio_loss_t;
+
 /**
  * @brief Structure to hold the state of the protocol data.
  */
  typedef struct sbp_state_s {
     bool send_periodic;
-    bool periodic_compact;
+    sbp_periodic_mode_t periodic_mode;
     uint8_t radio_frequency;
     uint32_t remote_id;
     const uint32_t id;
     uint16_t period_ms;
+    uint16_t delta_keyframe_interval;
+    uint8_t batch_size;
     const uint8_t hw_version;
     const char *sw_version;
     sbp_sensors_t sensors;
+    sbp_periodic_stats_t periodic_stats;
+    sbp_timestamps_t timestamps;
+    uint16_t capture_samples;
+    uint16_t capture_rate_hz;
+    uint32_t baudrate;
+    // Set by the first HS command, the baud rate can only be switched after it
+    bool handshake;
+    sbp_runtime_stats_t runtime_stats;
+    uint32_t profile_stage;
+    sbp_histogram_t profile;
+    bool radio_loss_msg;
+    uint32_t radio_loss_id;
+    sbp_radio_loss_t radio_loss;
+    uint8_t remote_index;
+    uint32_t remote_index_id;
+    uint16_t radio_deadband_mg;
+    uint16_t radio_heartbeat_ms;
+    bool radio_slots;
 } sbp_state_t;
 
+/**
+ * @brief Worst case length, including the null terminator, of the verbose
+ * and compact periodic messages with all sensors, both timestamps and the
+ * radio loss enabled.
+ */
+#define SBP_VERBOSE_STR_MAX_LEN     216
+#define SBP_COMPACT_STR_MAX_LEN     54
+#define SBP_MULTI_STR_MAX_LEN       (SBP_COMPACT_STR_MAX_LEN + 2)
+
 /**
  * @brief Initialises the protocol data structures.
  *
@@ -238,38 +477,263 @@ typedef struct sbp_sensor_data_s {
 int sbp_init(sbp_cmd_callbacks_t *cmd_callbacks, sbp_state_t *protocol_state);
 
 /**
- * @brief Converts sensor data to a protocol serial string representation.
+ * @brief Selects the sensors included by the verbose, compact and multi
+ * periodic message functions.
  *
- * This function converts the enabled sensor into a serial string
- * representation ready to be sent.
+ * The START, ZSTART and MSTART commands select their sensors, so this only
+ * needs to be called to encode messages without a start command.
  *
  * @param enabled_data The configuration of the enabled/disabled sensor data.
+ */
+void sbp_selectPeriodicEncoders(const sbp_sensors_t enabled_data);
+
+/**
+ * @brief Converts sensor data to a protocol serial string representation.
+ *
+ * This function converts the sensors enabled by the last start command, or
+ * sbp_selectPeriodicEncoders(), into a serial string representation ready
+ * to be sent.
+ *
+ * When enabled, the timestamps are added after the message ID, in decimal
+ * microseconds, as "TS[...]" and "TR[...]" for the remote capture time.
+ * After them the radio loss, the running count of lost radio packets from
+ * the active remote micro:bit, is added as "RL[...]".
+ *
  * @param data The actual sensor data.
  * @param str_buffer The buffer to store the serial string representation.
  * @param str_buffer_len The length of the buffer.
+ * @param timestamps The timestamps to include in the message.
+ * @param radio_loss Set to include the radio loss in the message.
  * @return The number of characters written to the buffer, excluding the
  *         null terminator, or a negative number if an error occurred.
  */
-int sbp_sensorDataPeriodicStr(const sbp_sensors_t enabled_data,
-                              const sbp_sensor_data_t *data,
+int sbp_sensorDataPeriodicStr(const sbp_sensor_data_t *data,
                               char *str_buffer,
-                              int str_buffer_len);
+                              int str_buffer_len,
+                              const sbp_timestamps_t timestamps = SBP_TIMESTAMPS_NONE,
+                              const bool radio_loss = false);
 
 /**
  * @brief Converts sensor data to a protocol serial string with the compact
  * format.
  *
- * @param enabled_data The configuration of the enabled/disabled sensor data.
+ * The compact format starts with "P" and a 2 hex digit message ID, then
+ * 8 hex digits for each enabled timestamp (local first, then remote),
+ * followed by a fixed number of uppercase hex digits for each sensor
+ * enabled by the last start command, in the same order as sbp_sensor_type_t:
+ *   - Accelerometer: 3 digits per axis, value + 2048, clamped to -2048 to
+ *                    2047 milli-g
+ *   - Magnetometer:  5 digits per axis, value + 0x80000, clamped to
+ *                    -524288 to 524287 nT, about 10 times the Earth's
+ *                    field, so a stronger field (e.g. from a magnet) reads
+ *                    as the limit
+ *   - Buttons: 1 digit, bit 0 = A, bit 1 = B
+ *   - Logo: 1 digit, 0 or 1
+ *   - Pins: 1 digit, bit 0 = P0, bit 1 = P1, bit 2 = P2
+ *   - Temperature: 2 digits, value + 128, clamped to -128 to 127
+ *   - Light level: 2 digits, 0 to 255
+ *   - Sound level: 2 digits, clamped to 0 to 255
+ *
+ * The header and every sensor take fewer characters than their shortest
+ * verbose representation, except the magnetometer, which takes the same as
+ * "MX[0]MY[0]MZ[0]". So the compact message is always shorter than the
+ * verbose one with the same sensors, as long as its timestamps are 1000 us
+ * or more. A compact timestamp is always 8 digits, up to 3 more than a
+ * verbose one under 1000 us, right after the microsecond clock wraps.
+ *
  * @param data The actual sensor data.
  * @param str_buffer The buffer to store the serial string representation.
  * @param str_buffer_len The length of the buffer.
+ * @param timestamps The timestamps to include in the message.
  * @return The number of characters written to the buffer, excluding the
  *        null terminator, or a negative number if an error occurred.
  */
-int sbp_compactSensorDataPeriodicStr(const sbp_sensors_t enabled_data,
-                                     const sbp_sensor_data_t *data,
+int sbp_compactSensorDataPeriodicStr(const sbp_sensor_data_t *data,
                                      char *str_buffer,
-                                     int str_buffer_len);
+                                     int str_buffer_len,
+                                     const sbp_timestamps_t timestamps = SBP_TIMESTAMPS_NONE);
+
+/**
+ * @brief Converts the sensor data of a remote micro:bit to a protocol serial
+ * string with the multi remote format, used by the bridge to send the data
+ * from all the remote micro:bits it hears.
+ *
+ * It's the compact format, with a 2 hex digit remote index after the
+ * message ID. The micro:bit ID of each index is read with the RMBIDX
+ * command, and an index is only reused for a different remote micro:bit
+ * after the previous one has not been heard for a few seconds, or when the
+ * RMBID command sets a new remote micro:bit while all of them are taken.
+ * Until then the new remote micro:bits heard are left out.
+ *
+ * @param data The actual sensor data.
+ * @param remote_index The index of the remote micro:bit.
+ * @param str_buffer The buffer to store the serial string representation.
+ * @param str_buffer_len The length of the buffer.
+ * @param timestamps The timestamps to include in the message.
+ * @return The number of characters written to the buffer, excluding the
+ *        null terminator, or a negative number if an error occurred.
+ */
+int sbp_multiSensorDataPeriodicStr(const sbp_sensor_data_t *data,
+                                   const uint8_t remote_index,
+                                   char *str_buffer,
+                                   int str_buffer_len,
+                                   const sbp_timestamps_t timestamps = SBP_TIMESTAMPS_NONE);
+
+/**
+ * @brief Binary periodic frame sizes.
+ *
+ * The record before framing is:
+ *   - uint16_t sequence number of the first sample, it increases by the
+ *              number of samples in each record
+ *   - uint8_t  sensor mask, same bit order as sbp_sensors_t
+ *   - uint8_t  number of samples in the record, more than one when the
+ *              BATCH command is used
+ *   - For each sample, the values of each enabled sensor, little-endian and
+ *     in the same order as sbp_sensor_type_t:
+ *       - Accelerometer: int16_t x, y, z
+ *       - Magnetometer:  int32_t x, y, z
+ *       - Buttons, logo and pins: a single uint8_t shared by all of them,
+ *         bit 0 = A, 1 = B, 2 = logo, 3 = P0, 4 = P1, 5 = P2
+ *       - Temperature: int8_t
+ *       - Light level: uint8_t
+ *       - Sound level: uint8_t
+ *   - uint16_t CRC-16/CCITT-FALSE of all the previous bytes
+ *
+ * The record is then COBS encoded and terminated with a 0x00 byte.
+ * As the records are always shorter than 0x51 bytes, the first byte of a
+ * frame is never an 'R', so the host can tell it apart from command
+ * responses, which always start with 'R' and end with a new line.
+ */
+#define SBP_BINARY_HEADER_LEN       (2 + 1 + 1)
+#define SBP_BINARY_SAMPLE_MAX_LEN   ((3 * 2) + (3 * 4) + 1 + 1 + 1 + 1)
+#define SBP_BINARY_RECORD_MAX_LEN   (80)
+#define SBP_BINARY_FRAME_MAX_LEN    (1 + SBP_BINARY_RECORD_MAX_LEN + 1)
+
+/**
+ * @brief Calculates how many samples fit in a single binary periodic
+ * message for the enabled sensors.
+ *
+ * @param enabled_data The configuration of the enabled/disabled sensor data.
+ * @return The maximum number of samples, always at least 1.
+ */
+size_t sbp_binaryMaxSamples(const sbp_sensors_t enabled_data);
+
+/**
+ * @brief Converts one or more sensor data samples to a COBS framed binary
+ * periodic message.
+ *
+ * @param enabled_data The configuration of the enabled/disabled sensor data.
+ * @param samples The sensor data samples, oldest first.
+ * @param samples_len Number of samples, up to sbp_binaryMaxSamples().
+ * @param buffer The buffer to store the binary frame, including the 0x00
+ *               frame delimiter.
+ * @param buffer_len The length of the buffer.
+ * @return The number of bytes written to the buffer, or a negative number if
+ *         an error occurred.
+ */
+int sbp_binarySensorDataPeriodic(const sbp_sensors_t enabled_data,
+                                 const sbp_sensor_data_t *samples,
+                                 size_t samples_len,
+                                 uint8_t *buffer,
+                                 int buffer_len);
+
+/**
+ * @brief Delta periodic frame sizes.
+ *
+ * Uses the same COBS framing and CRC as the binary format, and only one
+ * sample per record. The record before framing is:
+ *   - uint8_t  flags, bit 0 set for a keyframe
+ *   - uint16_t sequence number
+ *   - uint8_t  sensor mask, same bit order as sbp_sensors_t
+ *   - A zigzag encoded varint (LEB128) for each value of the enabled
+ *     sensors, in the same order and grouping as the binary format
+ *     (all buttons, logo and pins are a single value with the same bits).
+ *     In a keyframe these are the absolute values, otherwise they are the
+ *     difference with the previous record, modulo 2^32.
+ *   - uint16_t CRC-16/CCITT-FALSE of all the previous bytes
+ *
+ * A keyframe is sent every delta_keyframe_interval records, when the sensor
+ * mask changes, and after the DSTART or DKEY commands. To resync after a
+ * dropped or corrupted frame (a gap in the sequence number or a CRC error),
+ * the host must discard the delta records until the next keyframe, and can
+ * send DKEY[] to request one straight away.
+ */
+#define SBP_DELTA_VALUES_MAX        (3 + 3 + 1 + 1 + 1 + 1)
+#define SBP_DELTA_RECORD_MAX_LEN    (1 + 2 + 1 + (SBP_DELTA_VALUES_MAX * 5) + 2)
+#define SBP_DELTA_FRAME_MAX_LEN     (1 + SBP_DELTA_RECORD_MAX_LEN + 1)
+
+/**
+ * @brief Converts sensor data to a COBS framed delta periodic message.
+ *
+ * @param enabled_data The configuration of the enabled/disabled sensor data.
+ * @param keyframe_interval Number of records between keyframes.
+ * @param data The actual sensor data.
+ * @param buffer The buffer to store the binary frame, including the 0x00
+ *               frame delimiter.
+ * @param buffer_len The length of the buffer.
+ * @return The number of bytes written to the buffer, or a negative number if
+ *         an error occurred.
+ */
+int sbp_deltaSensorDataPeriodic(const sbp_sensors_t enabled_data,
+                                const uint16_t keyframe_interval,
+                                const sbp_sensor_data_t *data,
+                                uint8_t *buffer,
+                                int buffer_len);
+
+/**
+ * @brief Converts accelerometer samples from a burst capture (CAP command)
+ * to a COBS framed binary message for the capture dump.
+ *
+ * The frames use the binary periodic format with only the accelerometer in
+ * the sensor mask, but the sequence number is the index of the first sample
+ * in the capture. The periodic messages can't run during a capture, so the
+ * host reads binary frames after the CAP response until it has all the
+ * requested samples.
+ *
+ * @param first_sample Index in the capture of the first sample.
+ * @param samples The sensor data samples, oldest first.
+ * @param samples_len Number of samples, up to sbp_binaryMaxSamples() with
+ *                    only the accelerometer enabled.
+ * @param buffer The buffer to store the binary frame, including the 0x00
+ *               frame delimiter.
+ * @param buffer_len The length of the buffer.
+ * @return The number of bytes written to the buffer, or a negative number if
+ *         an error occurred.
+ */
+int sbp_binaryCaptureData(const uint16_t first_sample,
+                          const sbp_sensor_data_t *samples,
+                          size_t samples_len,
+                          uint8_t *buffer,
+                          int buffer_len);
+
+/**
+ * @brief Feeds a received byte into the command parser.
+ *
+ * Errors in the command line are only reported when its separator arrives,
+ * so every line produces a single result, and the parser is then ready for
+ * the next line. Empty lines are ignored.
+ *
+ * @param parser The parser instance.
+ * @param c The received byte.
+ * @param cmd Populated when a command line is complete, it points into the
+ *            parser buffer and is valid until the next byte is fed.
+ * @return SBP_PARSER_INCOMPLETE until the end of a line, then SBP_SUCCESS if
+ *         cmd has been populated, or a negative error code.
+ */
+int sbp_parserFeed(sbp_cmd_parser_t *parser, const char c, sbp_cmd_t *cmd);
+
+/**
+ * @brief Processes a command parsed by sbp_parserFeed() and prepares the
+ * response to send back.
+ *
+ * @param cmd The parsed command.
+ * @param protocol_state The protocol state, updated by the command.
+ * @param str_buffer Buffer to store the response.
+ * @param str_buffer_len Length of the buffer to store the response.
+ * @return int The number of characters written to the buffer, excluding the
+ *        null terminator, or a negative number if an error occurred.
+ */
+int sbp_processParsedCommand(const sbp_cmd_t *cmd, sbp_state_t *protocol_state, char *str_buffer, const size_t str_buffer_len);
 
 /**
  * @brief Processes a command message, identifies it, and prepares the
@@ -0,0 +1,33 @@
+/**
+ * @brief Minimal stand-in for the CODAL ManagedString, to be able to build
+ * the firmware code on the host computer.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+class ManagedString {
+    char *data;
+    int16_t len;
+
+public:
+    ManagedString(const char *str = "") {
+        len = (int16_t)strlen(str);
+        data = new char[len + 1];
+        memcpy(data, str, len + 1);
+    }
+    ManagedString(const ManagedString &s) : ManagedString(s.data) { }
+    ~ManagedString() { delete[] data; }
+    ManagedString& operator=(const ManagedString &s) {
+        if (this != &s) {
+            delete[] data;
+            len = s.len;
+            data = new char[len + 1];
+            memcpy(data, s.data, len + 1);
+        }
+        return *this;
+    }
+    int16_t length() const { return len; }
+    const char *toCharArray() const { return data; }
+};
@@ -0,0 +1,10 @@
+/**
+ * @brief Minimal stand-in for the CODAL MicroBit.h header, to be able to
+ * build the serial bridge protocol code on the host computer.
+ *
+ * Only provides what serial_bridge_protocol.h uses from CODAL, the simulator
+ * in the sim directory provides a full replacement.
+ */
+#pragma once
+
+#include "ManagedString.h"
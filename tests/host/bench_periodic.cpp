@@ -0,0 +1,186 @@
+/**
+ * @brief Host benchmark for the periodic message encoder.
+ *
+ * Checks sbp_sensorDataPeriodicStr() produces the same output as the
+ * original snprintf based implementation for every sensor mask, and prints
+ * the cycles per message for both. Also checks the compact messages are
+ * shorter than the shortest verbose ones, for every sensor mask.
+ *
+ * Built by the CMake project in this directory.
+ *
+ * Usage: bench_periodic [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "serial_bridge_protocol.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+#define CYCLES_UNIT "cycles"
+#else
+static inline uint64_t cycles() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#define CYCLES_UNIT "ns"
+#endif
+
+static const int DEFAULT_ITERATIONS = 20000;
+static const int SAMPLES = 64;
+
+/**
+ * @brief Reference encoder, the snprintf chain this benchmark compares with.
+ */
+static int referencePeriodicStr(uint32_t packet_id, const sbp_sensors_t s, const sbp_sensor_data_t *d,
+                                char *buf, const int buf_len) {
+    int len = snprintf(buf, buf_len, "P[%X]", (unsigned int)packet_id);
+    if (s.accelerometer) len += snprintf(buf + len, buf_len - len, "AX[%d]AY[%d]AZ[%d]",
+                                         d->accelerometer_x, d->accelerometer_y, d->accelerometer_z);
+    if (s.magnetometer) len += snprintf(buf + len, buf_len - len, "MX[%d]MY[%d]MZ[%d]",
+                                        d->magnetometer_x, d->magnetometer_y, d->magnetometer_z);
+    if (s.buttons) len += snprintf(buf + len, buf_len - len, "BA[%d]BB[%d]", d->button_a, d->button_b);
+    if (s.button_logo) len += snprintf(buf + len, buf_len - len, "F[%d]", d->button_logo);
+    if (s.button_pins) len += snprintf(buf + len, buf_len - len, "P0[%d]P1[%d]P2[%d]",
+                                       d->button_p0, d->button_p1, d->button_p2);
+    if (s.temperature) len += snprintf(buf + len, buf_len - len, "T[%d]", d->temperature);
+    if (s.light_level) len += snprintf(buf + len, buf_len - len, "L[%d]", d->light_level);
+    if (s.sound_level) len += snprintf(buf + len, buf_len - len, "S[%d]", d->sound_level);
+    len += snprintf(buf + len, buf_len - len, "\n");
+    return len;
+}
+
+/**
+ * @brief Length of the shortest verbose message with the same sensors and
+ * timestamps, with a single digit message ID and the shortest values.
+ */
+static int verboseMinLen(const sbp_timestamps_t timestamps, const uint32_t timestamp_us, char *buf, const int buf_len) {
+    sbp_sensor_data_t d = { };
+    d.timestamp_us = timestamp_us;
+    d.remote_timestamp_us = timestamp_us;
+    const int len = sbp_sensorDataPeriodicStr(&d, buf, buf_len, timestamps);
+    const int id_len = (int)(strchr(buf, ']') - buf) - 2;
+    return len - (id_len - 1);
+}
+
+/**
+ * @brief Checks the compact messages are shorter than the verbose ones with
+ * the same sensors and any values, with the timestamps of 1000 us or more,
+ * and that the compact timestamps add at most COMPACT_TIMESTAMP_EXTRA_LEN
+ * characters each over the shortest verbose ones.
+ *
+ * @return True if the compact messages are never longer than documented.
+ */
+static bool checkCompactLen(char *buffer, const int buffer_len) {
+    static const int COMPACT_TIMESTAMP_EXTRA_LEN = 3;
+    sbp_sensor_data_t d = { };
+    for (int mask = 0; mask < 256; mask++) {
+        sbp_sensors_t sensors;
+        sensors.raw = (uint8_t)mask;
+        sbp_selectPeriodicEncoders(sensors);
+        for (int ts = SBP_TIMESTAMPS_NONE; ts <= SBP_TIMESTAMPS_REMOTE; ts++) {
+            const sbp_timestamps_t timestamps = (sbp_timestamps_t)ts;
+            const int compact_len = sbp_compactSensorDataPeriodicStr(&d, buffer, buffer_len, timestamps);
+            const int verbose_len = verboseMinLen(timestamps, 1000, buffer, buffer_len);
+            const int verbose_short_ts_len = verboseMinLen(timestamps, 0, buffer, buffer_len);
+            if (compact_len >= verbose_len || compact_len > verbose_short_ts_len + (ts * COMPACT_TIMESTAMP_EXTRA_LEN)) {
+                printf("Mask 0x%02X with %d timestamps: compact %d, verbose %d (%d with 1 digit timestamps)\n",
+                       mask, ts, compact_len, verbose_len, verbose_short_ts_len);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void randomSensorData(sbp_sensor_data_t *d) {
+    d->accelerometer_x = (rand() % 4096) - 2048;
+    d->accelerometer_y = (rand() % 4096) - 2048;
+    d->accelerometer_z = (rand() % 4096) - 2048;
+    d->magnetometer_x = (rand() % 100000) - 50000;
+    d->magnetometer_y = (rand() % 100000) - 50000;
+    d->magnetometer_z = (rand() % 100000) - 50000;
+    d->temperature = (rand() % 100) - 20;
+    d->light_level = rand() % 256;
+    d->sound_level = rand() % 256;
+    d->button_a = rand() % 2;
+    d->button_b = rand() % 2;
+    d->button_logo = rand() % 2;
+    d->button_p0 = rand() % 2;
+    d->button_p1 = rand() % 2;
+    d->button_p2 = rand() % 2;
+}
+
+int main(int argc, char **argv) {
+    const int iterations = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    if (iterations < 1) {
+        printf("Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    const int buffer_len = 129;
+    char buffer[buffer_len];
+    char expected[buffer_len];
+    uint32_t packet_id = 0;
+
+    sbp_sensor_data_t data[SAMPLES];
+    for (int i = 0; i < SAMPLES; i++) {
+        randomSensorData(&data[i]);
+    }
+
+    // Verify the output is byte-identical to the reference, including extreme values
+    for (int mask = 0; mask < 256; mask++) {
+        sbp_sensors_t sensors;
+        sensors.raw = (uint8_t)mask;
+        sbp_selectPeriodicEncoders(sensors);
+        for (int i = 0; i < SAMPLES; i++) {
+            sbp_sensor_data_t d = data[i];
+            if (i == 0) {
+                d.accelerometer_x = -2147483647 - 1;
+                d.magnetometer_y = -2147483647 - 1;
+                d.temperature = 2147483647;
+            }
+            int expected_len = referencePeriodicStr(packet_id++, sensors, &d, expected, buffer_len);
+            int len = sbp_sensorDataPeriodicStr(&d, buffer, buffer_len);
+            if (expected_len >= buffer_len) {
+                if (len != SBP_ERROR_LEN) {
+                    printf("Mask 0x%02X: expected SBP_ERROR_LEN, got %d\n", mask, len);
+                    return 1;
+                }
+            } else if (len != expected_len || memcmp(buffer, expected, len + 1) != 0) {
+                printf("Mask 0x%02X mismatch:\n  expected: %s  got:      %s", mask, expected, buffer);
+                return 1;
+            }
+        }
+    }
+    printf("Output matches the snprintf reference for all 256 sensor masks.\n");
+
+    if (!checkCompactLen(buffer, buffer_len)) return 1;
+    printf("Compact messages are shorter than the verbose ones for all 256 sensor masks.\n\n");
+
+    printf("mask  bytes  encoder (%s/msg)  snprintf (%s/msg)\n", CYCLES_UNIT, CYCLES_UNIT);
+    for (int mask = 0; mask < 256; mask++) {
+        sbp_sensors_t sensors;
+        sensors.raw = (uint8_t)mask;
+        sbp_selectPeriodicEncoders(sensors);
+        int len = 0;
+
+        uint64_t start = cycles();
+        for (int i = 0; i < iterations; i++) {
+            len = sbp_sensorDataPeriodicStr(&data[i % SAMPLES], buffer, buffer_len);
+        }
+        uint64_t encoder_cycles = (cycles() - start) / iterations;
+
+        start = cycles();
+        for (int i = 0; i < iterations; i++) {
+            referencePeriodicStr(i, sensors, &data[i % SAMPLES], expected, buffer_len);
+        }
+        uint64_t reference_cycles = (cycles() - start) / iterations;
+
+        printf("0x%02X  %5d  %19llu  %20llu\n", mask, len,
+               (unsigned long long)encoder_cycles, (unsigned long long)reference_cycles);
+    }
+
+    return 0;
+}
@@ -0,0 +1,289 @@
+/**
+ * @brief Host benchmark for the serial bridge protocol.
+ *
+ * Measures sbp_processCommand() and the parser path used by the firmware
+ * for a set of commands, and every periodic message encoder for all the
+ * sensor masks, reporting ns/op and bytes/op.
+ * It fails if a command or an encoder returns an error or a message longer
+ * than the maximum length documented in serial_bridge_protocol.h.
+ *
+ * Usage: bench_protocol [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "serial_bridge_protocol.h"
+
+static const int DEFAULT_ITERATIONS = 20000;
+static const int SAMPLES = 64;
+static const int BUFFER_LEN = 161;
+
+static int callbackSuccess(sbp_state_t *) { return SBP_SUCCESS; }
+
+static sbp_state_t protocol_state = {
+    .send_periodic = false,
+    .periodic_mode = SBP_DEFAULT_PERIODIC_MODE,
+    .radio_frequency = SBP_DEFAULT_RADIO_FREQ,
+    .remote_id = 0,
+    .id = 0x12345678,
+    .period_ms = SBP_DEFAULT_PERIOD_MS,
+    .delta_keyframe_interval = SBP_DEFAULT_DELTA_KEYFRAME,
+    .batch_size = SBP_DEFAULT_BATCH_SIZE,
+    .hw_version = 2,
+    .sw_version = "0.3.0",
+    .sensors = { },
+    .periodic_stats = { },
+    .timestamps = SBP_DEFAULT_TIMESTAMPS,
+    .capture_samples = 0,
+    .capture_rate_hz = 0,
+    .baudrate = SBP_DEFAULT_BAUDRATE,
+    .handshake = false,
+    .runtime_stats = { },
+    .profile_stage = 0,
+    .profile = { },
+    .radio_loss_msg = false,
+    .radio_loss_id = 0,
+    .radio_loss = { },
+    .remote_index = 0,
+    .remote_index_id = 0,
+    .radio_deadband_mg = 0,
+    .radio_heartbeat_ms = 0,
+    .radio_slots = false,
+};
+
+static const char *const COMMANDS[] = {
+    "C[1]HS[]",
+    "C[12345678]RF[]",
+    "C[ABCD]RF[42]",
+    "C[1A]RMBID[]",
+    "C[2B]MBID[]",
+    "C[3C]PER[20]",
+    "C[4D]SWVER[]",
+    "C[5E]HWVER[]",
+    "C[6F]START[AB]",
+    "C[70]ZSTART[PABFMLTS]",
+    "C[81]BATCH[]",
+    "C[92]DKEY[50]",
+    "C[93]TS[2]",
+    "C[A3]STOP[]",
+    "C[B4]CAP[256,400]",
+    "C[C5]BAUD[921600]",
+    "C[D6]STATS[]",
+    "C[E7]PROF[1]",
+    "C[F8]RLOSS[]",
+    "C[F9]RLMSG[]",
+    "C[FA]RMBIDX[0]",
+    "C[FB]RCHG[]",
+    "C[FC]RSLOT[]",
+};
+
+typedef int (*bench_encoder_t)(const sbp_sensors_t sensors, const sbp_sensor_data_t *data, char *buffer);
+
+static int benchVerbose(const sbp_sensors_t, const sbp_sensor_data_t *data, char *buffer) {
+    return sbp_sensorDataPeriodicStr(data, buffer, BUFFER_LEN);
+}
+
+static int benchCompact(const sbp_sensors_t, const sbp_sensor_data_t *data, char *buffer) {
+    return sbp_compactSensorDataPeriodicStr(data, buffer, BUFFER_LEN);
+}
+
+static int benchVerboseTs(const sbp_sensors_t, const sbp_sensor_data_t *data, char *buffer) {
+    return sbp_sensorDataPeriodicStr(data, buffer, BUFFER_LEN, SBP_TIMESTAMPS_REMOTE);
+}
+
+static int benchCompactTs(const sbp_sensors_t, const sbp_sensor_data_t *data, char *buffer) {
+    return sbp_compactSensorDataPeriodicStr(data, buffer, BUFFER_LEN, SBP_TIMESTAMPS_REMOTE);
+}
+
+static int benchMulti(const sbp_sensors_t, const sbp_sensor_data_t *data, char *buffer) {
+    return sbp_multiSensorDataPeriodicStr(data, 7, buffer, BUFFER_LEN);
+}
+
+static int benchBinary(const sbp_sensors_t sensors, const sbp_sensor_data_t *data, char *buffer) {
+    return sbp_binarySensorDataPeriodic(sensors, data, 1, (uint8_t *)buffer, BUFFER_LEN);
+}
+
+static int benchDelta(const sbp_sensors_t sensors, const sbp_sensor_data_t *data, char *buffer) {
+    return sbp_deltaSensorDataPeriodic(sensors, SBP_DEFAULT_DELTA_KEYFRAME, data, (uint8_t *)buffer, BUFFER_LEN);
+}
+
+static const struct {
+    const char *name;
+    bench_encoder_t encode;
+    int max_len;
+} ENCODERS[] = {
+    { "verbose", benchVerbose, SBP_VERBOSE_STR_MAX_LEN },
+    { "compact", benchCompact, SBP_COMPACT_STR_MAX_LEN },
+    { "verbose+ts", benchVerboseTs, SBP_VERBOSE_STR_MAX_LEN },
+    { "compact+ts", benchCompactTs, SBP_COMPACT_STR_MAX_LEN },
+    { "multi", benchMulti, SBP_MULTI_STR_MAX_LEN },
+    { "binary", benchBinary, SBP_BINARY_FRAME_MAX_LEN },
+    { "delta", benchDelta, SBP_DELTA_FRAME_MAX_LEN },
+};
+static const int ENCODERS_LEN = sizeof(ENCODERS) / sizeof(ENCODERS[0]);
+
+static inline uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Sensor data with small changes between samples, like real sensors,
+ * so that the delta encoder is measured with typical deltas.
+ */
+static void sensorDataWalk(sbp_sensor_data_t *data, const int samples) {
+    sbp_sensor_data_t d;
+    d.accelerometer_x = -120;
+    d.accelerometer_y = 340;
+    d.accelerometer_z = -1010;
+    d.magnetometer_x = 25000;
+    d.magnetometer_y = -18000;
+    d.magnetometer_z = 40000;
+    d.temperature = 23;
+    d.light_level = 80;
+    d.sound_level = 40;
+    for (int i = 0; i < samples; i++) {
+        d.accelerometer_x += (rand() % 41) - 20;
+        d.accelerometer_y += (rand() % 41) - 20;
+        d.accelerometer_z += (rand() % 41) - 20;
+        d.magnetometer_x += (rand() % 201) - 100;
+        d.magnetometer_y += (rand() % 201) - 100;
+        d.magnetometer_z += (rand() % 201) - 100;
+        d.light_level = (d.light_level + (rand() % 3) - 1) & 0xFF;
+        d.sound_level = rand() % 256;
+        d.button_a = (i / 16) % 2;
+        d.button_b = (i / 8) % 2;
+        d.button_logo = (i / 32) % 2;
+        d.button_p0 = (i / 4) % 2;
+        // Close to the 32 bit wrap around, for the longest timestamps
+        d.timestamp_us = 4294000000u + (i * 20000u);
+        d.remote_timestamp_us = d.timestamp_us - 3500u;
+        data[i] = d;
+    }
+}
+
+static bool benchCommands(const int iterations) {
+    char buffer[BUFFER_LEN];
+    bool success = true;
+
+    printf("%-22s  %10s  %10s  %10s\n", "command", "ns/op", "parser ns", "bytes/op");
+    for (const char *command : COMMANDS) {
+        const ManagedString msg(command);
+        const size_t command_len = strlen(command);
+        int len = 0;
+
+        uint64_t start = nowNs();
+        for (int i = 0; i < iterations; i++) {
+            len = sbp_processCommand(msg, &protocol_state, buffer, BUFFER_LEN);
+        }
+        const double process_ns = (double)(nowNs() - start) / iterations;
+
+        // The firmware path, feeding the parser byte by byte
+        sbp_cmd_parser_t parser = { };
+        int parser_len = 0;
+        start = nowNs();
+        for (int i = 0; i < iterations; i++) {
+            sbp_cmd_t cmd;
+            for (size_t j = 0; j < command_len; j++) {
+                sbp_parserFeed(&parser, command[j], &cmd);
+            }
+            if (sbp_parserFeed(&parser, SBP_MSG_SEPARATOR[0], &cmd) == SBP_SUCCESS) {
+                parser_len = sbp_processParsedCommand(&cmd, &protocol_state, buffer, BUFFER_LEN);
+            }
+        }
+        const double parser_ns = (double)(nowNs() - start) / iterations;
+
+        printf("%-22s  %10.1f  %10.1f  %10d\n", command, process_ns, parser_ns, len);
+        if (len < 1 || parser_len != len || buffer[0] != sbp_msg_type_char[SBP_MSG_RESPONSE]) {
+            printf("  FAILED: %d, %d, %s\n", len, parser_len, buffer);
+            success = false;
+        }
+    }
+    return success;
+}
+
+static bool benchEncoders(const int iterations) {
+    char buffer[BUFFER_LEN];
+    sbp_sensor_data_t data[SAMPLES];
+    sensorDataWalk(data, SAMPLES);
+
+    double total_ns[ENCODERS_LEN] = { };
+    double total_bytes[ENCODERS_LEN] = { };
+    bool success = true;
+
+    printf("\nmask");
+    for (int e = 0; e < ENCODERS_LEN; e++) {
+        printf("  %10s ns  bytes", ENCODERS[e].name);
+    }
+    printf("\n");
+
+    for (int mask = 0; mask < 256; mask++) {
+        sbp_sensors_t sensors;
+        sensors.raw = (uint8_t)mask;
+        sbp_selectPeriodicEncoders(sensors);
+        printf("0x%02X", mask);
+
+        for (int e = 0; e < ENCODERS_LEN; e++) {
+            uint64_t bytes = 0;
+            const uint64_t start = nowNs();
+            for (int i = 0; i < iterations; i++) {
+                const int len = ENCODERS[e].encode(sensors, &data[i % SAMPLES], buffer);
+                if (len < 1 || len > ENCODERS[e].max_len) {
+                    printf("\n  FAILED: %s encoder returned %d for mask 0x%02X\n", ENCODERS[e].name, len, mask);
+                    success = false;
+                    break;
+                }
+                bytes += len;
+            }
+            const double ns = (double)(nowNs() - start) / iterations;
+            const double bytes_per_op = (double)bytes / iterations;
+            total_ns[e] += ns;
+            total_bytes[e] += bytes_per_op;
+            printf("  %13.1f  %5.1f", ns, bytes_per_op);
+        }
+        printf("\n");
+    }
+
+    printf("mean");
+    for (int e = 0; e < ENCODERS_LEN; e++) {
+        printf("  %13.1f  %5.1f", total_ns[e] / 256, total_bytes[e] / 256);
+    }
+    printf("\n");
+    return success;
+}
+
+int main(int argc, char **argv) {
+    const int iterations = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    if (iterations < 1) {
+        printf("Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    sbp_cmd_callbacks_t callbacks = {
+        .radioFrequency = callbackSuccess,
+        .remoteMbId = callbackSuccess,
+        .start = callbackSuccess,
+        .zstart = callbackSuccess,
+        .bstart = callbackSuccess,
+        .dstart = callbackSuccess,
+        .mstart = callbackSuccess,
+        .timestamps = callbackSuccess,
+        .capture = callbackSuccess,
+        .baudrate = callbackSuccess,
+        .profile = callbackSuccess,
+        .radioLoss = callbackSuccess,
+        .remoteIndex = callbackSuccess,
+        .radioChange = callbackSuccess,
+        .radioSlots = callbackSuccess,
+        .stop = callbackSuccess,
+    };
+    if (sbp_init(&callbacks, &protocol_state) != SBP_SUCCESS) {
+        printf("sbp_init() failed\n");
+        return 1;
+    }
+
+    bool success = benchCommands(iterations);
+    success = benchEncoders(iterations) && success;
+    return success ? 0 : 1;
+}
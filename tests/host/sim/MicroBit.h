@@ -0,0 +1,186 @@
+/**
+ * @brief Stand-in for the CODAL MicroBit.h header, to run the firmware main
+ * loop and radio code on the host computer against a virtual clock.
+ *
+ * Only provides what the firmware sources use from CODAL. The time only
+ * moves forward when the firmware calls into uBit, see sim.h for how the
+ * serial port, radio and clock are modelled.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "ManagedString.h"
+
+#define CONFIG_ENABLED(X)               (X == 1)
+#define CONFIG_DISABLED(X)              (X != 1)
+
+#define MICROBIT_OK                     0
+#define MICROBIT_INVALID_PARAMETER      (-1001)
+#define MICROBIT_BUSY                   (-1006)
+#define MICROBIT_NO_DATA                (-1012)
+
+#define MICROBIT_EVT_ANY                0
+#define MICROBIT_ID_SERIAL              12
+#define MICROBIT_ID_RADIO               9
+#define MICROBIT_ID_NOTIFY              1023
+#define CODAL_SERIAL_EVT_DELIM_MATCH    1
+#define CODAL_SERIAL_EVT_TX_EMPTY       2
+#define MICROBIT_RADIO_EVT_DATAGRAM     1
+#define MICROBIT_RADIO_POWER_LEVELS     8
+// As configured in codal.json, for the multi-sample radio packets
+#define MICROBIT_RADIO_MAX_PACKET_SIZE  64
+#define MICROBIT_RADIO_MAXIMUM_RX_BUFFERS 4
+
+typedef uint64_t CODAL_TIMESTAMP;
+
+enum SerialMode {
+    ASYNC,
+    SYNC_SPINWAIT,
+    SYNC_SLEEP,
+};
+
+class MicroBitEvent {
+public:
+    uint16_t source = 0;
+    uint16_t value = 0;
+
+    MicroBitEvent() { }
+    /** Creates and fires the event */
+    MicroBitEvent(uint16_t source, uint16_t value);
+};
+
+typedef void (*sim_event_handler_t)(MicroBitEvent);
+
+class Fiber { };
+
+class PacketBuffer {
+    std::vector<uint8_t> data;
+
+public:
+    PacketBuffer() { }
+    PacketBuffer(const uint8_t *bytes, int len) : data(bytes, bytes + len) { }
+    int length() const { return (int)data.size(); }
+    uint8_t *getBytes() { return data.data(); }
+};
+
+class MicroBitImage {
+public:
+    MicroBitImage() { }
+    MicroBitImage(const char *) { }
+};
+
+class MicroBitDisplay {
+public:
+    void print(const MicroBitImage &) { }
+    void clear() { }
+    MicroBitImage screenShot() { return MicroBitImage(); }
+    int readLightLevel();
+};
+
+class MicroBitSerial {
+public:
+    int setTxBufferSize(uint8_t size);
+    int setRxBufferSize(uint8_t size);
+    void setBaudrate(int baudrate);
+    int send(const uint8_t *buffer, int bufferLen, SerialMode mode = SYNC_SLEEP);
+    int read(SerialMode mode = SYNC_SLEEP);
+    int isReadable();
+    int txBufferedSize();
+    int eventOn(ManagedString delimiters, SerialMode mode = ASYNC);
+};
+
+class MicroBitRadioDatagram {
+public:
+    int send(const uint8_t *buffer, int len);
+    PacketBuffer recv();
+};
+
+class MicroBitRadio {
+public:
+    MicroBitRadioDatagram datagram;
+    int enable() { return MICROBIT_OK; }
+    int setTransmitPower(int) { return MICROBIT_OK; }
+    int setGroup(uint8_t) { return MICROBIT_OK; }
+    int setFrequencyBand(int band);
+};
+
+class MicroBitMessageBus {
+public:
+    int listen(int id, int value, sim_event_handler_t handler);
+};
+
+class MicroBitAxis {
+    const int axis;
+    int period_ms = 20;
+
+public:
+    MicroBitAxis(int axis) : axis(axis) { }
+    int getX();
+    int getY();
+    int getZ();
+    int getPeriod() { return period_ms; }
+    int setPeriod(int period) { period_ms = period; return MICROBIT_OK; }
+};
+
+class MicroBitButton {
+public:
+    int isPressed() { return 0; }
+};
+
+class MicroBitPin {
+public:
+    int isTouched() { return 0; }
+};
+
+class MicroBitIO {
+public:
+    MicroBitPin P0, P1, P2;
+};
+
+class MicroBitThermometer {
+public:
+    int getTemperature() { return 21; }
+};
+
+class LevelDetectorSPL {
+public:
+    float getValue() { return 42.0f; }
+};
+
+class MicroBitAudio {
+    LevelDetectorSPL level;
+
+public:
+    LevelDetectorSPL *levelSPL = &level;
+};
+
+class MicroBit {
+public:
+    MicroBitSerial serial;
+    MicroBitDisplay display;
+    MicroBitRadio radio;
+    MicroBitMessageBus messageBus;
+    MicroBitAxis accelerometer{0};
+    MicroBitAxis compass{1};
+    MicroBitButton buttonA, buttonB, logo;
+    MicroBitIO io;
+    MicroBitThermometer thermometer;
+    MicroBitAudio audio;
+
+    int init() { return MICROBIT_OK; }
+    unsigned long systemTime();
+    void sleep(uint32_t milliseconds);
+    [[noreturn]] void panic(int statusCode);
+};
+
+uint32_t microbit_serial_number();
+
+CODAL_TIMESTAMP system_timer_current_time_us();
+int system_timer_event_after_us(CODAL_TIMESTAMP period, uint16_t id, uint16_t value);
+int system_timer_event_every_us(CODAL_TIMESTAMP period, uint16_t id, uint16_t value);
+int system_timer_cancel_event(uint16_t id, uint16_t value);
+int fiber_wait_for_event(uint16_t id, uint16_t value);
+Fiber *create_fiber(void (*entry_fn)(void));
+void fiber_sleep(unsigned long t);
@@ -0,0 +1,6 @@
+/**
+ * @brief Stand-in for the CMSIS compiler macros used by the firmware.
+ */
+#pragma once
+
+#define __PACKED_STRUCT     struct __attribute__((packed))
@@ -0,0 +1,103 @@
+/**
+ * @brief Control of the virtual time simulator behind the fake uBit.
+ *
+ * The virtual clock, in microseconds, only advances when the firmware calls
+ * uBit.systemTime() (a fixed CPU cost per call), sleeps, or waits for the
+ * serial port. Scheduled serial bytes and radio packets arrive into the
+ * CODAL buffers at their virtual time, even while the firmware busy waits,
+ * but like the CODAL fibers, the radio event handlers only run when the
+ * firmware sleeps or yields in a SYNC_SLEEP serial send. Fibers created by
+ * the firmware run on their own stack, and likewise only when the main
+ * fiber yields, until they sleep or wait for an event.
+ *
+ * The simulation ends by throwing sim_end_t from inside the firmware once
+ * the virtual clock reaches the configured end time, and uBit.panic()
+ * throws sim_panic_t.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct sim_end_t { };
+
+struct sim_panic_t {
+    int code;
+};
+
+typedef struct sim_config_s {
+    uint64_t end_us;
+    // Scheduler tick, fibers wake up from sleep on the first tick after their time
+    uint32_t tick_us;
+    // Virtual time spent in each uBit.systemTime() call
+    uint32_t call_cost_us;
+    // Virtual time spent in each accelerometer or compass axis read, like an I2C transfer
+    uint32_t sensor_cost_us;
+    uint32_t serial_number;
+} sim_config_t;
+
+/** A byte sent by the firmware, with the time it finished transmission */
+typedef struct sim_tx_byte_s {
+    uint64_t end_us;
+    uint8_t byte;
+} sim_tx_byte_t;
+
+/** A radio datagram sent by the firmware, with the time it was sent */
+typedef struct sim_radio_tx_s {
+    uint64_t at_us;
+    std::vector<uint8_t> data;
+} sim_radio_tx_t;
+
+typedef struct sim_counters_s {
+    uint32_t serial_rx_overflow;
+    uint32_t radio_rx;
+    uint32_t radio_rx_dropped;
+    // Sent on a different radio frequency band than the one the firmware is on
+    uint32_t radio_rx_off_band;
+    uint32_t radio_tx;
+    uint32_t sleeps;
+} sim_counters_t;
+
+void sim_init(const sim_config_t *config);
+
+/** @return The current virtual time in microseconds. */
+uint64_t sim_now();
+
+/**
+ * @brief Schedules bytes from the host into the micro:bit UART RX, at the
+ * host baud rate, starting at at_us or when the previous host write
+ * finishes.
+ * @return The virtual time the last byte is received.
+ */
+uint64_t sim_hostWrite(const uint64_t at_us, const char *data, const size_t len);
+
+/**
+ * @brief Sets the baud rate of the following host writes, bytes received by
+ * the micro:bit UART at a different baud rate turn into garbage.
+ */
+void sim_hostSetBaudrate(const int baudrate);
+
+/** @brief Schedules a radio datagram to be received at at_us. */
+void sim_radioReceive(const uint64_t at_us, const void *data, const size_t len);
+
+/**
+ * @brief Sets the radio frequency band the scheduled datagrams are sent on
+ * from at_us, replacing any later band changes. The datagrams on a different
+ * band than the firmware are lost, until a band is set they are all received.
+ */
+void sim_radioSetBand(const uint64_t at_us, const int band);
+
+/**
+ * @brief Callback with each radio datagram sent by the firmware, and the band
+ * it was sent on, to reply to it with sim_radioReceive().
+ */
+typedef void (*sim_radio_send_hook_t)(const uint64_t at_us, const int band, const uint8_t *data, const size_t len);
+
+void sim_radioSetSendHook(const sim_radio_send_hook_t hook);
+
+const std::vector<sim_tx_byte_t> &sim_txBytes();
+
+const std::vector<sim_radio_tx_t> &sim_radioSent();
+
+const sim_counters_t *sim_counters();
@@ -0,0 +1,1043 @@
+/**
+ * @brief Runs the unmodified firmware main loop against the simulated uBit,
+ * with a scripted load, and reports the periodic message jitter, command
+ * latency and dropped fresh samples.
+ *
+ * The host sends a start command, and then a handshake command every
+ * cmd_interval to measure the command latency under load. In the radio
+ * bridge build a remote micro:bit sends a sensor data packet every
+ * radio_interval, with its sequence number as the accelerometer X value, so
+ * the fresh samples that never make it into a verbose periodic message can
+ * be counted. With --timestamps the TS command is sent before the start
+ * command, and the timestamps in the verbose periodic messages are used to
+ * measure the latency from sampling (or radio receipt) to the host. With a
+ * CAP[samples,rate] start command the binary capture frames are decoded and
+ * checked for missing samples. With --baud the BAUD command switches the
+ * serial port before the start command, only once after the handshake, and with --baud-confirm 0 the host
+ * doesn't confirm it, so both sides should go back to the default baud rate
+ * after the timeout. The STATS and PROF commands are sent just before the
+ * end, and their responses printed, the profiler measures the host time.
+ * With --radio-loss-pct and --radio-dup-pct the remote packets are lost or
+ * duplicated over the air, the RLMSG command adds the radio loss to the
+ * periodic messages, and the RLOSS counters are checked against them.
+ * With --remotes N there are N remote micro:bits, the last one with the
+ * shorter packets of the earlier firmware, and an MSTART start
+ * command checks every one of them is forwarded, with the RMBIDX IDs, or
+ * that they take even turns when the serial port can't send all of them.
+ * With more remote micro:bits than indexes, the first ones heard should
+ * keep their indexes, checked with RMBIDX early on and at the end. With
+ * --radio-restart 1 the second remote micro:bit restarts half way, with its
+ * packet IDs from 1 again, and it should still take even turns.
+ * With --radio-batch N the remote micro:bit sends multi-sample packets with
+ * N samples each, still one sample every radio_interval, and with a period
+ * no longer than the radio interval every sample should be forwarded. A
+ * malformed multi-sample packet is sent too, and should be ignored, like the
+ * single sample packet with the wrong length sent in every run.
+ * The bridge should send its period to the remote micro:bit, with the time
+ * until its next deadline, or to all of them without it in the multi mode.
+ * With --radio-heartbeat-ms N the RCHG command sets the change-driven mode,
+ * the remote micro:bit is still and only sends a heartbeat sample every N ms,
+ * and the bridge should hold it as fresh data for every periodic message.
+ * With --radio-slots 1 the RSLOT command starts the time-slotted beacons,
+ * checked to start a frame on a periodic deadline, with a slot for each
+ * remote micro:bit, and in the multi mode its RMBIDX index as its slot.
+ * With --radio-channel N the RF command switches to the radio frequency N
+ * half way through, the remote micro:bits reply to the announcements and
+ * switch at the announced time, and only one or two periods of packets
+ * should be lost on the wrong frequency. With --radio-channel-ack 0 they
+ * don't reply, and the bridge should stay on the same frequency.
+ * With --batch N the BATCH command is sent before the period, and with a
+ * BSTART[A] start command the binary records are decoded and each batched
+ * accelerometer sample should be a new one, even with the shortest periods.
+ *
+ * Usage: sim_<build> [--duration-ms N] [--period-ms N] [--start CMD]
+ *                    [--cmd-interval-ms N] [--radio-interval-ms N]
+ *                    [--radio-jitter-us N] [--tick-us N] [--call-cost-us N]
+ *                    [--timestamps N] [--sensor-cost-us N] [--baud N]
+ *                    [--baud-confirm N] [--radio-loss-pct N] [--radio-dup-pct N]
+ *                    [--remotes N] [--radio-batch N] [--radio-heartbeat-ms N]
+ *                    [--radio-slots N] [--radio-channel N]
+ *                    [--radio-channel-ack N] [--radio-restart N] [--batch N]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "main.h"
+#include "profiler.h"
+#include "radio_comms.h"
+#include "serial_bridge_protocol.h"
+#include "sim.h"
+
+int firmware_main();
+
+static const uint32_t SERIAL_NUMBER = 0x5EB1DA7A;
+// Simulated flash page with the remote micro:bit ID, see REMOTE_MB_ID_ADDR in main.cpp
+static const uintptr_t FLASH_PAGE_ADDR = 0x0007F000;
+static const size_t FLASH_PAGE_LEN = 0x1000;
+// Deadband sent with the RCHG command in the change-driven mode
+static const uint32_t RADIO_DEADBAND_MG = 50;
+// The STATS, PROF, RF and RLOSS queries are sent this long before the end
+static const uint64_t QUERY_BEFORE_END_US = 30000;
+
+typedef struct sim_options_s {
+    uint32_t duration_ms = 5000;
+    uint32_t period_ms = 20;
+    const char *start = "START[A]";
+    uint32_t cmd_interval_ms = 50;
+    uint32_t radio_interval_ms = 10;
+    uint32_t radio_jitter_us = 500;
+    uint32_t tick_us = 4000;
+    uint32_t call_cost_us = 1;
+    uint32_t timestamps = 0;
+    uint32_t sensor_cost_us = 0;
+    uint32_t baud = 0;
+    uint32_t baud_confirm = 1;
+    uint32_t radio_loss_pct = 0;
+    uint32_t radio_dup_pct = 0;
+    uint32_t remotes = 1;
+    uint32_t radio_batch = 1;
+    uint32_t radio_heartbeat_ms = 0;
+    uint32_t radio_slots = 0;
+    uint32_t radio_channel = 0;
+    uint32_t radio_channel_ack = 1;
+    uint32_t radio_restart = 0;
+    uint32_t batch = 1;
+} sim_options_t;
+
+typedef struct sim_msg_s {
+    uint64_t end_us;
+    std::string data;
+} sim_msg_t;
+
+typedef struct sim_stats_s {
+    size_t count = 0;
+    double sum = 0;
+    double sum_sq = 0;
+    double min = 0;
+    double max = 0;
+} sim_stats_t;
+
+static void statsAdd(sim_stats_t *stats, const double value) {
+    if (stats->count == 0 || value < stats->min) stats->min = value;
+    if (stats->count == 0 || value > stats->max) stats->max = value;
+    stats->count++;
+    stats->sum += value;
+    stats->sum_sq += value * value;
+}
+
+static void statsPrint(const char *name, const sim_stats_t *stats, const char *unit) {
+    if (stats->count == 0) {
+        printf("%-24s n/a\n", name);
+        return;
+    }
+    const double mean = stats->sum / stats->count;
+    const double variance = (stats->sum_sq / stats->count) - (mean * mean);
+    printf("%-24s mean %9.1f  stddev %8.1f  min %9.1f  max %9.1f %s  (n=%zu)\n",
+           name, mean, sqrt(variance > 0 ? variance : 0), stats->min, stats->max, unit, stats->count);
+}
+
+/**
+ * @brief A simulation run: the options, the scripted host commands and remote
+ * packets, and what the firmware sent back.
+ */
+typedef struct sim_run_s {
+    sim_options_t options;
+    uint64_t end_us = 0;
+    bool multi = false;
+    bool capture = false;
+    bool binary = false;
+    bool radio_loss = false;
+
+    // Commands from the host, with the time their last byte is received,
+    // removed once answered
+    std::map<std::string, uint64_t> commands;
+    uint32_t cmd_id = 0;
+    uint64_t start_us = 0;
+    std::map<std::string, uint32_t> remote_index_ids;
+    std::map<std::string, uint32_t> remote_index_first_ids;
+    std::string radio_channel_id;
+    std::string radio_channel_set_id;
+    std::string radio_channel_busy_id;
+    std::string baud_before_hs_id;
+    std::string stats_id;
+    std::string profile_ids[PROFILER_STAGE_LEN];
+    std::string radio_loss_id;
+
+    // The first remote micro:bit, sending a sample every radio_send_us
+    uint64_t radio_send_us = 0;
+    uint32_t air_lost = 0;
+    uint32_t air_lost_before_query = 0;
+    uint32_t air_duplicated = 0;
+    uint32_t air_duplicated_before_query = 0;
+
+    // Responses by ID, without the ID and the separator
+    std::map<std::string, std::string> responses;
+    size_t responses_count = 0;
+    sim_stats_t period_stats;
+    sim_stats_t latency_stats;
+    sim_stats_t sample_latency_stats;
+    uint64_t previous_periodic_us = 0;
+    std::map<int32_t, bool> samples_sent;
+    uint32_t capture_samples = 0;
+    uint32_t capture_frames = 0;
+    uint32_t capture_errors = 0;
+    uint64_t capture_end_us = 0;
+    uint32_t binary_records = 0;
+    uint32_t binary_samples = 0;
+    uint32_t binary_repeated = 0;
+    uint32_t binary_errors = 0;
+    std::string radio_lost_msg = "n/a";
+    std::map<uint32_t, uint32_t> remote_records;
+    uint64_t remote_records_len = 0;
+    std::vector<uint32_t> remote_mb_ids;
+    std::vector<uint32_t> remote_mb_ids_first;
+} sim_run_t;
+
+/** @return The remote micro:bits with a multi remote index, the rest are left out. */
+static uint32_t remoteIndexes(const sim_options_t &options) {
+    return options.remotes < RADIO_REMOTES_LEN ? options.remotes : RADIO_REMOTES_LEN;
+}
+
+static bool parseOptions(int argc, char **argv, sim_options_t *options) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) return false;
+        const char *option = argv[i];
+        const char *value = argv[++i];
+        if (strcmp(option, "--start") == 0) {
+            options->start = value;
+            continue;
+        }
+        uint32_t *number = NULL;
+        if (strcmp(option, "--duration-ms") == 0) number = &options->duration_ms;
+        else if (strcmp(option, "--period-ms") == 0) number = &options->period_ms;
+        else if (strcmp(option, "--cmd-interval-ms") == 0) number = &options->cmd_interval_ms;
+        else if (strcmp(option, "--radio-interval-ms") == 0) number = &options->radio_interval_ms;
+        else if (strcmp(option, "--radio-jitter-us") == 0) number = &options->radio_jitter_us;
+        else if (strcmp(option, "--tick-us") == 0) number = &options->tick_us;
+        else if (strcmp(option, "--call-cost-us") == 0) number = &options->call_cost_us;
+        else if (strcmp(option, "--timestamps") == 0) number = &options->timestamps;
+        else if (strcmp(option, "--sensor-cost-us") == 0) number = &options->sensor_cost_us;
+        else if (strcmp(option, "--baud") == 0) number = &options->baud;
+        else if (strcmp(option, "--baud-confirm") == 0) number = &options->baud_confirm;
+        else if (strcmp(option, "--radio-loss-pct") == 0) number = &options->radio_loss_pct;
+        else if (strcmp(option, "--radio-dup-pct") == 0) number = &options->radio_dup_pct;
+        else if (strcmp(option, "--remotes") == 0) number = &options->remotes;
+        else if (strcmp(option, "--radio-batch") == 0) number = &options->radio_batch;
+        else if (strcmp(option, "--radio-heartbeat-ms") == 0) number = &options->radio_heartbeat_ms;
+        else if (strcmp(option, "--radio-slots") == 0) number = &options->radio_slots;
+        else if (strcmp(option, "--radio-channel") == 0) number = &options->radio_channel;
+        else if (strcmp(option, "--radio-channel-ack") == 0) number = &options->radio_channel_ack;
+        else if (strcmp(option, "--radio-restart") == 0) number = &options->radio_restart;
+        else if (strcmp(option, "--batch") == 0) number = &options->batch;
+        else return false;
+        *number = (uint32_t)strtoul(value, NULL, 10);
+    }
+    return options->duration_ms > 0 && options->tick_us > 0 &&
+           options->radio_loss_pct < 100 && options->radio_dup_pct <= 100 &&
+           options->remotes > 0 && options->remotes <= 2 * RADIO_REMOTES_LEN &&
+           options->radio_batch > 0 && options->radio_batch <= RADIO_BATCH_SAMPLES_MAX &&
+           options->batch > 0;
+}
+
+/**
+ * @brief Decodes a COBS frame without the 0x00 delimiter, and checks and
+ * removes the CRC-16/CCITT-FALSE at the end.
+ * @return False if the frame is invalid.
+ */
+static bool decodeFrame(const std::string &frame, std::vector<uint8_t> *record) {
+    record->clear();
+    for (size_t i = 0; i < frame.size();) {
+        const uint8_t code = (uint8_t)frame[i++];
+        if (code == 0 || i + code - 1 > frame.size()) return false;
+        for (uint8_t j = 1; j < code; j++) record->push_back((uint8_t)frame[i++]);
+        if (code < 0xFF && i < frame.size()) record->push_back(0);
+    }
+    if (record->size() < 2) return false;
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < record->size() - 2; i++) {
+        crc ^= (uint16_t)((*record)[i] << 8);
+        for (int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    const uint16_t frame_crc = (uint16_t)((*record)[record->size() - 2] | ((*record)[record->size() - 1] << 8));
+    record->resize(record->size() - 2);
+    return crc == frame_crc;
+}
+
+/**
+ * @brief Splits the bytes sent by the firmware into messages, text lines for
+ * the responses and text periodic messages, and 0x00 delimited binary frames.
+ */
+static std::vector<sim_msg_t> splitMessages(const std::vector<sim_tx_byte_t> &tx_bytes) {
+    std::vector<sim_msg_t> messages;
+    sim_msg_t msg;
+    for (const sim_tx_byte_t &tx : tx_bytes) {
+        msg.data.push_back((char)tx.byte);
+        const bool text = msg.data[0] == 'R' || msg.data[0] == 'P';
+        if ((text && tx.byte == '\n') || (!text && tx.byte == 0x00)) {
+            msg.end_us = tx.end_us;
+            messages.push_back(msg);
+            msg.data.clear();
+        }
+    }
+    return messages;
+}
+
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+/**
+ * @brief The remote micro:bits side of the radio frequency switch, they
+ * reply to the announcements they hear, and from the switch time on their
+ * packets are sent on the new frequency.
+ */
+static uint32_t channel_remotes = 1;
+static bool channel_ack = true;
+static int channel_remote_band = -1;
+static int channel_remote_target = -1;
+static uint64_t channel_remote_switch_us = UINT64_MAX;
+static uint32_t channel_announcements = 0;
+static uint32_t channel_replies = 0;
+
+static void channelSendHook(const uint64_t at_us, const int band, const uint8_t *data, const size_t len) {
+    if (channel_remote_band < 0) channel_remote_band = band;
+    if (at_us >= channel_remote_switch_us) {
+        channel_remote_band = channel_remote_target;
+        channel_remote_switch_us = UINT64_MAX;
+    }
+    radio_packet_t packet;
+    if (len != sizeof(packet) || band != channel_remote_band) return;
+    memcpy(&packet, data, sizeof(packet));
+    if (packet.packet_type != RADIO_PKT_CMD || packet.cmd_type != RADIO_CMD_CHANNEL) return;
+
+    const radio_cmd_channel_t *channel = &packet.cmd_channel;
+    if (channel->frequency == channel_remote_band) {
+        // Confirmed or cancelled, so any pending switch is too
+        channel_remote_switch_us = UINT64_MAX;
+        sim_radioSetBand(at_us, channel_remote_band);
+        return;
+    }
+    if (channel->switch_in_us == 0) return;
+    channel_announcements++;
+    if (!channel_ack) return;
+
+    for (uint32_t remote = 0; remote < channel_remotes; remote++) {
+        radio_packet_t reply = { };
+        reply.packet_type = RADIO_PKT_RESPONSE;
+        reply.cmd_type = RADIO_CMD_CHANNEL;
+        reply.id = channel->switch_id;
+        reply.mb_id = SERIAL_NUMBER + remote;
+        sim_radioReceive(at_us + ((1 + (remote % 4)) * 1000), &reply, sizeof(reply));
+        channel_replies++;
+    }
+    channel_remote_target = channel->frequency;
+    channel_remote_switch_us = at_us + channel->switch_in_us;
+    sim_radioSetBand(at_us, channel_remote_band);
+    sim_radioSetBand(channel_remote_switch_us, channel_remote_target);
+}
+#endif
+
+/**
+ * @brief Schedules a command from the host.
+ * @return The ID of its response, e.g. "R[1A]".
+ */
+static std::string hostCommand(sim_run_t *run, const uint64_t at_us, const std::string &cmd) {
+    char id[9];
+    snprintf(id, sizeof(id), "%X", (unsigned int)++run->cmd_id);
+    const std::string line = std::string("C[") + id + "]" + cmd + "\n";
+    const std::string response_id = std::string("R[") + id + "]";
+    run->commands[response_id] = sim_hostWrite(at_us, line.c_str(), line.size());
+    return response_id;
+}
+
+/**
+ * @brief Schedules the host commands: the setup and start commands, the
+ * handshakes during the run, and the queries just before the end.
+ */
+static void scheduleHostCommands(sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    uint64_t setup_us = 10000;
+    // The shortest periods are only accepted once batching
+    if (options.batch > 1) {
+        hostCommand(run, setup_us, "BATCH[" + std::to_string(options.batch) + "]");
+    }
+    hostCommand(run, setup_us, "PER[" + std::to_string(options.period_ms) + "]");
+    if (options.timestamps > 0) {
+        hostCommand(run, setup_us, "TS[" + std::to_string(options.timestamps) + "]");
+    }
+    if (options.baud > 0) {
+        const std::string baud_cmd = "BAUD[" + std::to_string(options.baud) + "]";
+        // The switch is only negotiated after the handshake
+        run->baud_before_hs_id = hostCommand(run, setup_us, baud_cmd);
+        hostCommand(run, setup_us, "HS[]");
+        hostCommand(run, setup_us, baud_cmd);
+        // The host switches once it has received the response
+        setup_us = sim_hostWrite(setup_us, "", 0) + 20000;
+        if (options.baud_confirm) {
+            sim_hostSetBaudrate((int)options.baud);
+            hostCommand(run, setup_us, baud_cmd);
+        } else {
+            setup_us += (SBP_BAUD_CONFIRM_TIMEOUT_MS * 1000) + 20000;
+        }
+    }
+    if (run->radio_loss) {
+        hostCommand(run, setup_us, "RLMSG[1]");
+    }
+    if (options.radio_heartbeat_ms > 0) {
+        hostCommand(run, setup_us, "RCHG[" + std::to_string(RADIO_DEADBAND_MG) + "," +
+                                   std::to_string(options.radio_heartbeat_ms) + "]");
+    }
+    if (options.radio_slots > 0) {
+        hostCommand(run, setup_us, "RSLOT[1]");
+    }
+    hostCommand(run, setup_us, options.start);
+    run->start_us = sim_hostWrite(setup_us, "", 0);
+
+    // The host writes one command after the other, so the HS commands stop
+    // before the RMBIDX ones, sent early enough to get all their responses
+    const uint64_t remote_index_us = run->multi ? run->end_us - 200000 - (options.remotes * 10000ULL) : run->end_us;
+    // The radio frequency switch half way, in between the HS commands
+    const uint64_t channel_us = options.radio_channel > 0 ?
+                                run->start_us + (remote_index_us - run->start_us) / 2 : run->end_us;
+    const std::string channel_cmd = "RF[" + std::to_string(options.radio_channel) + "]";
+    if (options.cmd_interval_ms > 0) {
+        const uint64_t interval_us = options.cmd_interval_ms * 1000ULL;
+        for (uint64_t t = run->start_us + interval_us; t < remote_index_us; t += interval_us) {
+            if (t >= channel_us && t - channel_us < interval_us) {
+                run->radio_channel_set_id = hostCommand(run, channel_us, channel_cmd);
+                // A second switch while the first one is in progress
+                run->radio_channel_busy_id = hostCommand(run, channel_us + 1000, channel_cmd);
+            }
+            hostCommand(run, t, "HS[]");
+        }
+    } else if (options.radio_channel > 0) {
+        run->radio_channel_set_id = hostCommand(run, channel_us, channel_cmd);
+        run->radio_channel_busy_id = hostCommand(run, channel_us + 1000, channel_cmd);
+    }
+    if (run->multi) {
+        // With more remote micro:bits than indexes, also early on, as the
+        // indexes shouldn't change while their remote micro:bits are heard,
+        // half a radio interval out of step as the remotes send in turn
+        const uint64_t remote_index_first_us = run->start_us + (remote_index_us - run->start_us) / 4 +
+                                               options.radio_interval_ms * 500ULL;
+        for (uint32_t i = 0; i < remoteIndexes(options); i++) {
+            const std::string cmd = "RMBIDX[" + std::to_string(i) + "]";
+            if (options.remotes > RADIO_REMOTES_LEN) {
+                run->remote_index_first_ids[hostCommand(run, remote_index_first_us, cmd)] = i;
+            }
+            run->remote_index_ids[hostCommand(run, remote_index_us, cmd)] = i;
+        }
+    }
+
+    const uint64_t query_us = run->end_us - QUERY_BEFORE_END_US;
+    run->radio_channel_id = hostCommand(run, query_us, "RF[]");
+    run->stats_id = hostCommand(run, query_us, "STATS[]");
+    for (int i = 0; i < PROFILER_STAGE_LEN; i++) {
+        run->profile_ids[i] = hostCommand(run, query_us, "PROF[" + std::to_string(i) + "]");
+    }
+    run->radio_loss_id = hostCommand(run, query_us, "RLOSS[]");
+}
+
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+/** @return The number of malformed packets scheduleRemotePackets sends. */
+static uint32_t malformedPackets(const sim_options_t &options) {
+    return options.radio_batch > 1 ? 2 : 1;
+}
+
+/**
+ * @brief Schedules the packets from the remote micro:bits. The first one
+ * numbers its samples and can lose or duplicate them over the air, the
+ * packets sent well before the RLOSS query must be included in its
+ * counters, and the rest might be.
+ */
+static void scheduleRemotePackets(sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    channel_remotes = options.remotes;
+    channel_ack = options.radio_channel_ack != 0;
+    sim_radioSetSendHook(channelSendHook);
+    // A still remote micro:bit in the change-driven mode only sends the heartbeats
+    run->radio_send_us = (options.radio_heartbeat_ms > 0 ? options.radio_heartbeat_ms :
+                          options.radio_interval_ms) * 1000ULL;
+    if (options.radio_interval_ms == 0) return;
+
+    srand(1);
+    const uint64_t query_us = run->end_us - QUERY_BEFORE_END_US;
+    uint32_t radio_packets = 0;
+    radio_batch_packet_t batch = { };
+    for (uint64_t t = 0; t < run->end_us; t += run->radio_send_us) {
+        const bool before_query = t + 20000 < query_us;
+        radio_packet_t packet = { };
+        packet.packet_type = RADIO_PKT_SENSOR_DATA;
+        packet.id = ++radio_packets;
+        packet.mb_id = SERIAL_NUMBER;
+        packet.sensor_data.accelerometer_x = (int32_t)radio_packets;
+        packet.sensor_data.capture_time_us = (uint32_t)t;
+        const void *packet_data = &packet;
+        size_t packet_len = sizeof(packet);
+        if (options.radio_batch > 1) {
+            // The samples are sent together once the batch is full
+            if (batch.sample_count == options.radio_batch) batch.sample_count = 0;
+            if (batch.sample_count == 0) {
+                batch.packet_type = RADIO_PKT_SENSOR_BATCH;
+                batch.id = packet.id;
+                batch.mb_id = SERIAL_NUMBER;
+                batch.capture_time_us = (uint32_t)t;
+            }
+            radio_batch_sample_t *sample = &batch.samples[batch.sample_count++];
+            sample->capture_delta_us = (uint16_t)(t - batch.capture_time_us);
+            sample->accelerometer_x = (int16_t)radio_packets;
+            if (batch.sample_count < options.radio_batch) continue;
+            packet_data = &batch;
+            packet_len = RADIO_BATCH_HEADER_LEN + (batch.sample_count * sizeof(radio_batch_sample_t));
+        }
+        // The radio loss counters count samples, each sample of a lost packet is lost
+        const uint32_t packet_samples = options.radio_batch;
+        const uint64_t jitter = options.radio_jitter_us ? (uint64_t)(rand() % options.radio_jitter_us) : 0;
+        if (options.radio_loss_pct && (uint32_t)(rand() % 100) < options.radio_loss_pct) {
+            run->air_lost += packet_samples;
+            if (before_query) run->air_lost_before_query += packet_samples;
+            continue;
+        }
+        sim_radioReceive(t + jitter, packet_data, packet_len);
+        if (options.radio_dup_pct && (uint32_t)(rand() % 100) < options.radio_dup_pct) {
+            run->air_duplicated += packet_samples;
+            if (before_query) run->air_duplicated_before_query += packet_samples;
+            sim_radioReceive(t + jitter + 1000, packet_data, packet_len);
+        }
+    }
+    if (options.radio_batch > 1) {
+        // A malformed multi-sample packet, with more samples than it's long
+        radio_batch_packet_t malformed = { };
+        malformed.packet_type = RADIO_PKT_SENSOR_BATCH;
+        malformed.id = radio_packets + 1;
+        malformed.mb_id = SERIAL_NUMBER;
+        malformed.sample_count = options.radio_batch;
+        sim_radioReceive(run->end_us / 4, &malformed, RADIO_BATCH_HEADER_LEN + sizeof(radio_batch_sample_t));
+    }
+    // A single sample packet a few bytes short, from foreign traffic on the channel
+    radio_packet_t short_packet = { };
+    short_packet.packet_type = RADIO_PKT_SENSOR_DATA;
+    short_packet.id = radio_packets + 1;
+    short_packet.mb_id = SERIAL_NUMBER;
+    sim_radioReceive((run->end_us / 4) + 1000, &short_packet, RADIO_PACKET_LEGACY_LEN - 4);
+    // The other remote micro:bits are spread over the radio interval, without any loss,
+    // and the last one has the earlier firmware, with the packets without the capture time
+    const uint64_t interval_us = options.radio_interval_ms * 1000ULL;
+    for (uint32_t remote = 1; remote < options.remotes; remote++) {
+        const size_t packet_len = remote == options.remotes - 1 ? RADIO_PACKET_LEGACY_LEN : sizeof(radio_packet_t);
+        uint32_t remote_packets = 0;
+        bool restarted = false;
+        for (uint64_t t = (remote * interval_us) / options.remotes; t < run->end_us; t += interval_us) {
+            if (options.radio_restart && remote == 1 && !restarted && t >= run->end_us / 2) {
+                // Its packet IDs start from 1 again, far behind the last ones
+                remote_packets = 0;
+                restarted = true;
+            }
+            radio_packet_t packet = { };
+            packet.packet_type = RADIO_PKT_SENSOR_DATA;
+            packet.id = ++remote_packets;
+            packet.mb_id = SERIAL_NUMBER + remote;
+            packet.sensor_data.accelerometer_x = (int32_t)remote_packets;
+            packet.sensor_data.capture_time_us = (uint32_t)t;
+            sim_radioReceive(t, &packet, packet_len);
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Analyses everything sent by the firmware: the command responses,
+ * the capture frames, the multi remote records and the periodic messages.
+ */
+static void analyseMessages(sim_run_t *run) {
+    for (const sim_msg_t &msg : splitMessages(sim_txBytes())) {
+        if (msg.data[0] == 'R') {
+            const std::string id = msg.data.substr(0, msg.data.find(']') + 1);
+            run->responses[id] = msg.data.substr(id.size(), msg.data.size() - id.size() - 1);
+            if (msg.data.find("RMBIDX[") != std::string::npos) {
+                const uint32_t mb_id = (uint32_t)strtoul(msg.data.c_str() + id.size() + 7, NULL, 10);
+                if (run->remote_index_ids.count(id)) run->remote_mb_ids[run->remote_index_ids[id]] = mb_id;
+                if (run->remote_index_first_ids.count(id)) run->remote_mb_ids_first[run->remote_index_first_ids[id]] = mb_id;
+            }
+            auto cmd = run->commands.find(id);
+            if (cmd != run->commands.end()) {
+                statsAdd(&run->latency_stats, (double)(msg.end_us - cmd->second) / 1000.0);
+                run->commands.erase(cmd);
+                run->responses_count++;
+            }
+            continue;
+        }
+        if (run->capture) {
+            // Header is sequence number (first sample index), mask and samples count
+            std::vector<uint8_t> record;
+            const bool valid = decodeFrame(msg.data.substr(0, msg.data.size() - 1), &record) && record.size() >= 4;
+            if (!valid || (uint32_t)(record[0] | (record[1] << 8)) != run->capture_samples) {
+                run->capture_errors++;
+                continue;
+            }
+            run->capture_samples += record[3];
+            run->capture_frames++;
+            run->capture_end_us = msg.end_us;
+            continue;
+        }
+        if (run->binary) {
+            // Accelerometer only records, the header and then 6 bytes per sample
+            std::vector<uint8_t> record;
+            const bool valid = decodeFrame(msg.data.substr(0, msg.data.size() - 1), &record) && record.size() >= 4 &&
+                               record[2] == 0x01 && record.size() == 4 + (record[3] * 6u);
+            if (!valid) {
+                run->binary_errors++;
+                continue;
+            }
+            for (size_t i = 1; i < record[3]; i++) {
+                if (memcmp(&record[4 + (i * 6)], &record[4 + ((i - 1) * 6)], 6) == 0) run->binary_repeated++;
+            }
+            run->binary_samples += record[3];
+            run->binary_records++;
+            continue;
+        }
+        if (run->multi) {
+            // Compact message with the remote index after the message ID
+            if (msg.data.size() > 5) {
+                run->remote_records[(uint32_t)strtoul(msg.data.substr(3, 2).c_str(), NULL, 16)]++;
+                run->remote_records_len += msg.data.size();
+            }
+            continue;
+        }
+        if (run->previous_periodic_us != 0) {
+            statsAdd(&run->period_stats, (double)(msg.end_us - run->previous_periodic_us) / 1000.0);
+        }
+        run->previous_periodic_us = msg.end_us;
+        const size_t ts = msg.data.find("TS[");
+        if (ts != std::string::npos) {
+            const uint32_t sample_us = (uint32_t)strtoul(msg.data.c_str() + ts + 3, NULL, 10);
+            statsAdd(&run->sample_latency_stats, (double)((uint32_t)msg.end_us - sample_us) / 1000.0);
+        }
+        const size_t rl = msg.data.find("RL[");
+        if (rl != std::string::npos) {
+            run->radio_lost_msg = msg.data.substr(rl + 3, msg.data.find(']', rl) - rl - 3);
+        }
+        const size_t ax = msg.data.find("AX[");
+        if (ax != std::string::npos) {
+            run->samples_sent[(int32_t)strtol(msg.data.c_str() + ax + 3, NULL, 10)] = true;
+        }
+    }
+}
+
+/** @return The response to a command, without its ID, or "n/a". */
+static std::string response(const sim_run_t *run, const std::string &id) {
+    auto found = run->responses.find(id);
+    return found != run->responses.end() ? found->second : "n/a";
+}
+
+/** @return The commands without a response, except the ones sent too close to the end. */
+static size_t unansweredCommands(const sim_run_t *run) {
+    size_t unanswered = 0;
+    for (const auto &cmd : run->commands) {
+        if (cmd.second + 100000 < run->end_us) unanswered++;
+    }
+    return unanswered;
+}
+
+/** @brief Prints the periodic message timing, command latency and stats. */
+static void printSummary(const sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    const sim_counters_t *counters = sim_counters();
+    printf("Simulated %u ms, period %u ms, %s\n", options.duration_ms, options.period_ms, options.start);
+    statsPrint("Periodic interval", &run->period_stats, "ms");
+    statsPrint("Command latency", &run->latency_stats, "ms");
+    if (options.timestamps > 0) {
+        statsPrint("Sample latency", &run->sample_latency_stats, "ms");
+    }
+    printf("%-24s %zu responses, %zu unanswered\n", "Commands", run->responses_count, unansweredCommands(run));
+    printf("%-24s %s\n", "Stats", response(run, run->stats_id).c_str());
+    for (int i = 0; i < PROFILER_STAGE_LEN; i++) {
+        unsigned long count = 0, mean_ns = 0, max_ns = 0;
+        if (sscanf(response(run, run->profile_ids[i]).c_str(), "PROF[%lu,%lu,%lu", &count, &mean_ns, &max_ns) != 3) continue;
+        const std::string name = std::string("Profile ") + profiler_stage_str[i];
+        printf("%-24s %lu times, mean %lu ns, max %lu ns\n", name.c_str(), count, mean_ns, max_ns);
+    }
+    if (run->capture) {
+        printf("%-24s %u samples in %u frames, %u errors, sent by %.1f ms\n", "Capture",
+               run->capture_samples, run->capture_frames, run->capture_errors, (double)run->capture_end_us / 1000.0);
+    }
+    printf("%-24s %u overflowed bytes\n", "Serial RX", counters->serial_rx_overflow);
+    printf("%-24s %u sleeps\n", "Main fiber", counters->sleeps);
+}
+
+/**
+ * @return False if a batched binary sample repeats the previous one, or
+ *         the records miss more than a few deadlines.
+ */
+static bool checkBatchedSamples(const sim_run_t *run) {
+    if (!run->binary) return true;
+    const uint32_t expected = (uint32_t)((run->end_us - run->start_us) / (run->options.period_ms * 1000ULL));
+    printf("%-24s %u samples in %u records of %u deadlines, %u repeated, %u errors\n", "Batched samples",
+           run->binary_samples, run->binary_records, expected, run->binary_repeated, run->binary_errors);
+    if (run->binary_records == 0 || run->binary_repeated > 0 || run->binary_errors > 0 ||
+            run->binary_samples < (expected * 9) / 10) {
+        printf("The batched samples are not a new sample for every deadline\n");
+        return false;
+    }
+    return true;
+}
+
+/** @return False if the BAUD command switched before the handshake. */
+static bool checkBaudHandshake(const sim_run_t *run) {
+    if (run->options.baud == 0) return true;
+    if (response(run, run->baud_before_hs_id) != "ERROR[1]") {
+        printf("The baud rate switch was accepted before the handshake\n");
+        return false;
+    }
+    return true;
+}
+
+/** @return False if the capture frames are invalid or missing samples. */
+static bool checkCapture(const sim_run_t *run) {
+    if (!run->capture) return true;
+    return run->capture_errors == 0 && run->capture_samples == (uint32_t)strtoul(run->options.start + 4, NULL, 10);
+}
+
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+/**
+ * @brief Decodes the commands the bridge sent to the remote micro:bits.
+ * @return The commands of cmd_type, with the time they were sent.
+ */
+static std::vector<std::pair<uint64_t, radio_packet_t>> radioCommandsSent(const uint8_t cmd_type) {
+    std::vector<std::pair<uint64_t, radio_packet_t>> cmds;
+    for (const sim_radio_tx_t &tx : sim_radioSent()) {
+        radio_packet_t packet;
+        if (tx.data.size() != sizeof(packet)) continue;
+        memcpy(&packet, tx.data.data(), sizeof(packet));
+        if (packet.packet_type != RADIO_PKT_CMD || packet.cmd_type != cmd_type) continue;
+        cmds.push_back(std::make_pair(tx.at_us, packet));
+    }
+    return cmds;
+}
+
+/** @return False if the period commands don't match the bridge period. */
+static bool checkPeriodCommands(const sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    bool period_valid = true;
+    uint32_t period_cmds = 0;
+    for (const auto &cmd : radioCommandsSent(RADIO_CMD_PERIOD)) {
+        const radio_cmd_period_t *period = &cmd.second.cmd_period;
+        period_cmds++;
+        const uint32_t deadband_mg = options.radio_heartbeat_ms > 0 ? RADIO_DEADBAND_MG : 0;
+        if (period->period_us != options.period_ms * 1000 || period->batch_samples < 1 ||
+                period->deadband_mg != deadband_mg || period->heartbeat_ms != options.radio_heartbeat_ms ||
+                period->batch_samples > RADIO_BATCH_SAMPLES ||
+                cmd.second.mb_id != (run->multi ? 0 : SERIAL_NUMBER) ||
+                (run->multi ? period->phase_us != RADIO_PHASE_NONE : period->phase_us > period->period_us)) {
+            period_valid = false;
+        }
+    }
+    printf("%-24s %u period commands sent\n", "Remote period", period_cmds);
+    if (period_cmds == 0) period_valid = false;
+    if (!period_valid) printf("The period commands don't match the bridge period\n");
+    return period_valid;
+}
+
+/**
+ * @return False if the time-slotted beacons aren't a frame apart, or the
+ *         slots they assign don't match the remote micro:bits.
+ */
+static bool checkBeacons(const sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    bool slots_valid = true;
+    uint32_t beacons = 0;
+    uint64_t previous_beacon_us = 0;
+    uint32_t previous_frame_us = 0;
+    uint32_t slot_count_max = 0;
+    std::map<uint32_t, uint32_t> slot_mb_ids;
+    for (const auto &cmd : radioCommandsSent(RADIO_CMD_BEACON)) {
+        const radio_cmd_beacon_t *beacon = &cmd.second.cmd_beacon;
+        beacons++;
+        if (beacon->slot_count > slot_count_max) slot_count_max = beacon->slot_count;
+        if (beacon->slot != RADIO_SLOT_NONE) slot_mb_ids[beacon->slot] = beacon->slot_mb_id;
+        // A frame fits a slot per remote micro:bit, and is a whole number of periods
+        if (cmd.second.mb_id != 0 || beacon->slot_us != RADIO_SLOT_US ||
+                beacon->frame_us < (uint32_t)(beacon->slot_count + 2) * beacon->slot_us ||
+                beacon->frame_us % (options.period_ms * 1000) != 0 ||
+                (beacon->slot != RADIO_SLOT_NONE && beacon->slot >= beacon->slot_count)) {
+            slots_valid = false;
+        }
+        // Beacons sent late are still on a deadline, at most a few periods late
+        if (previous_beacon_us != 0 && (cmd.first - previous_beacon_us < previous_frame_us - options.tick_us ||
+                cmd.first - previous_beacon_us > previous_frame_us + (2 * options.period_ms * 1000ULL))) {
+            slots_valid = false;
+        }
+        previous_beacon_us = cmd.first;
+        previous_frame_us = beacon->frame_us;
+    }
+    if (options.radio_slots > 0) {
+        printf("%-24s %u beacons, %u slots, %zu assigned, frame %u us\n", "Remote slots",
+               beacons, slot_count_max, slot_mb_ids.size(), previous_frame_us);
+        if (beacons == 0 || slot_mb_ids.size() != options.remotes) slots_valid = false;
+        for (const auto &slot : slot_mb_ids) {
+            if (slot.second < SERIAL_NUMBER || slot.second >= SERIAL_NUMBER + options.remotes ||
+                    (run->multi && slot.second != run->remote_mb_ids[slot.first])) {
+                slots_valid = false;
+            }
+        }
+        if (!slots_valid) printf("The beacons don't match the remote micro:bits\n");
+    } else if (beacons > 0) {
+        printf("Beacons sent without the RSLOT command\n");
+        slots_valid = false;
+    }
+    return slots_valid;
+}
+
+/**
+ * @return False if the bridge and remote micro:bits didn't switch the radio
+ *         frequency together, or switched without the replies.
+ */
+static bool checkRadioChannel(const sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    if (options.radio_channel == 0) return true;
+
+    const sim_counters_t *counters = sim_counters();
+    const std::string radio_channel_response = response(run, run->radio_channel_id);
+    uint64_t switch_us = 0;
+    uint32_t channel_cmds = 0;
+    for (const auto &cmd : radioCommandsSent(RADIO_CMD_CHANNEL)) {
+        channel_cmds++;
+        if (switch_us == 0 && cmd.second.cmd_channel.switch_in_us == 0 &&
+                cmd.second.cmd_channel.frequency == options.radio_channel) {
+            switch_us = cmd.first;
+        }
+    }
+    printf("%-24s %s, %u commands, %u announcements heard, switched at %.1f ms, %u packets lost\n",
+           "Radio channel", radio_channel_response.c_str(), channel_cmds, channel_announcements,
+           (double)switch_us / 1000.0, counters->radio_rx_off_band);
+    const std::string previous_channel = "RF[" + std::to_string(radio_getFrequencyFromId(SERIAL_NUMBER)) + "]";
+    const std::string expected_channel = options.radio_channel_ack ?
+            "RF[" + std::to_string(options.radio_channel) + "]" : previous_channel;
+    // The switch has only started when the RF[N] command is answered
+    const std::string set_response = response(run, run->radio_channel_set_id);
+    const std::string busy_response = response(run, run->radio_channel_busy_id);
+    printf("%-24s %s, then %s while switching\n", "Radio channel command", set_response.c_str(), busy_response.c_str());
+    // At most two periods of packets lost, from each remote micro:bit
+    const uint32_t lost_max = options.remotes * ((2 * options.period_ms / options.radio_interval_ms) + 1);
+    if (radio_channel_response != expected_channel || set_response != previous_channel ||
+            busy_response != "ERROR[4]" || channel_announcements == 0 ||
+            counters->radio_rx_off_band > (options.radio_channel_ack ? lost_max : 0) ||
+            (options.radio_channel_ack != 0) != (switch_us != 0)) {
+        printf("The remote micro:bits and the bridge didn't switch the radio frequency together\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return False if samples from the multi-sample packets are missing from
+ *         the periodic messages, without radio loss and with a period that
+ *         keeps up with them.
+ */
+static bool checkFreshSamples(const sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    const sim_counters_t *counters = sim_counters();
+    // Samples received before the periodic messages start are not expected in the output
+    const uint32_t first_expected = (uint32_t)(run->start_us / run->radio_send_us) + 2;
+    // The last samples of a multi-sample packet can still be waiting to be released
+    const uint32_t malformed = malformedPackets(options);
+    const uint32_t last_expected = ((counters->radio_rx - channel_replies - malformed) * options.radio_batch) -
+                                   (options.radio_batch - 1);
+    uint32_t dropped = 0;
+    uint32_t expected = 0;
+    for (uint32_t seq = first_expected; seq <= last_expected; seq++) {
+        expected++;
+        if (!run->samples_sent.count((int32_t)seq)) dropped++;
+    }
+    printf("%-24s %u received, %u dropped by the radio queue\n", "Radio", counters->radio_rx, counters->radio_rx_dropped);
+    if (run->samples_sent.empty()) {
+        printf("%-24s n/a, needs a verbose periodic message with the accelerometer\n", "Dropped fresh samples");
+    } else {
+        printf("%-24s %u of %u\n", "Dropped fresh samples", dropped, expected);
+    }
+    if (options.radio_batch > 1 && options.radio_loss_pct == 0 && options.period_ms <= options.radio_interval_ms &&
+            (run->samples_sent.empty() || dropped > expected / 50)) {
+        printf("Samples from the multi-sample packets missing from the periodic messages\n");
+        return false;
+    }
+    return true;
+}
+
+/** @return False if the malformed packets aren't counted as ignored. */
+static bool checkMalformedPackets(const sim_run_t *run) {
+    // The STATS query can still be behind the periodic messages at the end
+    const std::string stats_response = response(run, run->stats_id);
+    if (run->options.radio_interval_ms == 0 || stats_response == "n/a") return true;
+    unsigned long received = 0, accepted = 0, ignored = 0;
+    if (sscanf(stats_response.c_str(), "STATS[%*u,%*u,%*u,%*u,%*u,%*u,%*u,%lu,%lu,%lu",
+               &received, &accepted, &ignored) != 3 || ignored < malformedPackets(run->options)) {
+        printf("The malformed radio packets aren't counted as ignored\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return False if periodic messages are stale between the heartbeats of the
+ *         change-driven mode, as the bridge holds the heartbeat samples and
+ *         only the deadlines before the first one should be stale.
+ */
+static bool checkHeartbeat(const sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    if (options.radio_heartbeat_ms == 0) return true;
+    unsigned long deadlines = 0, missed = 0, stale = 0;
+    if (sscanf(response(run, run->stats_id).c_str(), "STATS[%lu,%lu,%lu", &deadlines, &missed, &stale) != 3 ||
+            stale > (options.radio_heartbeat_ms / options.period_ms) + 2) {
+        printf("Stale periodic messages between the heartbeat samples\n");
+        return false;
+    }
+    return true;
+}
+#endif
+
+/**
+ * @return False if a remote micro:bit is missing from the multi remote
+ *         messages, it should be forwarded for nearly every deadline, or the
+ *         RMBIDX IDs don't match them.
+ */
+static bool checkRemotes(const sim_run_t *run) {
+    const sim_options_t &options = run->options;
+    if (!run->multi) return true;
+    const uint64_t interval_us = (options.radio_interval_ms > options.period_ms ?
+                                  options.radio_interval_ms : options.period_ms) * 1000ULL;
+    uint32_t expected = (uint32_t)((run->end_us - run->start_us) / interval_us);
+    // Too many remote micro:bits for the serial port, they should take turns
+    uint32_t records_total = 0;
+    for (const auto &records : run->remote_records) records_total += records.second;
+    const uint32_t baud = options.baud && options.baud_confirm ? options.baud : 115200;
+    const uint64_t period_len = ((uint64_t)baud * options.period_ms) / (10 * 1000);
+    const uint64_t record_len = records_total ? run->remote_records_len / records_total : 1;
+    const uint64_t period_records = period_len / record_len;
+    const uint32_t deadlines = (uint32_t)((run->end_us - run->start_us) / (options.period_ms * 1000ULL));
+    const uint32_t indexes = remoteIndexes(options);
+    if (period_records * interval_us < indexes * options.period_ms * 1000ULL) {
+        expected = (uint32_t)((deadlines * period_records) / indexes);
+    }
+    bool remotes_valid = true;
+    uint32_t records_min = UINT32_MAX;
+    uint32_t records_max = 0;
+    uint32_t index_changes = 0;
+    std::map<uint32_t, bool> mb_ids_seen;
+    for (uint32_t i = 0; i < indexes; i++) {
+        const auto found = run->remote_records.find(i);
+        const uint32_t records = found != run->remote_records.end() ? found->second : 0;
+        if (records < records_min) records_min = records;
+        if (records > records_max) records_max = records;
+        const uint32_t mb_id = run->remote_mb_ids[i];
+        if (mb_id < SERIAL_NUMBER || mb_id >= SERIAL_NUMBER + options.remotes || mb_ids_seen.count(mb_id)) {
+            remotes_valid = false;
+        }
+        if (options.remotes > RADIO_REMOTES_LEN && run->remote_mb_ids_first[i] != mb_id) index_changes++;
+        mb_ids_seen[mb_id] = true;
+    }
+    printf("%-24s %zu indexes, %u to %u records per remote, %u expected, %u indexes changed\n", "Remotes",
+           run->remote_records.size(), records_min, records_max, expected, index_changes);
+    if (run->remote_records.size() != indexes || index_changes > 0 || records_min < (expected * 9) / 10 ||
+        records_max - records_min > expected / 10 + 1) {
+        remotes_valid = false;
+    }
+    if (!remotes_valid) printf("Remote micro:bits missing from the multi remote messages\n");
+    return remotes_valid;
+}
+
+/** @return False if the RLOSS counters don't match the simulated radio. */
+static bool checkRadioLoss(const sim_run_t *run) {
+    if (!run->radio_loss) return true;
+    const sim_counters_t *counters = sim_counters();
+    const std::string radio_loss_response = response(run, run->radio_loss_id);
+    printf("%-24s %s, last RL[%s], %u lost and %u duplicated over the air\n", "Radio loss",
+           radio_loss_response.c_str(), run->radio_lost_msg.c_str(), run->air_lost, run->air_duplicated);
+    // The radio queue can drop packets too, and the duplicated copies it drops are never seen
+    const uint32_t queue_dropped = counters->radio_rx_dropped * run->options.radio_batch;
+    unsigned long received = 0, lost = 0, duplicated = 0, reordered = 0;
+    const bool radio_loss_valid = sscanf(radio_loss_response.c_str(), "RLOSS[%lu,%lu,%lu,%lu]",
+                                         &received, &lost, &duplicated, &reordered) == 4 &&
+                                  lost >= run->air_lost_before_query &&
+                                  lost <= run->air_lost + queue_dropped &&
+                                  duplicated + queue_dropped >= run->air_duplicated_before_query &&
+                                  duplicated <= run->air_duplicated &&
+                                  (run->options.radio_loss_pct == 0 || run->radio_lost_msg != "0");
+    if (!radio_loss_valid) printf("Radio loss counters don't match the simulated radio\n");
+    return radio_loss_valid;
+}
+
+int main(int argc, char **argv) {
+    sim_run_t run;
+    if (!parseOptions(argc, argv, &run.options)) {
+        printf("Usage: %s [--duration-ms N] [--period-ms N] [--start CMD] [--cmd-interval-ms N]\n"
+               "       [--radio-interval-ms N] [--radio-jitter-us N] [--tick-us N] [--call-cost-us N]\n"
+               "       [--timestamps N] [--sensor-cost-us N] [--baud N] [--baud-confirm N]\n"
+               "       [--radio-loss-pct N] [--radio-dup-pct N] [--remotes N] [--radio-batch N]\n"
+               "       [--radio-heartbeat-ms N] [--radio-slots N] [--radio-channel N]\n"
+               "       [--radio-channel-ack N] [--radio-restart N] [--batch N]\n", argv[0]);
+        return 1;
+    }
+    const sim_options_t &options = run.options;
+
+    void *flash = mmap((void *)FLASH_PAGE_ADDR, FLASH_PAGE_LEN, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (flash != (void *)FLASH_PAGE_ADDR) {
+        printf("Could not map the simulated flash page\n");
+        return 1;
+    }
+    memset(flash, 0xFF, FLASH_PAGE_LEN);
+
+    run.end_us = options.duration_ms * 1000ULL;
+    run.multi = strncmp(options.start, "MSTART[", 7) == 0;
+    run.capture = strncmp(options.start, "CAP[", 4) == 0;
+    run.binary = strcmp(options.start, "BSTART[A]") == 0;
+    run.radio_loss = CONFIG_ENABLED(RADIO_BRIDGE) && (options.radio_loss_pct > 0 || options.radio_dup_pct > 0);
+    run.remote_mb_ids.resize(remoteIndexes(options), 0);
+    run.remote_mb_ids_first.resize(remoteIndexes(options), 0);
+    const sim_config_t config = {
+        .end_us = run.end_us,
+        .tick_us = options.tick_us,
+        .call_cost_us = options.call_cost_us,
+        .sensor_cost_us = options.sensor_cost_us,
+        .serial_number = SERIAL_NUMBER,
+    };
+    sim_init(&config);
+
+    scheduleHostCommands(&run);
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+    scheduleRemotePackets(&run);
+#endif
+
+    int panic_code = -1;
+    try {
+        firmware_main();
+    } catch (const sim_end_t &) {
+    } catch (const sim_panic_t &panic) {
+        panic_code = panic.code;
+    }
+
+    analyseMessages(&run);
+    printSummary(&run);
+    bool valid = unansweredCommands(&run) == 0;
+#if CONFIG_ENABLED(RADIO_BRIDGE)
+    valid &= checkPeriodCommands(&run);
+    valid &= checkBeacons(&run);
+    valid &= checkRadioChannel(&run);
+    valid &= checkFreshSamples(&run);
+    valid &= checkHeartbeat(&run);
+    valid &= checkMalformedPackets(&run);
+#endif
+    valid &= checkRemotes(&run);
+    valid &= checkRadioLoss(&run);
+
+    if (panic_code != -1) {
+        printf("PANIC %d at %llu us\n", panic_code, (unsigned long long)sim_now());
+        return 1;
+    }
+    valid &= checkBaudHandshake(&run);
+    valid &= checkCapture(&run);
+    valid &= checkBatchedSamples(&run);
+    return valid ? 0 : 1;
+}
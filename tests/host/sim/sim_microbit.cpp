@@ -0,0 +1,530 @@
+/**
+ * @brief Fake uBit for the simulator, see sim.h for the timing model.
+ */
+#include <ucontext.h>
+#include <deque>
+#include <exception>
+#include <map>
+#include <string>
+#include <utility>
+#include "MicroBit.h"
+#include "sim.h"
+
+static sim_config_t config = { };
+static sim_counters_t counters = { };
+static uint64_t now_us = 0;
+
+// Serial port, bytes sent by the host at a different baud rate than the
+// micro:bit UART are received as garbage
+static int baudrate = 115200;
+static int host_baudrate = 115200;
+static size_t rx_buffer_size = 20;
+static size_t tx_buffer_size = 20;
+static uint64_t host_write_end_us = 0;
+typedef struct sim_rx_byte_s {
+    uint64_t at_us;
+    uint8_t byte;
+    int baudrate;
+} sim_rx_byte_t;
+static std::deque<sim_rx_byte_t> rx_scheduled;
+static std::deque<uint8_t> rx_buffer;
+static std::vector<sim_tx_byte_t> tx_bytes;
+// When the last byte in the TX buffer finishes transmission, or 0 if empty
+static uint64_t tx_empty_us = 0;
+static std::string serial_delimiters;
+
+// Radio
+static std::multimap<uint64_t, std::vector<uint8_t>> radio_scheduled;
+static std::deque<PacketBuffer> radio_queue;
+static std::vector<sim_radio_tx_t> radio_sent;
+static int radio_band = 0;
+// Band of the scheduled datagrams from each time, none if empty
+static std::map<uint64_t, int> radio_air_bands;
+static sim_radio_send_hook_t radio_send_hook = NULL;
+
+// Events, the listeners run when the main fiber yields, but a main fiber
+// waiting for an event wakes up straight away
+typedef struct sim_listener_s {
+    uint16_t id;
+    uint16_t value;
+    sim_event_handler_t handler;
+} sim_listener_t;
+static std::vector<sim_listener_t> listeners;
+static std::deque<MicroBitEvent> events_pending;
+static bool in_handler = false;
+static bool main_waiting = false;
+static bool main_woken = false;
+static uint16_t main_wait_id = 0;
+static uint16_t main_wait_value = 0;
+
+typedef struct sim_timer_s {
+    uint64_t at_us;
+    // Zero for the single shot timers
+    uint64_t period_us;
+    uint16_t id;
+    uint16_t value;
+} sim_timer_t;
+static std::vector<sim_timer_t> timers;
+
+// Fibers other than the main one, running on their own stack with ucontext
+static const size_t FIBER_STACK_LEN = 64 * 1024;
+typedef struct sim_fiber_s {
+    ucontext_t context;
+    std::vector<uint8_t> stack;
+    void (*entry_fn)(void);
+    uint64_t wake_us;
+    bool finished;
+    // Waiting for an event, like the main fiber, instead of sleeping
+    bool waiting;
+    uint16_t wait_id;
+    uint16_t wait_value;
+} sim_fiber_t;
+static std::vector<sim_fiber_t *> fibers;
+static sim_fiber_t *current_fiber = NULL;
+static ucontext_t main_context;
+// Exceptions can't unwind across stacks, so they are rethrown in the main fiber
+static std::exception_ptr fiber_exception;
+
+static inline uint64_t byteTimeUs(const int rate) {
+    // 8N1, 10 bits per byte
+    return (10 * 1000000ULL + rate - 1) / rate;
+}
+
+static inline bool eventMatches(const uint16_t id, const uint16_t value, const MicroBitEvent &evt) {
+    return (id == evt.source || id == MICROBIT_EVT_ANY) && (value == evt.value || value == MICROBIT_EVT_ANY);
+}
+
+static void fireEvent(const uint16_t id, const uint16_t value) {
+    MicroBitEvent evt;
+    evt.source = id;
+    evt.value = value;
+    if (main_waiting && eventMatches(main_wait_id, main_wait_value, evt)) {
+        main_woken = true;
+    }
+    for (sim_fiber_t *fiber : fibers) {
+        if (fiber->waiting && eventMatches(fiber->wait_id, fiber->wait_value, evt)) {
+            fiber->waiting = false;
+            fiber->wake_us = 0;
+        }
+    }
+    for (const sim_listener_t &listener : listeners) {
+        if (eventMatches(listener.id, listener.value, evt)) {
+            events_pending.push_back(evt);
+            break;
+        }
+    }
+}
+
+/** @return The time of the next scheduled arrival or timer, or UINT64_MAX. */
+static uint64_t nextScheduledUs() {
+    uint64_t next_us = UINT64_MAX;
+    if (!rx_scheduled.empty()) next_us = rx_scheduled.front().at_us;
+    if (!radio_scheduled.empty() && radio_scheduled.begin()->first < next_us) {
+        next_us = radio_scheduled.begin()->first;
+    }
+    for (const sim_timer_t &timer : timers) {
+        if (timer.at_us < next_us) next_us = timer.at_us;
+    }
+    if (tx_empty_us && tx_empty_us < next_us) next_us = tx_empty_us;
+    for (const sim_fiber_t *fiber : fibers) {
+        if (!fiber->finished && fiber->wake_us < next_us) next_us = fiber->wake_us;
+    }
+    return next_us;
+}
+
+/**
+ * @brief Moves the clock forward, with all the scheduled bytes, packets and
+ * timers arriving or firing until that time.
+ */
+static void advanceTo(uint64_t t) {
+    const bool end = t >= config.end_us;
+    if (end) t = config.end_us;
+
+    while (!rx_scheduled.empty() && rx_scheduled.front().at_us <= t) {
+        const sim_rx_byte_t &rx = rx_scheduled.front();
+        const uint8_t c = (rx.baudrate == baudrate) ? rx.byte : 0xFF;
+        if (rx_buffer.size() < rx_buffer_size) {
+            rx_buffer.push_back(c);
+            if (serial_delimiters.find((char)c) != std::string::npos) {
+                fireEvent(MICROBIT_ID_SERIAL, CODAL_SERIAL_EVT_DELIM_MATCH);
+            }
+        } else {
+            counters.serial_rx_overflow++;
+        }
+        rx_scheduled.pop_front();
+    }
+    while (!radio_scheduled.empty() && radio_scheduled.begin()->first <= t) {
+        const std::vector<uint8_t> &data = radio_scheduled.begin()->second;
+        std::map<uint64_t, int>::const_iterator air_band = radio_air_bands.upper_bound(radio_scheduled.begin()->first);
+        counters.radio_rx++;
+        if (air_band != radio_air_bands.begin() && (--air_band)->second != radio_band) {
+            counters.radio_rx_off_band++;
+        } else if (radio_queue.size() < MICROBIT_RADIO_MAXIMUM_RX_BUFFERS) {
+            radio_queue.push_back(PacketBuffer(data.data(), (int)data.size()));
+            fireEvent(MICROBIT_ID_RADIO, MICROBIT_RADIO_EVT_DATAGRAM);
+        } else {
+            counters.radio_rx_dropped++;
+        }
+        radio_scheduled.erase(radio_scheduled.begin());
+    }
+    for (size_t i = 0; i < timers.size();) {
+        if (timers[i].at_us <= t) {
+            const sim_timer_t timer = timers[i];
+            if (timer.period_us) {
+                timers[i].at_us += timer.period_us;
+            } else {
+                timers.erase(timers.begin() + i);
+            }
+            fireEvent(timer.id, timer.value);
+        } else {
+            i++;
+        }
+    }
+    if (tx_empty_us && tx_empty_us <= t) {
+        tx_empty_us = 0;
+        fireEvent(MICROBIT_ID_NOTIFY, CODAL_SERIAL_EVT_TX_EMPTY);
+    }
+    if (t > now_us) now_us = t;
+
+    if (end) throw sim_end_t();
+}
+
+/**
+ * @brief Runs the queued event handlers, as the CODAL scheduler would do when
+ * the main fiber yields.
+ */
+static void dispatchEvents() {
+    if (in_handler) return;
+    in_handler = true;
+    while (!events_pending.empty()) {
+        const MicroBitEvent evt = events_pending.front();
+        events_pending.pop_front();
+        for (const sim_listener_t &listener : listeners) {
+            if (eventMatches(listener.id, listener.value, evt)) listener.handler(evt);
+        }
+    }
+    in_handler = false;
+}
+
+static void fiberEntry() {
+    try {
+        current_fiber->entry_fn();
+    } catch (...) {
+        fiber_exception = std::current_exception();
+    }
+    current_fiber->finished = true;
+}
+
+/**
+ * @brief Runs the fibers whose sleep has finished, each one until it sleeps
+ * again, as the CODAL scheduler would do when the main fiber yields.
+ */
+static void runFibers() {
+    if (current_fiber != NULL) return;
+    for (sim_fiber_t *fiber : fibers) {
+        if (fiber->finished || fiber->wake_us > now_us) continue;
+        current_fiber = fiber;
+        swapcontext(&main_context, &fiber->context);
+        current_fiber = NULL;
+        if (fiber_exception) {
+            std::exception_ptr exception = fiber_exception;
+            fiber_exception = NULL;
+            std::rethrow_exception(exception);
+        }
+    }
+}
+
+/**
+ * @brief Sleeps the main fiber until wake_us, running the event handlers and
+ * the other fibers as the events arrive and their sleep finishes.
+ */
+static void sleepUntil(const uint64_t wake_us) {
+    dispatchEvents();
+    runFibers();
+    while (now_us < wake_us) {
+        const uint64_t next_us = nextScheduledUs();
+        advanceTo(next_us < wake_us ? next_us : wake_us);
+        dispatchEvents();
+        runFibers();
+    }
+}
+
+static inline uint64_t nextTickUs(const uint64_t t) {
+    return ((t + config.tick_us - 1) / config.tick_us) * config.tick_us;
+}
+
+// ----------------------------------------------------------------------------
+// SIMULATOR CONTROL ----------------------------------------------------------
+// ----------------------------------------------------------------------------
+void sim_init(const sim_config_t *sim_config) {
+    config = *sim_config;
+}
+
+uint64_t sim_now() {
+    return now_us;
+}
+
+uint64_t sim_hostWrite(const uint64_t at_us, const char *data, const size_t len) {
+    uint64_t t = at_us > host_write_end_us ? at_us : host_write_end_us;
+    for (size_t i = 0; i < len; i++) {
+        t += byteTimeUs(host_baudrate);
+        rx_scheduled.push_back({ t, (uint8_t)data[i], host_baudrate });
+    }
+    host_write_end_us = t;
+    return t;
+}
+
+void sim_hostSetBaudrate(const int rate) {
+    host_baudrate = rate;
+}
+
+void sim_radioReceive(const uint64_t at_us, const void *data, const size_t len) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    radio_scheduled.insert(std::make_pair(at_us, std::vector<uint8_t>(bytes, bytes + len)));
+}
+
+void sim_radioSetBand(const uint64_t at_us, const int band) {
+    radio_air_bands.erase(radio_air_bands.lower_bound(at_us), radio_air_bands.end());
+    radio_air_bands[at_us] = band;
+}
+
+void sim_radioSetSendHook(const sim_radio_send_hook_t hook) {
+    radio_send_hook = hook;
+}
+
+const std::vector<sim_tx_byte_t> &sim_txBytes() {
+    return tx_bytes;
+}
+
+const std::vector<sim_radio_tx_t> &sim_radioSent() {
+    return radio_sent;
+}
+
+const sim_counters_t *sim_counters() {
+    return &counters;
+}
+
+// ----------------------------------------------------------------------------
+// FAKE CODAL -----------------------------------------------------------------
+// ----------------------------------------------------------------------------
+unsigned long MicroBit::systemTime() {
+    advanceTo(now_us + config.call_cost_us);
+    return (unsigned long)(now_us / 1000);
+}
+
+void MicroBit::sleep(uint32_t milliseconds) {
+    fiber_sleep(milliseconds);
+}
+
+void MicroBit::panic(int statusCode) {
+    throw sim_panic_t{statusCode};
+}
+
+uint32_t microbit_serial_number() {
+    return config.serial_number;
+}
+
+int MicroBitDisplay::readLightLevel() {
+    return (int)((now_us / 1000) % 256);
+}
+
+/**
+ * @return The time of the last sensor update, as CODAL only reads a new
+ * sample from the sensor once per period.
+ */
+static inline uint64_t axisUpdateUs(const int period_ms) {
+    const uint64_t period_us = (period_ms > 0 ? period_ms : 1) * 1000ULL;
+    return (now_us / period_us) * period_us;
+}
+
+int MicroBitAxis::getX() {
+    advanceTo(now_us + config.sensor_cost_us);
+    return (int)((axisUpdateUs(period_ms) / 1000) % 2048) - 1024 + axis;
+}
+
+int MicroBitAxis::getY() {
+    advanceTo(now_us + config.sensor_cost_us);
+    return (int)((axisUpdateUs(period_ms) / 3000) % 2048) - 1024 + axis;
+}
+
+int MicroBitAxis::getZ() {
+    advanceTo(now_us + config.sensor_cost_us);
+    return -1024 + axis;
+}
+
+int MicroBitSerial::setTxBufferSize(uint8_t size) {
+    tx_buffer_size = size;
+    return MICROBIT_OK;
+}
+
+int MicroBitSerial::setRxBufferSize(uint8_t size) {
+    rx_buffer_size = size;
+    return MICROBIT_OK;
+}
+
+void MicroBitSerial::setBaudrate(int rate) {
+    baudrate = rate;
+}
+
+int MicroBitSerial::txBufferedSize() {
+    // Bytes still in the TX buffer are the ones not fully transmitted yet
+    int buffered = 0;
+    for (size_t i = tx_bytes.size(); i > 0 && tx_bytes[i - 1].end_us > now_us; i--) {
+        buffered++;
+    }
+    return buffered;
+}
+
+int MicroBitSerial::send(const uint8_t *buffer, int bufferLen, SerialMode mode) {
+    size_t buffered = (size_t)txBufferedSize();
+    uint64_t t = (buffered > 0) ? tx_bytes.back().end_us : now_us;
+
+    int sent = 0;
+    for (; sent < bufferLen; sent++) {
+        if (mode == ASYNC && buffered >= tx_buffer_size) break;
+        t += byteTimeUs(baudrate);
+        tx_bytes.push_back({ t, buffer[sent] });
+        buffered++;
+    }
+    if (sent > 0) tx_empty_us = t;
+
+    // CODAL waits for the TX buffer to be empty in the synchronous modes
+    if (mode == SYNC_SLEEP) {
+        sleepUntil(t);
+    } else if (mode == SYNC_SPINWAIT) {
+        advanceTo(t);
+    }
+    return sent;
+}
+
+int MicroBitSerial::read(SerialMode mode) {
+    while (rx_buffer.empty()) {
+        if (mode == ASYNC) return MICROBIT_NO_DATA;
+        if (rx_scheduled.empty()) {
+            // Nothing else will ever arrive, wait until the end of the simulation
+            sleepUntil(config.end_us);
+        }
+        sleepUntil(rx_scheduled.front().at_us);
+    }
+    const uint8_t c = rx_buffer.front();
+    rx_buffer.pop_front();
+    return c;
+}
+
+int MicroBitSerial::isReadable() {
+    return rx_buffer.empty() ? 0 : 1;
+}
+
+int MicroBitRadioDatagram::send(const uint8_t *buffer, int len) {
+    radio_sent.push_back({ now_us, std::vector<uint8_t>(buffer, buffer + len) });
+    counters.radio_tx++;
+    if (radio_send_hook != NULL) radio_send_hook(now_us, radio_band, buffer, (size_t)len);
+    return MICROBIT_OK;
+}
+
+PacketBuffer MicroBitRadioDatagram::recv() {
+    if (radio_queue.empty()) return PacketBuffer();
+    PacketBuffer packet = radio_queue.front();
+    radio_queue.pop_front();
+    return packet;
+}
+
+int MicroBitRadio::setFrequencyBand(int band) {
+    if (band < 0 || band > 83) return MICROBIT_INVALID_PARAMETER;
+    radio_band = band;
+    return MICROBIT_OK;
+}
+
+int MicroBitMessageBus::listen(int id, int value, sim_event_handler_t handler) {
+    listeners.push_back({ (uint16_t)id, (uint16_t)value, handler });
+    return MICROBIT_OK;
+}
+
+MicroBitEvent::MicroBitEvent(uint16_t source, uint16_t value) : source(source), value(value) {
+    fireEvent(source, value);
+}
+
+int MicroBitSerial::eventOn(ManagedString delimiters, SerialMode mode) {
+    (void)mode;
+    serial_delimiters = delimiters.toCharArray();
+    return MICROBIT_OK;
+}
+
+CODAL_TIMESTAMP system_timer_current_time_us() {
+    advanceTo(now_us + config.call_cost_us);
+    return now_us;
+}
+
+int system_timer_event_after_us(CODAL_TIMESTAMP period, uint16_t id, uint16_t value) {
+    timers.push_back({ now_us + period, 0, id, value });
+    return MICROBIT_OK;
+}
+
+int system_timer_event_every_us(CODAL_TIMESTAMP period, uint16_t id, uint16_t value) {
+    timers.push_back({ now_us + period, period, id, value });
+    return MICROBIT_OK;
+}
+
+int system_timer_cancel_event(uint16_t id, uint16_t value) {
+    for (size_t i = 0; i < timers.size();) {
+        if (timers[i].id == id && timers[i].value == value) {
+            timers.erase(timers.begin() + i);
+        } else {
+            i++;
+        }
+    }
+    return MICROBIT_OK;
+}
+
+int fiber_wait_for_event(uint16_t id, uint16_t value) {
+    if (current_fiber != NULL) {
+        current_fiber->waiting = true;
+        current_fiber->wait_id = id;
+        current_fiber->wait_value = value;
+        current_fiber->wake_us = UINT64_MAX;
+        swapcontext(&current_fiber->context, &main_context);
+        return MICROBIT_OK;
+    }
+    counters.sleeps++;
+    main_waiting = true;
+    main_woken = false;
+    main_wait_id = id;
+    main_wait_value = value;
+    dispatchEvents();
+    runFibers();
+    while (!main_woken) {
+        advanceTo(nextScheduledUs());
+        dispatchEvents();
+        runFibers();
+    }
+    main_waiting = false;
+    return MICROBIT_OK;
+}
+
+Fiber *create_fiber(void (*entry_fn)(void)) {
+    sim_fiber_t *fiber = new sim_fiber_t();
+    fiber->stack.resize(FIBER_STACK_LEN);
+    fiber->entry_fn = entry_fn;
+    fiber->wake_us = now_us;
+    fiber->finished = false;
+    fiber->waiting = false;
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack.data();
+    fiber->context.uc_stack.ss_size = fiber->stack.size();
+    fiber->context.uc_link = &main_context;
+    makecontext(&fiber->context, fiberEntry, 0);
+    fibers.push_back(fiber);
+    static Fiber handle;
+    return &handle;
+}
+
+void fiber_sleep(unsigned long t) {
+    const uint64_t wake_us = nextTickUs(now_us + (t * 1000ULL));
+    if (current_fiber == NULL) {
+        counters.sleeps++;
+        sleepUntil(wake_us);
+        return;
+    }
+    current_fiber->wake_us = wake_us;
+    swapcontext(&current_fiber->context, &main_context);
+}
@@ -6,10 +6,12 @@ the commands expected to configure the sensors data to start streaming.
 
 It prints all sent and received data to the terminal for inspection.
 """
+import re
 import sys
 import time
 import uuid
 import random
+import struct
 
 from serial import Serial, PARITY_NONE, STOPBITS_ONE
 from serial.tools import list_ports
@@ -125,6 +127,27 @@ def test_cmd(ubit_serial, cmd_name, cmd, expected_response=None, check_value=Tru
     return response_cmd.split("[", 1)[1][:-1], periodic_msgs
 
 
+def test_pipelined_commands(ubit_serial):
+    """
+    Commands are parsed as the bytes arrive, so several commands in a single
+    write, and a command split across writes, should all get a response.
+    """
+    print("\nPipelined commands")
+    ubit_serial.write(b"C[A1]HS[]\nC[A2]HWVER[]\n\nC[A3]PER[20]\n")
+    for expected in (b"R[A1]HS[1]", b"R[A2]HWVER[2]", b"R[A3]PER[20]"):
+        response = ubit_serial.readline()[:-1]
+        if response != expected:
+            raise Exception(f"Unexpected response: {response} != {expected}")
+        print(f"\t{response}")
+    for c in b"C[B1]HS[]\n":
+        ubit_serial.write(bytes([c]))
+        time.sleep(0.005)
+    response = ubit_serial.readline()[:-1]
+    if response != b"R[B1]HS[1]":
+        raise Exception(f"Unexpected response: {response}")
+    print(f"\t{response}")
+
+
 def test_radio_frequency(ubit_serial):
     # First read the current radio frequency
     original_radio_frequency, _ = test_cmd(
@@ -181,6 +204,12 @@ def test_start_stop(ubit_serial):
     for msg in periodic_msgs:
         print(f"\t(DEVICE 🔁) {msg}")
 
+    # About 50 deadlines at the default 20 ms period, none should have been missed
+    jitter, _ = test_cmd(ubit_serial, "Jitter", "JITTER[]", check_value=False)
+    deadlines, missed, late_mean_us, late_max_us = [int(v) for v in jitter.split(",")]
+    if deadlines < 40 or missed != 0:
+        raise Exception(f"Unexpected periodic deadlines: {jitter}")
+
 
 def test_zstart_stop(ubit_serial):
     """
@@ -188,7 +217,7 @@ def test_zstart_stop(ubit_serial):
 
     :param ubit_serial: The serial connection to the micro:bit.
     """
-    _ , periodic_msgs = test_cmd(ubit_serial, "Start", "ZSTART[]")
+    test_cmd(ubit_serial, "Start", "ZSTART[PABFMLTS]", "ZSTART[]")
 
     print("Printing all periodic messages received for 1 second...")
     timeout_time = time.time() + 1  # 1 second timeout
@@ -208,6 +237,446 @@ def test_zstart_stop(ubit_serial):
         print(f"\t(DEVICE 🔁) {msg}")
 
 
+def test_timestamps(ubit_serial):
+    """
+    Test the sample timestamps in the verbose and compact periodic messages,
+    consecutive samples should be about a period apart.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    test_cmd(ubit_serial, "Timestamps (read)", "TS[]", "TS[0]")
+    test_cmd(ubit_serial, "Timestamps (set)", "TS[1]")
+
+    for start_cmd, pattern in (("START[A]", rb"^P\[[0-9A-F]+\]TS\[(\d+)\]AX\["),
+                               ("ZSTART[A]", rb"^P[0-9A-F]{2}([0-9A-F]{8})[0-9A-F]{9}$")):
+        test_cmd(ubit_serial, "Start", start_cmd, start_cmd.split("[")[0] + "[]")
+        timestamps = []
+        timeout_time = time.time() + 0.5
+        while time.time() < timeout_time:
+            serial_line = ubit_serial.readline()[:-1]
+            match = re.match(pattern, serial_line)
+            if not match:
+                raise Exception(f"Unexpected periodic message: {serial_line}")
+            base = 10 if start_cmd == "START[A]" else 16
+            timestamps.append(int(match.group(1), base))
+        test_cmd(ubit_serial, "Stop", "STOP[]", periodic_error=False)
+        print(f"\t{len(timestamps)} timestamps, from {timestamps[0]} to {timestamps[-1]} us")
+
+        # 32 bit microsecond timestamps, so they can wrap around
+        intervals = [(b - a) & 0xFFFFFFFF for a, b in zip(timestamps, timestamps[1:])]
+        if len(intervals) < 10 or any(i < 15000 or i > 25000 for i in intervals):
+            raise Exception(f"Unexpected timestamp intervals: {intervals}")
+
+    test_cmd(ubit_serial, "Timestamps (set)", "TS[0]")
+
+
+def test_stats(ubit_serial):
+    """
+    Test the runtime statistics after a second of verbose periodic messages.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    test_cmd(ubit_serial, "Start", "START[A]", "START[]")
+    time.sleep(1)
+    test_cmd(ubit_serial, "Stop", "STOP[]", periodic_error=False)
+    stats, _ = test_cmd(ubit_serial, "Stats", "STATS[]", check_value=False)
+    (deadlines, missed, stale, slack_min_us, slack_mean_us, commands, tx_bytes,
+     radio_received, radio_accepted, radio_ignored, messages, encode_us) = [int(v) for v in stats.split(",")]
+    print(f"\t{deadlines} deadlines, {missed} missed, {stale} stale, slack min {slack_min_us} us "
+          f"mean {slack_mean_us} us, {commands} commands, {tx_bytes} bytes sent, radio "
+          f"{radio_received}/{radio_accepted}/{radio_ignored}, {messages} messages in {encode_us} us")
+    if deadlines < 40 or messages < 40 or messages > deadlines or commands < 1:
+        raise Exception(f"Unexpected runtime statistics: {stats}")
+    if slack_min_us > slack_mean_us or slack_mean_us > 20000 or tx_bytes < messages * 10:
+        raise Exception(f"Unexpected runtime statistics: {stats}")
+    test_cmd(ubit_serial, "Stats (error)", "STATS[1]", "ERROR[1]")
+
+
+def test_profile(ubit_serial):
+    """
+    Test the profiler latency histograms, if the firmware was built with it.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    test_cmd(ubit_serial, "Profile (reset)", "PROF[0]", check_value=False)
+    test_cmd(ubit_serial, "Start", "START[A]", "START[]")
+    time.sleep(1)
+    test_cmd(ubit_serial, "Stop", "STOP[]", periodic_error=False)
+    profile, _ = test_cmd(ubit_serial, "Profile", "PROF[0]", check_value=False)
+    if "," not in profile:
+        # ERROR[3] response, only the value is returned
+        print("\tThe firmware was built without the profiler.")
+        return
+    values = [int(v) for v in profile.split(",")]
+    count, mean_ns, max_ns, buckets = values[0], values[1], values[2], values[3:]
+    print(f"\t{count} samples, mean {mean_ns} ns, max {max_ns} ns, buckets {buckets}")
+    if count < 40 or len(buckets) != 16 or sum(buckets) != count or mean_ns > max_ns:
+        raise Exception(f"Unexpected profile histogram: {profile}")
+    test_cmd(ubit_serial, "Profile (error)", "PROF[5]", "ERROR[1]")
+
+
+def test_radio_loss(ubit_serial):
+    """
+    Test the radio loss commands are rejected, as the sensors build has no radio.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    test_cmd(ubit_serial, "Radio loss", "RLOSS[]", "ERROR[3]")
+    test_cmd(ubit_serial, "Radio loss message (read)", "RLMSG[]", "RLMSG[0]")
+    test_cmd(ubit_serial, "Radio loss message (set)", "RLMSG[1]", "ERROR[3]")
+    test_cmd(ubit_serial, "Radio loss message (error)", "RLMSG[2]", "ERROR[1]")
+
+
+def test_multi_remote(ubit_serial):
+    """
+    Test the multi remote commands are rejected, as the sensors build has no radio.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    test_cmd(ubit_serial, "Multi remote start", "MSTART[AB]", "ERROR[3]")
+    test_cmd(ubit_serial, "Remote index", "RMBIDX[0]", "ERROR[3]")
+    test_cmd(ubit_serial, "Remote index (error)", "RMBIDX[]", "ERROR[1]")
+
+
+def test_radio_change(ubit_serial):
+    """
+    Test the change-driven radio mode is rejected, as the sensors build has no radio.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    test_cmd(ubit_serial, "Radio change (read)", "RCHG[]", "RCHG[0,0]")
+    test_cmd(ubit_serial, "Radio change (set)", "RCHG[50,200]", "ERROR[3]")
+    test_cmd(ubit_serial, "Radio change (error)", "RCHG[50,0]", "ERROR[1]")
+    test_cmd(ubit_serial, "Radio change (error)", "RCHG[50,5000]", "ERROR[1]")
+
+
+def test_radio_slots(ubit_serial):
+    """
+    Test the time-slotted radio mode is rejected, as the sensors build has no radio.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    test_cmd(ubit_serial, "Radio slots (read)", "RSLOT[]", "RSLOT[0]")
+    test_cmd(ubit_serial, "Radio slots (set)", "RSLOT[1]", "ERROR[3]")
+    test_cmd(ubit_serial, "Radio slots (error)", "RSLOT[2]", "ERROR[1]")
+
+
+def cobs_decode(frame):
+    """Decodes a COBS encoded frame, without the 0x00 delimiter."""
+    data = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        if code == 0:
+            raise Exception(f"Unexpected zero byte in COBS frame: {frame}")
+        data += frame[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(frame):
+            data.append(0)
+    return bytes(data)
+
+
+def crc16_ccitt(data):
+    """CRC-16/CCITT-FALSE, as used by the binary periodic records."""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def parse_binary_record(frame):
+    """
+    Decodes a binary periodic frame into a list of samples.
+
+    :param frame: The COBS encoded frame, without the 0x00 delimiter.
+
+    :raises Exception: If the CRC or the record length is not valid.
+
+    :return: List of dictionaries with the sequence number and sensor values
+             for each sample, using the same keys as the verbose periodic
+             messages.
+    """
+    record = cobs_decode(frame)
+    if len(record) < 6:
+        raise Exception(f"Binary record too short: {record}")
+    crc, = struct.unpack_from("<H", record, len(record) - 2)
+    if crc != crc16_ccitt(record[:-2]):
+        raise Exception(f"Binary record CRC mismatch: {record}")
+
+    seq, mask, count = struct.unpack_from("<HBB", record, 0)
+    samples = []
+    offset = 4
+    for i in range(count):
+        values = {"P": (seq + i) & 0xFFFF}
+        if mask & 0x01:
+            values["AX"], values["AY"], values["AZ"] = struct.unpack_from("<hhh", record, offset)
+            offset += 6
+        if mask & 0x02:
+            values["MX"], values["MY"], values["MZ"] = struct.unpack_from("<iii", record, offset)
+            offset += 12
+        if mask & (0x04 | 0x08 | 0x10):
+            buttons = record[offset]
+            offset += 1
+            if mask & 0x04:
+                values["BA"], values["BB"] = buttons & 1, (buttons >> 1) & 1
+            if mask & 0x08:
+                values["F"] = (buttons >> 2) & 1
+            if mask & 0x10:
+                values["P0"], values["P1"], values["P2"] = (
+                    (buttons >> 3) & 1, (buttons >> 4) & 1, (buttons >> 5) & 1)
+        if mask & 0x20:
+            values["T"], = struct.unpack_from("<b", record, offset)
+            offset += 1
+        if mask & 0x40:
+            values["L"] = record[offset]
+            offset += 1
+        if mask & 0x80:
+            values["S"] = record[offset]
+            offset += 1
+        samples.append(values)
+    if offset != len(record) - 2:
+        raise Exception(f"Binary record length does not match mask: {record}")
+    return samples
+
+
+def read_varint(data, offset):
+    """Reads an unsigned LEB128 varint, returns the value and next offset."""
+    value = 0
+    shift = 0
+    while True:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, offset
+
+
+def delta_value_keys(mask):
+    """The value names, in order, included in a delta record for a mask."""
+    keys = []
+    if mask & 0x01: keys += ["AX", "AY", "AZ"]
+    if mask & 0x02: keys += ["MX", "MY", "MZ"]
+    if mask & (0x04 | 0x08 | 0x10): keys += ["BTN"]
+    if mask & 0x20: keys += ["T"]
+    if mask & 0x40: keys += ["L"]
+    if mask & 0x80: keys += ["S"]
+    return keys
+
+
+def parse_delta_record(frame, previous):
+    """
+    Decodes a delta periodic frame.
+
+    :param frame: The COBS encoded frame, without the 0x00 delimiter.
+    :param previous: The values dictionary from the previous record, or None
+                     if there is no valid previous record.
+
+    :raises Exception: If the CRC or the record length is not valid.
+
+    :return: The values dictionary, or None if the record is a delta and
+             there is no valid previous record to apply it to.
+    """
+    record = cobs_decode(frame)
+    crc, = struct.unpack_from("<H", record, len(record) - 2)
+    if crc != crc16_ccitt(record[:-2]):
+        raise Exception(f"Delta record CRC mismatch: {record}")
+
+    flags, seq, mask = struct.unpack_from("<BHB", record, 0)
+    keyframe = bool(flags & 0x01)
+    if not keyframe and (previous is None or previous["P"] != ((seq - 1) & 0xFFFF)):
+        # Dropped record, wait for the next keyframe
+        return None
+
+    values = {"P": seq, "K": keyframe}
+    offset = 4
+    for key in delta_value_keys(mask):
+        zigzag, offset = read_varint(record, offset)
+        delta = (zigzag >> 1) ^ -(zigzag & 1)
+        base = 0 if keyframe else previous[key]
+        value = (base + delta) & 0xFFFFFFFF
+        values[key] = value - (1 << 32) if value & 0x80000000 else value
+    if offset != len(record) - 2:
+        raise Exception(f"Delta record length does not match mask: {record}")
+    return values
+
+
+def test_dstart_stop(ubit_serial):
+    """
+    Test the delta start command to stream data for 1 second and stop.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    test_cmd(ubit_serial, "Delta keyframe interval", "DKEY[10]")
+    test_cmd(ubit_serial, "Start", "DSTART[PABFMLTS]", "DSTART[]")
+
+    print("Printing all delta periodic messages received for 1 second...")
+    keyframes_received = 0
+    previous = None
+    timeout_time = time.time() + 1
+    while time.time() < timeout_time:
+        frame = ubit_serial.read_until(b"\x00")
+        if len(frame) > 0 and frame.endswith(b"\x00"):
+            previous = parse_delta_record(frame[:-1], previous)
+            print(f"\t(DEVICE 🔁) {previous}")
+            if previous and previous["K"]:
+                keyframes_received += 1
+    if keyframes_received < 2:
+        raise Exception(f"Expected multiple keyframes, received {keyframes_received}.")
+
+    stop_binary_stream(ubit_serial)
+
+
+def stop_binary_stream(ubit_serial):
+    """
+    Sends the stop command while binary periodic frames are being received,
+    and reads the raw data until the response is found.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+
+    :raises Exception: If the stop response is not received.
+    """
+    sent_cmd, _, _ = send_command(ubit_serial, "STOP[]", wait_response=False)
+    print(f"\t(SENT   ➡️) {sent_cmd}")
+    expected_response = b"R" + sent_cmd[1:] + b"\n"
+    received = b""
+    timeout_time = time.time() + 1
+    while expected_response not in received and time.time() < timeout_time:
+        received += ubit_serial.read(ubit_serial.in_waiting or 1)
+    if expected_response not in received:
+        raise Exception(f"Stop command failed, response not found in: {received}")
+    print("Stop command successful.")
+
+
+def test_bstart_stop(ubit_serial, sensors="PABFMLTS", batch_size=1):
+    """
+    Test the binary start command to stream data for 1 second and stop.
+
+    The binary frames are delimited by 0x00 bytes, and any command response
+    is a text line that starts with "R" and is placed before a frame.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    :param sensors: The sensors to enable in the start command.
+    :param batch_size: The expected number of samples in each frame.
+    """
+    test_cmd(ubit_serial, "Start", f"BSTART[{sensors}]", "BSTART[]")
+
+    print("Printing all binary periodic messages received for 1 second...")
+    frames_received = 0
+    timeout_time = time.time() + 1
+    while time.time() < timeout_time:
+        frame = ubit_serial.read_until(b"\x00")
+        if len(frame) > 0 and frame.endswith(b"\x00"):
+            samples = parse_binary_record(frame[:-1])
+            print(f"\t(DEVICE 🔁) {samples}")
+            if len(samples) != batch_size:
+                raise Exception(f"Expected {batch_size} samples per frame, received {len(samples)}.")
+            frames_received += 1
+    if frames_received == 0:
+        raise Exception("No binary periodic messages received.")
+
+    stop_binary_stream(ubit_serial)
+
+
+def test_capture(ubit_serial, samples=500, rate_hz=400):
+    """
+    Test an accelerometer burst capture, and that all the samples are
+    received in order in the binary frames sent once it finishes.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    :param samples: The number of samples to capture.
+    :param rate_hz: The capture sample rate.
+    """
+    test_cmd(ubit_serial, "Capture", f"CAP[{samples},{rate_hz}]")
+    test_cmd(ubit_serial, "Capture (busy)", "CAP[10,100]", "ERROR[2]")
+
+    received = []
+    timeout_time = time.time() + (samples / rate_hz) + 2
+    while len(received) < samples and time.time() < timeout_time:
+        frame = ubit_serial.read_until(b"\x00")
+        if len(frame) > 0 and frame.endswith(b"\x00"):
+            frame_samples = parse_binary_record(frame[:-1])
+            if frame_samples[0]["P"] != len(received):
+                raise Exception(f"Capture sample {len(received)} missing: {frame_samples}")
+            received += frame_samples
+    if len(received) != samples:
+        raise Exception(f"Expected {samples} capture samples, received {len(received)}.")
+    print(f"\t{len(received)} samples, first {received[0]}, last {received[-1]}")
+
+    # Once the capture has been sent, commands and periodic messages work as usual
+    test_cmd(ubit_serial, "Handshake", "HS[]", "HS[1]")
+
+
+def test_batch(ubit_serial):
+    """
+    Test the batched binary periodic messages with a short period.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    """
+    ERROR_CODE = 1
+    # Short periods are only accepted when batching
+    test_cmd(ubit_serial, "Period (error)", "PER[5]", f"ERROR[{ERROR_CODE}]")
+    test_cmd(ubit_serial, "Batch", "BATCH[8]")
+    test_cmd(ubit_serial, "Batch (read)", "BATCH[]", "BATCH[8]")
+    test_cmd(ubit_serial, "Period", "PER[5]")
+    test_cmd(ubit_serial, "Batch (error 1)", "BATCH[1]", f"ERROR[{ERROR_CODE}]")
+    test_cmd(ubit_serial, "Batch (error 2)", "BATCH[33]", f"ERROR[{ERROR_CODE}]")
+    # Text formats can't be started with short periods
+    test_cmd(ubit_serial, "Start (error)", "START[A]", f"ERROR[{ERROR_CODE}]")
+
+    test_bstart_stop(ubit_serial, sensors="AB", batch_size=8)
+
+    # Nor can the period be shortened once a text format is running
+    test_cmd(ubit_serial, "Period", "PER[20]")
+    test_cmd(ubit_serial, "Start", "START[A]", "START[]")
+    test_cmd(ubit_serial, "Period (error)", "PER[2]", f"ERROR[{ERROR_CODE}]", periodic_error=False)
+    test_cmd(ubit_serial, "Stop", "STOP[]", periodic_error=False)
+    test_cmd(ubit_serial, "Batch", "BATCH[1]")
+
+
+def test_baudrate(ubit_serial, baudrate=921600):
+    """
+    Test switching the serial port to a faster baud rate, streaming all the
+    sensors every 10 ms, and switching back. Then test that the micro:bit goes
+    back to 115200 if a switch is not confirmed.
+
+    :param ubit_serial: The serial connection to the micro:bit.
+    :param baudrate: The faster baud rate to switch to.
+    """
+    test_cmd(ubit_serial, "Baud rate (read)", "BAUD[]", "BAUD[115200]")
+    test_cmd(ubit_serial, "Baud rate (switch)", f"BAUD[{baudrate}]")
+    ubit_serial.baudrate = baudrate
+    test_cmd(ubit_serial, "Baud rate (confirm)", f"BAUD[{baudrate}]")
+
+    test_cmd(ubit_serial, "Periodic", "PER[10]")
+    test_cmd(ubit_serial, "Start", "START[PABFMLTS]", "START[]")
+    periodic_msgs = []
+    timeout_time = time.time() + 1
+    while time.time() < timeout_time:
+        serial_line = ubit_serial.readline()
+        if not serial_line.startswith(b"P["):
+            raise Exception(f"Unexpected periodic message: {serial_line}")
+        periodic_msgs.append(serial_line)
+    test_cmd(ubit_serial, "Stop", "STOP[]", periodic_error=False)
+    print(f"\t{len(periodic_msgs)} periodic messages in 1 second")
+    if len(periodic_msgs) < 95:
+        raise Exception(f"Only {len(periodic_msgs)} periodic messages received in 1 second")
+    test_cmd(ubit_serial, "Periodic", "PER[20]")
+
+    test_cmd(ubit_serial, "Baud rate (switch)", "BAUD[115200]")
+    ubit_serial.baudrate = 115200
+    test_cmd(ubit_serial, "Baud rate (confirm)", "BAUD[115200]")
+
+    # Without the confirmation the micro:bit goes back to 115200 after the timeout
+    test_cmd(ubit_serial, "Baud rate (switch)", f"BAUD[{baudrate}]")
+    time.sleep(1.5)
+    ubit_serial.reset_input_buffer()
+    test_cmd(ubit_serial, "Baud rate (read)", "BAUD[]", "BAUD[115200]")
+
+
 def connect_serial():
     print("Connecting to device serial..")
     microbit_port = find_microbit_serial_port()
@@ -236,6 +705,7 @@ def main():
     ERROR_CODE = 1
 
     test_cmd(ubit_serial, "Handshake", "HS[]", "HS[1]")
+    test_pipelined_commands(ubit_serial)
 
     test_radio_frequency(ubit_serial)
     test_cmd(ubit_serial, "Radio Frequency (error 1)", "RF[84]", f"ERROR[{ERROR_CODE}]")
@@ -263,9 +733,37 @@ def main():
     test_cmd(ubit_serial, "Start (error)", "START[PABFMLTSZ]", f"ERROR[{ERROR_CODE}]")
     test_cmd(ubit_serial, "Start (error)", "START[20]", f"ERROR[{ERROR_CODE}]")
     test_cmd(ubit_serial, "Start (error)", "START[-1]", f"ERROR[{ERROR_CODE}]")
+    test_cmd(ubit_serial, "Jitter (error)", "JITTER[1]", f"ERROR[{ERROR_CODE}]")
 
     test_zstart_stop(ubit_serial)
-    # TODO: Once implemented, check error response for ZSTART command
+    test_cmd(ubit_serial, "Compact Start (error)", "ZSTART[PABFMLTSZ]", f"ERROR[{ERROR_CODE}]")
+
+    test_timestamps(ubit_serial)
+    test_stats(ubit_serial)
+    test_profile(ubit_serial)
+    test_radio_loss(ubit_serial)
+    test_multi_remote(ubit_serial)
+    test_radio_change(ubit_serial)
+    test_radio_slots(ubit_serial)
+    test_cmd(ubit_serial, "Timestamps (error)", "TS[3]", f"ERROR[{ERROR_CODE}]")
+
+    test_bstart_stop(ubit_serial)
+    test_cmd(ubit_serial, "Binary Start (error)", "BSTART[Z]", f"ERROR[{ERROR_CODE}]")
+
+    test_batch(ubit_serial)
+
+    test_capture(ubit_serial)
+    test_cmd(ubit_serial, "Capture (error 1)", "CAP[0,400]", f"ERROR[{ERROR_CODE}]")
+    test_cmd(ubit_serial, "Capture (error 2)", "CAP[100]", f"ERROR[{ERROR_CODE}]")
+    test_cmd(ubit_serial, "Capture (error 3)", "CAP[100,1001]", f"ERROR[{ERROR_CODE}]")
+
+    test_baudrate(ubit_serial)
+    test_cmd(ubit_serial, "Baud rate (error)", "BAUD[9600]", f"ERROR[{ERROR_CODE}]")
+
+    test_dstart_stop(ubit_serial)
+    test_cmd(ubit_serial, "Delta Start (error)", "DSTART[Z]", f"ERROR[{ERROR_CODE}]")
+    test_cmd(ubit_serial, "Delta keyframe interval (read)", "DKEY[]", "DKEY[10]")
+    test_cmd(ubit_serial, "Delta keyframe interval (error)", "DKEY[0]", f"ERROR[{ERROR_CODE}]")
 
     print("\n✅ All tests passed.")
 